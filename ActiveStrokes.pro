@@ -10,3 +10,5 @@ SUBDIRS += qglviewer
 SUBDIRS += libnpr
 SUBDIRS += libas
 SUBDIRS += qviewer
+SUBDIRS += asbench
+SUBDIRS += asbatch
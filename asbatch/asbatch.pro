@@ -0,0 +1,80 @@
+CONFIG += debug_and_release
+
+CONFIG(release, debug|release) {
+	DBGNAME = release
+}
+else {
+	DBGNAME = debug
+}
+DESTDIR = $${DBGNAME}
+
+win32 {
+    TEMPLATE = vcapp
+    UNAME = Win32
+}
+else {
+    TEMPLATE = app
+    TRIMESH = trimesh
+    macx {
+        DEFINES += DARWIN
+        UNAME = Darwin
+        CONFIG -= app_bundle
+        LIBS += -framework CoreFoundation -framework OpenGL
+    }
+    else {
+        QMAKE_CXXFLAGS += -fopenmp
+        QMAKE_LFLAGS += -fopenmp
+        DEFINES += LINUX
+        UNAME = Linux
+        LIBS += -lGLU
+    }
+}
+
+TRIMESH = trimesh
+
+QT += opengl xml
+
+equals (QT_MAJOR_VERSION, 6) {
+	QT += gui widgets openglwidgets
+}
+
+TARGET = asbatch
+
+# Dependents first for the static link order
+PRE_TARGETDEPS += ../libas/$${DBGNAME}/libas.a
+DEPENDPATH += ../libas/include
+INCLUDEPATH += ../libas/include
+LIBS += -L../libas/$${DBGNAME} -las
+
+PRE_TARGETDEPS += ../libnpr/$${DBGNAME}/libnpr.a
+DEPENDPATH += ../libnpr/include
+INCLUDEPATH += ../libnpr/include
+LIBS += -L../libnpr/$${DBGNAME} -lnpr
+
+PRE_TARGETDEPS += ../libgq/$${DBGNAME}/libgq.a
+DEPENDPATH += ../libgq/include
+INCLUDEPATH += ../libgq/include
+LIBS += -L../libgq/$${DBGNAME} -lgq
+
+PRE_TARGETDEPS += ../demoutils/$${DBGNAME}/libdemoutils.a
+DEPENDPATH += ../demoutils/include
+INCLUDEPATH += ../demoutils/include
+LIBS += -L../demoutils/$${DBGNAME} -ldemoutils
+
+PRE_TARGETDEPS += ../qglviewer/$${DBGNAME}/libqglviewer.a
+DEPENDPATH += ../qglviewer
+INCLUDEPATH += ../qglviewer
+LIBS += -L../qglviewer/$${DBGNAME} -lqglviewer
+DEFINES += QGLVIEWER_STATIC
+
+PRE_TARGETDEPS += ../trimesh2/$${DBGNAME}/libtrimesh.a
+DEPENDPATH += ../trimesh2/include
+INCLUDEPATH += ../trimesh2/include
+LIBS += -L../trimesh2/$${DBGNAME} -l$${TRIMESH}
+
+INCLUDEPATH += ../eigen3
+
+CONFIG += console
+
+# Input
+SOURCES += src/*.cc
@@ -0,0 +1,225 @@
+/*****************************************************************************\
+
+main.cc
+Authors:
+    Pierre Benard (pierre.benard@laposte.net),
+    Forrester Cole (fcole@csail.mit.edu),
+    Jingwan Lu (jingwanl@princeton.edu)
+Copyright (c) 2012 Pierre Benard, Forrester Cole, Jingwan Lu
+
+asbatch is distributed under the terms of the GNU General Public License.
+See the COPYING file for details.
+
+\*****************************************************************************/
+
+// Replays a sequence recorded by qviewer ("Current->Record tracking inputs")
+// through ASSnakes without any GL context and reports per-stage timings.
+
+#include "ASSnakes.h"
+#include "ASClipPath.h"
+
+#include "DialsAndKnobs.h"
+#include "Stats.h"
+#include "Profiler.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTextStream>
+#include <QStringList>
+#include <QVariant>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+
+struct FrameRecord {
+    int      frame;
+    bool     init;
+    bool     useMotion;
+    GLint    viewport[4];
+    GLdouble depthRange[2];
+};
+
+struct StageTimes {
+    StageTimes() : total(0.0), min(1e30), max(0.0), count(0) {}
+    double total, min, max;
+    int    count;
+};
+
+static void printUsage(const char *myname)
+{
+    fprintf(stderr, "\n Usage    : %s <recording dir> [-r repeat] [-t trace.json] [-d \"dial name=value\"]...\n\n", myname);
+    exit(1);
+}
+
+static bool readSequence(const QString& dir, QList<FrameRecord>& frames)
+{
+    QFile file(dir + "/sequence.txt");
+    if(!file.open(QIODevice::ReadOnly | QIODevice::Text)){
+        qWarning("Cannot read %s", qPrintable(file.fileName()));
+        return false;
+    }
+
+    QTextStream in(&file);
+    while(!in.atEnd()){
+        QString line = in.readLine().trimmed();
+        if(line.isEmpty() || line.startsWith("#"))
+            continue;
+        QStringList fields = line.simplified().split(" ");
+        if(fields.size() != 9){
+            qWarning("Malformed line in %s: %s", qPrintable(file.fileName()), qPrintable(line));
+            return false;
+        }
+        FrameRecord f;
+        f.frame     = fields[0].toInt();
+        f.init      = fields[1].toInt() != 0;
+        f.useMotion = fields[2].toInt() != 0;
+        for(int i=0; i<4; i++)
+            f.viewport[i] = fields[3+i].toInt();
+        f.depthRange[0] = fields[7].toDouble();
+        f.depthRange[1] = fields[8].toDouble();
+        frames << f;
+    }
+    return !frames.isEmpty();
+}
+
+static QString frameFile(const QString& dir, const QString& prefix, int frame)
+{
+    return dir + "/" + prefix + "." + QString("%1").arg(frame,4,10,QLatin1Char('0')) + ".float";
+}
+
+int main( int argc, char** argv )
+{
+    QCoreApplication app(argc, argv);
+
+    QStringList args = app.arguments();
+    QString dir;
+    int repeat = 1;
+    QString tracePath;
+    for(int i=1; i<args.size(); i++){
+        if(args[i] == "-r" && i+1 < args.size()){
+            repeat = std::max(1, args[++i].toInt());
+        }else if(args[i] == "-t" && i+1 < args.size()){
+            tracePath = args[++i];
+        }else if(args[i] == "-d" && i+1 < args.size()){
+            QStringList dial = args[++i].split("=");
+            dkValue* value = dial.size() == 2 ? dkValue::find(dial[0]) : NULL;
+            if(!value){
+                qWarning("Unknown dial %s", qPrintable(args[i]));
+                return 1;
+            }
+            value->setFromVariant(QVariant(dial[1]));
+        }else if(dir.isEmpty()){
+            dir = args[i];
+        }else{
+            printUsage(argv[0]);
+        }
+    }
+    if(dir.isEmpty())
+        printUsage(argv[0]);
+
+    QList<FrameRecord> frames;
+    if(!readSequence(dir, frames))
+        return 1;
+
+    ASClipPathSet pathSet;
+    ASSnakes snakes;
+    QVector<vec>   positions2D, positions;
+    QVector<vec2>  tangents;
+    QVector<float> strengths;
+    GQFloatImage   refImg, geomFlow;
+
+    Stats& perf = Stats::instance();
+    QStringList stageNames;
+    QHash<QString,StageTimes> stages;
+    StageTimes tracking;
+    qint64 nbSamples = 0;
+
+    QElapsedTimer timer;
+
+    // Timed blocks of all threads, for the trace and the percentiles
+    Profiler::setEnabled(!tracePath.isEmpty());
+
+    for(int r=0; r<repeat; r++){
+        bool initialized = false;
+        snakes.clear();
+
+        for(int k=0; k<frames.size(); k++){
+            const FrameRecord& f = frames.at(k);
+
+            // File reading is not timed
+            if(!ASClipPathSet::loadSamples(frameFile(dir,"samples",f.frame), positions2D, positions, tangents, strengths))
+                return 1;
+            bool init = f.init || !initialized;
+            if(!init && (!refImg.load(frameFile(dir,"ref",f.frame)) ||
+                         !geomFlow.load(frameFile(dir,"flow",f.frame)))){
+                qWarning("Missing reference image or flow for frame %d", f.frame);
+                return 1;
+            }
+
+            perf.reset();
+            timer.start();
+            pathSet.initFromPoints(positions2D, positions, tangents, strengths, f.viewport, f.depthRange);
+            if(pathSet.size() > 0){
+                if(init){
+                    snakes.clear();
+                    snakes.init(pathSet,true);
+                    initialized = true;
+                }else{
+                    snakes.updateRefImage(refImg, &geomFlow, NULL, pathSet, f.useMotion);
+                }
+            }
+            double elapsed = timer.nsecsElapsed() * 1e-6;
+
+            // Initialization frames are not representative of the tracking
+            if(init)
+                continue;
+
+            nbSamples += positions.size();
+            tracking.total += elapsed;
+            tracking.min = std::min(tracking.min, elapsed);
+            tracking.max = std::max(tracking.max, elapsed);
+            tracking.count++;
+
+            for(int i=0; i<perf.numTimers(); i++){
+                double value = perf.timerValue(i) * 1000.0;
+                if(value <= 0.0)
+                    continue;
+                const QString& name = perf.timerName(i);
+                if(!stages.contains(name))
+                    stageNames << name;
+                StageTimes& s = stages[name];
+                s.total += value;
+                s.min = std::min(s.min, value);
+                s.max = std::max(s.max, value);
+                s.count++;
+            }
+        }
+    }
+
+    if(tracking.count == 0){
+        qWarning("No tracked frame in %s", qPrintable(dir));
+        return 1;
+    }
+
+    printf("%d tracked frames, %.0f samples per frame\n\n", tracking.count, double(nbSamples) / tracking.count);
+    printf("%-40s %10s %10s %10s %8s\n", "stage", "mean (ms)", "min (ms)", "max (ms)", "frames");
+    for(int i=0; i<stageNames.size(); i++){
+        const StageTimes& s = stages[stageNames.at(i)];
+        printf("%-40s %10.3f %10.3f %10.3f %8d\n", qPrintable(stageNames.at(i)),
+               s.total / s.count, s.min, s.max, s.count);
+    }
+    printf("%-40s %10.3f %10.3f %10.3f %8d\n", "Total", tracking.total / tracking.count,
+           tracking.min, tracking.max, tracking.count);
+    printf("\n%.1f frames/s\n", 1000.0 * tracking.count / tracking.total);
+
+    if(!tracePath.isEmpty()){
+        Profiler::setEnabled(false);
+        printf("\n%s", qPrintable(Profiler::summary()));
+        if(!Profiler::saveChromeTrace(tracePath))
+            return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,533 @@
+/*****************************************************************************\
+
+main.cc
+Authors:
+    Pierre Benard (pierre.benard@laposte.net),
+    Forrester Cole (fcole@csail.mit.edu),
+    Jingwan Lu (jingwanl@princeton.edu)
+Copyright (c) 2012 Pierre Benard, Forrester Cole, Jingwan Lu
+
+asbench is distributed under the terms of the GNU General Public License.
+See the COPYING file for details.
+
+\*****************************************************************************/
+
+#include "ASDeform.h"
+#include "ASBandedSolver.h"
+#include "ASSimpleGrid.h"
+#include "ASClipPath.h"
+#include "ASSnakes.h"
+#include "ASContour.h"
+#include "ASBrushPath.h"
+#include "ASBrushPathFitting.h"
+#include "ASRenderer.h"
+
+#include "GQImage.h"
+#include "GQCPUImageProcessing.h"
+#include "DialsAndKnobs.h"
+#include "Profiler.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QStringList>
+#include <QTextStream>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+// Relaxation defaults (see ASDeform.cc)
+const float k_alpha = 0.001f;
+const float k_beta  = 0.001f;
+const float k_step  = 0.5f;
+const int   k_solvesPerFactorization = 5;
+
+// Time one resampling block of ASDeform::iterate: one factorization
+// followed by a few solves of the x and y right-hand sides.
+static void benchSolver(int n, bool closed, int reps)
+{
+    std::vector<vec2> rhs(n);
+    for(int i=0; i<n; i++)
+        rhs[i] = vec2(float(rand())/RAND_MAX * 1000.f, float(rand())/RAND_MAX * 1000.f);
+
+    Eigen::VectorXf bx(n), by(n), xx, xy;
+    for(int i=0; i<n; i++){
+        bx(i) = rhs[i][0];
+        by(i) = rhs[i][1];
+    }
+
+    QElapsedTimer timer;
+
+    timer.start();
+    for(int r=0; r<reps; r++){
+        ASDeform::SparseMatrixType A(n,n);
+        ASDeform::buildMatrix(A, n, closed, k_alpha, k_beta, k_step);
+        Eigen::SimplicialLDLT<ASDeform::SparseMatrixType> sparseLDLT;
+        sparseLDLT.compute(A);
+        for(int s=0; s<k_solvesPerFactorization; s++){
+            xx = sparseLDLT.solve(bx);
+            xy = sparseLDLT.solve(by);
+        }
+    }
+    double eigenTime = timer.nsecsElapsed() * 1e-3 / reps;
+
+    ASBandedSolver solver;
+    std::vector<vec2> x(n);
+    timer.restart();
+    for(int r=0; r<reps; r++){
+        ASDeform::buildMatrix(solver, n, closed, k_alpha, k_beta, k_step);
+        solver.factorize();
+        for(int s=0; s<k_solvesPerFactorization; s++){
+            x = rhs;
+            solver.solve(&x[0]);
+        }
+    }
+    double bandedTime = timer.nsecsElapsed() * 1e-3 / reps;
+
+    float maxDiff = 0.f;
+    for(int i=0; i<n; i++){
+        maxDiff = std::max(maxDiff, fabsf(x[i][0] - xx(i)));
+        maxDiff = std::max(maxDiff, fabsf(x[i][1] - xy(i)));
+    }
+
+    fprintf(stderr, "%6d %-6s %12.2f %12.2f %8.1fx %12g\n", n, closed ? "closed" : "open",
+            eigenTime, bandedTime, eigenTime / bandedTime, maxDiff);
+}
+
+// Clip paths as random polylines in a 1280x720 viewport
+const int   k_viewportWidth  = 1280;
+const int   k_viewportHeight = 720;
+const float k_coverRadius    = 4.f;
+const int   k_gridFrames     = 20;
+
+static void buildPaths(ASClipPathSet& pathSet, int nbSamples)
+{
+    while(nbSamples > 0){
+        ASClipPath* path = new ASClipPath();
+        vec2 p(float(rand())/RAND_MAX * k_viewportWidth, float(rand())/RAND_MAX * k_viewportHeight);
+        float angle = float(rand())/RAND_MAX * 2.f * M_PI;
+        int length = std::min(nbSamples, 20 + rand() % 200);
+        for(int i=0; i<length; i++){
+            angle += (float(rand())/RAND_MAX - 0.5f) * 0.2f;
+            vec2 t(cos(angle),sin(angle));
+            p += t;
+            ASClipVertex* cv = new ASClipVertex(vec3(p[0],p[1],0.5f), vec2(i,0), i, path, 1.f, 1.f);
+            cv->setTangent(t);
+            path->addVertex(cv);
+        }
+        pathSet.addPath(path);
+        nbSamples -= length;
+    }
+}
+
+// Former layout: one heap allocated cell with its own lists per key
+struct LegacyCell {
+    QList<ASVertexContour*> contourVertices;
+    QList<ASVertexContour*> endPoints;
+    QList<ASClipVertex*>    clipVertices;
+};
+
+static int legacyQuery(QHash<int,LegacyCell*>& hash, ASSimpleGrid& grid, ASClipPathSet& pathSet)
+{
+    int nbNeighbors = 0;
+    for(int i=0; i<pathSet.size(); ++i){
+        for(int j=0; j<pathSet[i]->size(); ++j){
+            ASClipVertex* cv = (*pathSet[i])[j];
+            int key = grid.posToKey(cv->position2D());
+            for(int a=-1; a<=1; ++a){
+                for(int b=-1; b<=1; ++b){
+                    int key2 = key+a+b*grid.nbCols();
+                    if(hash.contains(key2)){
+                        const QList<ASClipVertex*> clipVertices = hash[key2]->clipVertices;
+                        for(int k=0; k<clipVertices.size(); ++k)
+                            if(dist2(cv->position2D(),clipVertices.at(k)->position2D()) <= k_coverRadius*k_coverRadius)
+                                nbNeighbors++;
+                    }
+                }
+            }
+        }
+    }
+    return nbNeighbors;
+}
+
+static int gridQuery(ASSimpleGrid& grid, ASClipPathSet& pathSet)
+{
+    int nbNeighbors = 0;
+    for(int i=0; i<pathSet.size(); ++i){
+        for(int j=0; j<pathSet[i]->size(); ++j){
+            ASClipVertex* cv = (*pathSet[i])[j];
+            int key = grid.posToKey(cv->position2D());
+            for(int a=-1; a<=1; ++a){
+                for(int b=-1; b<=1; ++b){
+                    ASCell* cell = grid.find(key+a+b*grid.nbCols());
+                    if(!cell)
+                        continue;
+                    for(int k=0; k<cell->nbClipVertices(); ++k)
+                        if(dist2(cv->position2D(),cell->clipVertex(k)->position2D()) <= k_coverRadius*k_coverRadius)
+                            nbNeighbors++;
+                }
+            }
+        }
+    }
+    return nbNeighbors;
+}
+
+// Time the grid construction and a 3x3 neighbourhood scan around every
+// clip vertex, as done by the topology phases, with both cell layouts.
+static void benchGrid(int nbSamples)
+{
+    ASClipPathSet pathSet;
+    buildPaths(pathSet, nbSamples);
+
+    ASSimpleGrid grid;
+    grid.setCellSize(ceil(k_coverRadius*2.0));
+
+    QElapsedTimer timer;
+    qint64 legacyBuild = 0, legacyScan = 0, gridBuild = 0, gridScan = 0;
+    int legacyCount = 0, gridCount = 0;
+
+    for(int f=0; f<k_gridFrames; f++){
+        timer.start();
+        grid.init(k_viewportWidth, pathSet, f);
+        gridBuild += timer.nsecsElapsed();
+
+        timer.restart();
+        gridCount = gridQuery(grid, pathSet);
+        gridScan += timer.nsecsElapsed();
+
+        // keys computed with the origin picked by the grid above
+        timer.restart();
+        QHash<int,LegacyCell*> hash;
+        for(int i=0; i<pathSet.size(); ++i){
+            for(int j=0; j<pathSet[i]->size(); ++j){
+                ASClipVertex* cv = (*pathSet[i])[j];
+                int key = grid.posToKey(cv->position2D());
+                if(!hash.contains(key))
+                    hash[key] = new LegacyCell;
+                hash[key]->clipVertices << cv;
+            }
+        }
+        legacyBuild += timer.nsecsElapsed();
+
+        timer.restart();
+        legacyCount = legacyQuery(hash, grid, pathSet);
+        legacyScan += timer.nsecsElapsed();
+        qDeleteAll(hash);
+    }
+
+    fprintf(stderr, "%8d %8d %12.1f %12.1f %12.1f %12.1f %s\n", nbSamples, grid.nbCells(),
+            legacyBuild * 1e-3 / k_gridFrames, gridBuild * 1e-3 / k_gridFrames,
+            legacyScan * 1e-3 / k_gridFrames, gridScan * 1e-3 / k_gridFrames,
+            legacyCount == gridCount ? "ok" : "MISMATCH");
+}
+
+// Synthetic line samples, one pixel apart, as extracted by ImageSpaceLines
+struct Scene {
+    QVector<vec>   positions2D;
+    QVector<vec>   positions;
+    QVector<vec2>  tangents;
+    QVector<float> strengths;
+};
+
+static void addCurve(Scene& scene, const std::vector<vec2>& points)
+{
+    float remaining = 0.f;
+    for(unsigned int i=1; i<points.size(); i++){
+        vec2 d = points[i] - points[i-1];
+        float l = len(d);
+        if(l <= 0.f)
+            continue;
+        vec2 t = d / l;
+        float s = remaining;
+        for(; s<l; s+=1.f){
+            vec2 p = points[i-1] + s * t;
+            if(p[0] < 0.f || p[1] < 0.f || p[0] >= k_viewportWidth || p[1] >= k_viewportHeight)
+                continue;
+            // clip coordinates of a [0,1] depth range
+            vec ndc(2.f * p[0] / k_viewportWidth - 1.f, 2.f * p[1] / k_viewportHeight - 1.f, 0.f);
+            scene.positions2D << ndc;
+            scene.positions << vec(p[0], p[1], 0.f);
+            scene.tangents << t;
+            scene.strengths << 1.f;
+        }
+        remaining = s - l;
+    }
+}
+
+static float random01()
+{
+    return float(rand())/RAND_MAX;
+}
+
+// Same primitives every frame (fixed seed), translated by "offset"
+static void buildScene(Scene& scene, const QString& kind, int scale, vec2 offset)
+{
+    scene = Scene();
+    srand(1);
+
+    std::vector<vec2> points;
+    if(kind == "circles"){
+        for(int k=0; k<30*scale; k++){
+            vec2 c(random01() * k_viewportWidth, random01() * k_viewportHeight);
+            float r = 10.f + random01() * 70.f;
+            int n = int(2.f * M_PI * r);
+            points.clear();
+            for(int i=0; i<=n; i++)
+                points.push_back(c + offset + r * vec2(cos(2.f * M_PI * i / n), sin(2.f * M_PI * i / n)));
+            addCurve(scene, points);
+        }
+    }else if(kind == "spirals"){
+        for(int k=0; k<4*scale; k++){
+            vec2 c(random01() * k_viewportWidth, random01() * k_viewportHeight);
+            float pitch = 3.f + random01() * 5.f;
+            points.clear();
+            for(float a=0.f; pitch * a / (2.f * M_PI) < 150.f; a+=0.02f){
+                float r = pitch * a / (2.f * M_PI);
+                points.push_back(c + offset + r * vec2(cos(a), sin(a)));
+            }
+            addCurve(scene, points);
+        }
+    }else if(kind == "noise"){
+        // Streamlines of a smooth random direction field
+        float fx = 0.005f + random01() * 0.01f, fy = 0.005f + random01() * 0.01f;
+        for(int k=0; k<60*scale; k++){
+            vec2 p(random01() * k_viewportWidth, random01() * k_viewportHeight);
+            int length = 50 + rand() % 250;
+            points.clear();
+            for(int i=0; i<length; i++){
+                float angle = 4.f * sin(p[0] * fx) * cos(p[1] * fy);
+                points.push_back(p + offset);
+                p += vec2(cos(angle), sin(angle));
+            }
+            addCurve(scene, points);
+        }
+    }else if(kind == "hatching"){
+        // Patches of short parallel strokes, 3 pixels apart
+        for(int k=0; k<20*scale; k++){
+            vec2 c(random01() * k_viewportWidth, random01() * k_viewportHeight);
+            float angle = random01() * M_PI;
+            vec2 t(cos(angle), sin(angle)), n(-t[1], t[0]);
+            for(int i=0; i<12; i++){
+                vec2 p = c + offset + (i * 3.f) * n;
+                points.clear();
+                points.push_back(p);
+                points.push_back(p + 30.f * t);
+                addCurve(scene, points);
+            }
+        }
+    }
+}
+
+// Lines rendered as white on black, as in the offscreen reference image
+static void rasterize(const Scene& scene, GQFloatImage& refImg)
+{
+    refImg.resize(k_viewportWidth, k_viewportHeight, 1);
+    memset(refImg.raster(), 0, k_viewportWidth * k_viewportHeight * sizeof(float));
+    for(int i=0; i<scene.positions.size(); i++)
+        refImg.setPixelChannel(int(scene.positions[i][0]), int(scene.positions[i][1]), 0, scene.strengths[i]);
+}
+
+extern dkFloat k_lineSegmentCost;
+extern dkFloat k_arcSegmentCost;
+extern dkFloat k_arcTargetRadius;
+extern dkFloat k_arcRadiusWeight;
+
+const int k_kernelReps = 5;
+
+// Times the tracking of a moving synthetic scene stage by stage (the timers
+// of ASSnakes), then each kernel in isolation on the state of the last
+// frame. Everything goes through the Profiler, read back with stages().
+static void benchStages(QTextStream& json, const QString& kind, int scale, int nbFrames, bool first)
+{
+    Profiler::clear();
+    Profiler::setEnabled(true);
+
+    const GLint viewport[4] = { 0, 0, k_viewportWidth, k_viewportHeight };
+    const GLdouble depthRange[2] = { 0.0, 1.0 };
+
+    Scene scene;
+    GQFloatImage refImg;
+    ASClipPathSet pathSet;
+    ASSnakes snakes;
+
+    int trackingId = Profiler::timerId("Tracking: frame");
+    for(int f=0; f<nbFrames; f++){
+        buildScene(scene, kind, scale, vec2(2.f * f, 1.f * f));
+        rasterize(scene, refImg);
+
+        qint64 start = Profiler::now();
+        pathSet.initFromPoints(scene.positions2D, scene.positions, scene.tangents,
+                               scene.strengths, viewport, depthRange);
+        if(f == 0)
+            snakes.init(pathSet, true);
+        else
+            snakes.updateRefImage(refImg, NULL, NULL, pathSet, false);
+        Profiler::record(trackingId, start, Profiler::now());
+    }
+
+    int closestId = Profiler::timerId("Kernel: findClosestEdgeRef");
+    for(int r=0; r<k_kernelReps; r++){
+        for(int i=0; i<snakes.nbContours(); i++){
+            ASContour::ContourIterator it = snakes.at(i)->iterator();
+            qint64 start = Profiler::now();
+            while(it.hasNext()){
+                ASVertexContour* v = it.next();
+                snakes.findClosestEdgeRef(v->position(), v->tangent(), true, snakes.coverRadius());
+            }
+            Profiler::record(closestId, start, Profiler::now());
+        }
+    }
+
+    int gridId = Profiler::timerId("Kernel: ASSimpleGrid::init");
+    ASSimpleGrid grid;
+    grid.setCellSize(ceil(k_coverRadius*2.0));
+    for(int r=0; r<k_kernelReps; r++){
+        qint64 start = Profiler::now();
+        grid.init(k_viewportWidth, pathSet, r);
+        Profiler::record(gridId, start, Profiler::now());
+    }
+
+    int lineId = Profiler::timerId("Kernel: line fitting");
+    int arcId = Profiler::timerId("Kernel: arc fitting");
+    ASBrushPathFitting& fit = ASBrushPathFitting::threadContext();
+    for(int i=0; i<snakes.nbBrushPaths(); i++){
+        const ASBrushPath* bp = snakes.brushPath(i);
+        qint64 start = Profiler::now();
+        fit.findBreakingPositionForLine(k_lineSegmentCost, bp);
+        qint64 middle = Profiler::now();
+        fit.findBreakingPositionForArc(k_arcSegmentCost, k_arcTargetRadius, k_arcRadiusWeight, bp);
+        Profiler::record(lineId, start, middle);
+        Profiler::record(arcId, middle, Profiler::now());
+    }
+
+    int segmentsId = Profiler::timerId("Kernel: ASRenderer::buildSegments");
+    std::vector<ASRenderer::Segment> segments;
+    std::vector<ASRenderer::PathRange> ranges;
+    for(int r=0; r<k_kernelReps; r++){
+        qint64 start = Profiler::now();
+        ASRenderer::buildSegments(snakes, segments, ranges, 16.f);
+        Profiler::record(segmentsId, start, Profiler::now());
+    }
+
+    // Last, since they move the contours
+    int resampleId = Profiler::timerId("Kernel: ASContour::resample");
+    for(int i=0; i<snakes.nbContours(); i++){
+        qint64 start = Profiler::now();
+        snakes.at(i)->resample();
+        Profiler::record(resampleId, start, Profiler::now());
+    }
+    snakes.invalidateBrushPaths();
+
+    int iterateId = Profiler::timerId("Kernel: ASDeform::iterate");
+    GQFloatImage fext;
+    std::vector<float> buffer, scratch;
+    GQCPUImageProcessing::blurAndGrad(2, refImg, fext, buffer, scratch);
+    ASDeform deformer;
+    for(int i=0; i<snakes.nbContours(); i++){
+        qint64 start = Profiler::now();
+        deformer.iterate(*snakes.at(i), fext);
+        Profiler::record(iterateId, start, Profiler::now());
+    }
+
+    Profiler::setEnabled(false);
+
+    json << (first ? "" : ",\n") << "  {\"scene\": \"" << kind << "\", \"scale\": " << scale
+         << ", \"frames\": " << nbFrames << ", \"samples\": " << scene.positions.size()
+         << ", \"contours\": " << snakes.nbContours() << ", \"brushPaths\": " << snakes.nbBrushPaths()
+         << ", \"segments\": " << int(segments.size()) << ",\n   \"stages\": [";
+    QList<ProfilerStage> stages = Profiler::stages();
+    for(int i=0; i<stages.size(); i++){
+        const ProfilerStage& s = stages.at(i);
+        json << (i ? "," : "") << "\n    {\"name\": \"" << s.name << "\", \"calls\": " << s.calls
+             << ", \"mean_ms\": " << s.mean << ", \"p50_ms\": " << s.p50
+             << ", \"p95_ms\": " << s.p95 << ", \"p99_ms\": " << s.p99 << "}";
+    }
+    json << "]}";
+
+    fprintf(stderr, "%-10s x%-3d %8d samples %6d contours %6d brush paths\n", qPrintable(kind), scale,
+            scene.positions.size(), snakes.nbContours(), snakes.nbBrushPaths());
+}
+
+int main( int argc, char** argv )
+{
+    QCoreApplication app(argc, argv);
+
+    srand(0);
+
+    // Run every benchmark unless some are named on the command line. The
+    // tables go to stderr, stdout only gets the JSON of the stages
+    QStringList args = app.arguments().mid(1);
+
+    // Options of the "stages" benchmark
+    QList<int> scales;
+    int nbFrames = 10;
+    QString jsonFile;
+    for(int i=0; i+1<args.size(); ){
+        if(args[i] == "-scale"){
+            scales << args[i+1].toInt();
+        }else if(args[i] == "-frames"){
+            nbFrames = std::max(1, args[i+1].toInt());
+        }else if(args[i] == "-json"){
+            jsonFile = args[i+1];
+        }else{
+            i++;
+            continue;
+        }
+        args.removeAt(i);
+        args.removeAt(i);
+    }
+    if(scales.isEmpty())
+        scales << 1 << 4;
+
+    if(args.isEmpty() || args.contains("solver")){
+        fprintf(stderr, "%6s %-6s %12s %12s %9s %12s\n", "n", "type", "eigen (us)", "banded (us)", "speedup", "max diff");
+
+        const int sizes[] = { 10, 30, 100, 300, 1000, 3000, 10000 };
+        for(unsigned int k=0; k<sizeof(sizes)/sizeof(int); k++){
+            int reps = std::max(3, 20000 / sizes[k]);
+            benchSolver(sizes[k], false, reps);
+            benchSolver(sizes[k], true, reps);
+        }
+    }
+
+    if(args.isEmpty() || args.contains("grid")){
+        fprintf(stderr, "%8s %8s %12s %12s %12s %12s\n", "samples", "cells", "hash (us)", "flat (us)", "hash scan", "flat scan");
+
+        const int samples[] = { 1000, 10000, 50000, 200000 };
+        for(unsigned int k=0; k<sizeof(samples)/sizeof(int); k++)
+            benchGrid(samples[k]);
+    }
+
+    if(args.isEmpty() || args.contains("stages")){
+        QFile file;
+        if(jsonFile.isEmpty()){
+            file.open(stdout, QIODevice::WriteOnly);
+        }else{
+            file.setFileName(jsonFile);
+            if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)){
+                qWarning("Cannot write %s", qPrintable(jsonFile));
+                return 1;
+            }
+        }
+
+        QTextStream json(&file);
+        json << "[\n";
+        const char* kinds[] = { "circles", "spirals", "noise", "hatching" };
+        bool first = true;
+        for(int s=0; s<scales.size(); s++){
+            for(unsigned int k=0; k<sizeof(kinds)/sizeof(char*); k++){
+                benchStages(json, kinds[k], scales[s], nbFrames, first);
+                json.flush();
+                first = false;
+            }
+        }
+        json << "\n]\n";
+    }
+
+    return 0;
+}
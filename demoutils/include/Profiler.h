@@ -0,0 +1,66 @@
+/*****************************************************************************\
+
+Profiler.h
+Authors:
+    Pierre Benard (pierre.benard@laposte.net),
+    Forrester Cole (fcole@csail.mit.edu),
+    Jingwan Lu (jingwanl@princeton.edu)
+Copyright (c) 2012 Pierre Benard, Forrester Cole, Jingwan Lu
+
+Records every timed block (see __TIME_CODE_BLOCK in Stats.h) from every
+thread, for export as a Chrome trace (chrome://tracing, Perfetto) or as
+per-stage percentiles. Timer names are interned once per call site and
+each thread appends to its own buffer, so recording takes no lock.
+
+demoutils is distributed under the terms of the GNU General Public License.
+See the COPYING file for details.
+
+\*****************************************************************************/
+
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+#include <QList>
+#include <QString>
+#include <QtGlobal>
+
+#include <atomic>
+
+// Statistics of one timer over the recorded events, in milliseconds
+struct ProfilerStage
+{
+    QString name;
+    int     calls;
+    double  mean, p50, p95, p99;
+};
+
+class Profiler
+{
+  public:
+    // Id of a timer name, the same for every call with the same name
+    static int timerId( const char* name );
+    static int timerId( const QString& name );
+    static QString timerName( int id );
+
+    // Recording is off by default; the buffers are kept until clear()
+    static void setEnabled( bool enabled ) { _enabled.store(enabled, std::memory_order_relaxed); }
+    static bool isEnabled() { return _enabled.load(std::memory_order_relaxed); }
+
+    // Nanoseconds since the start of the program
+    static qint64 now();
+    static void record( int id, qint64 start, qint64 end );
+
+    // Not safe while other threads are recording
+    static void clear();
+
+    static bool saveChromeTrace( const QString& filename );
+    // Timers with at least one recorded event, in creation order
+    static QList<ProfilerStage> stages();
+    // Same, as a text table
+    static QString summary();
+
+  protected:
+    static std::atomic<bool> _enabled;
+};
+
+#endif // _PROFILER_H_
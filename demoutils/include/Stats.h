@@ -22,6 +22,8 @@ See the COPYING file for details.
 #include <QAbstractItemModel>
 #include <QDockWidget>
 
+#include "Profiler.h"
+
 using trimesh::timestamp;
 
 class QMenu;
@@ -40,8 +42,13 @@ class Stats : public QAbstractItemModel
     // Emits an update signal for attached views.
     void updateView();
 
+    // Timers and counters are only recorded from the thread the
+    // instance lives in, calls from worker threads are ignored.
     void startTimer( const QString& name );
     void stopTimer( const QString& name );
+    // Same, with the id of the name in the Profiler
+    void startTimer( int id );
+    void stopTimer( int id );
 
     void setCounter( const QString& name, float value );
     void addToCounter( const QString& name, float value );
@@ -86,7 +93,7 @@ class Stats : public QAbstractItemModel
       public:
         Record() : name(), category(NUM_CATEGORIES), stamp(), 
                    value(0), str_value(), touches_since_last_reset(0),
-                   parent(0), children() {}
+                   parent(0), children(), id(-1) {}
       public:
         QString     name;
         Category    category;
@@ -97,6 +104,7 @@ class Stats : public QAbstractItemModel
 
         Record*         parent;
         QList<Record*>  children;
+        int             id;
     };
     
 
@@ -105,10 +113,13 @@ class Stats : public QAbstractItemModel
     Stats() { init(); }
     bool init();
 
+    bool isOwnerThread() const;
+
     void clearCategory( Category which );
     void setChildValuesToZero( Record* record );
 
     int findTimer( const QString& name, const Record* parent );
+    int findTimer( int id, const Record* parent );
     int findTimer( const Record* pointer );
     int findCounter( const QString& name );
 
@@ -146,14 +157,28 @@ class StatsWidget : public QDockWidget
 //
 
 // When this object is created, it starts a timer.
-// When it passes out of scope, it stops the timer.
+// When it passes out of scope, it stops the timer. The block is also
+// recorded by the Profiler when it is enabled.
 class ScopeTimer
 {
 public:
-    ScopeTimer( const QString& name ) { _name = name; Stats::instance().startTimer(name); }
-    ~ScopeTimer() { Stats::instance().stopTimer(_name); }
+    ScopeTimer( const QString& name ) : _id(Profiler::timerId(name)) { start(); }
+    ScopeTimer( int id ) : _id(id) { start(); }
+    ~ScopeTimer()
+    {
+        if (_start >= 0)
+            Profiler::record(_id, _start, Profiler::now());
+        Stats::instance().stopTimer(_id);
+    }
 protected:
-    QString _name;
+    void start()
+    {
+        _start = Profiler::isEnabled() ? Profiler::now() : -1;
+        Stats::instance().startTimer(_id);
+    }
+
+    int    _id;
+    qint64 _start;
 };
 
 #ifndef DEMOUTILS_NO_TIMERS
@@ -161,7 +186,9 @@ protected:
 #define __STOP_TIMER(X) Stats::instance().stopTimer(X);
 #define __SET_COUNTER(X,Y) Stats::instance().setCounter((X),(Y));
 #define __ADD_TO_COUNTER(X,Y) Stats::instance().addToCounter((X),(Y));
-#define __TIME_CODE_BLOCK(X) ScopeTimer __scope_timer(X);
+// The name is interned once per call site
+#define __TIME_CODE_BLOCK(X) static const int __scope_timer_id = Profiler::timerId(X); \
+                             ScopeTimer __scope_timer(__scope_timer_id);
 #else
 #define __START_TIMER(X) ;
 #define __STOP_TIMER(X) ;
@@ -0,0 +1,260 @@
+/*****************************************************************************\
+
+Profiler.cc
+Authors:
+    Pierre Benard (pierre.benard@laposte.net),
+    Forrester Cole (fcole@csail.mit.edu),
+    Jingwan Lu (jingwanl@princeton.edu)
+Copyright (c) 2012 Pierre Benard, Forrester Cole, Jingwan Lu
+
+demoutils is distributed under the terms of the GNU General Public License.
+See the COPYING file for details.
+
+\*****************************************************************************/
+
+#include "Profiler.h"
+
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QStringList>
+#include <QTextStream>
+#include <QThread>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+std::atomic<bool> Profiler::_enabled(false);
+
+namespace {
+
+struct Event {
+    qint64 start;
+    qint64 end;
+    int    id;
+};
+
+const int k_chunkSize = 4096;
+
+// Written by its thread only. Chunks are never moved, so that readers can
+// go through the first count events while the thread keeps appending.
+struct ThreadBuffer {
+    int                 tid;
+    QString             name;
+    std::vector<Event*> chunks;
+    std::atomic<int>    count;
+};
+
+struct Registry {
+    QMutex                     mutex;
+    QHash<QString,int>         ids;
+    QStringList                names;
+    std::vector<ThreadBuffer*> buffers;
+};
+
+Registry& registry()
+{
+    static Registry r;
+    return r;
+}
+
+const std::chrono::steady_clock::time_point k_epoch = std::chrono::steady_clock::now();
+
+thread_local ThreadBuffer* t_buffer = NULL;
+
+ThreadBuffer* threadBuffer()
+{
+    if (!t_buffer)
+    {
+        Registry& r = registry();
+        QMutexLocker locker(&r.mutex);
+        t_buffer = new ThreadBuffer;
+        t_buffer->tid = int(r.buffers.size());
+        t_buffer->name = QThread::currentThread()->objectName();
+        if (t_buffer->name.isEmpty())
+            t_buffer->name = QString("Thread %1").arg(t_buffer->tid);
+        t_buffer->count.store(0);
+        r.buffers.push_back(t_buffer);
+    }
+    return t_buffer;
+}
+
+QString escaped( const QString& s )
+{
+    QString e = s;
+    e.replace("\\", "\\\\");
+    e.replace("\"", "\\\"");
+    return e;
+}
+
+double percentile( const std::vector<qint64>& sorted, double p )
+{
+    int i = std::min(int(p * sorted.size()), int(sorted.size()) - 1);
+    return sorted[i] * 1e-6;
+}
+
+}
+
+int Profiler::timerId( const char* name )
+{
+    return timerId(QString(name));
+}
+
+int Profiler::timerId( const QString& name )
+{
+    Registry& r = registry();
+    QMutexLocker locker(&r.mutex);
+
+    QHash<QString,int>::const_iterator it = r.ids.constFind(name);
+    if (it != r.ids.constEnd())
+        return it.value();
+
+    int id = r.names.size();
+    r.names << name;
+    r.ids.insert(name, id);
+    return id;
+}
+
+QString Profiler::timerName( int id )
+{
+    Registry& r = registry();
+    QMutexLocker locker(&r.mutex);
+    return r.names.value(id);
+}
+
+qint64 Profiler::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - k_epoch).count();
+}
+
+void Profiler::record( int id, qint64 start, qint64 end )
+{
+    ThreadBuffer* b = threadBuffer();
+
+    int n = b->count.load(std::memory_order_relaxed);
+    int chunk = n / k_chunkSize;
+    if (chunk == int(b->chunks.size()))
+    {
+        // Readers hold the lock while they go through the chunks
+        Event* events = new Event[k_chunkSize];
+        QMutexLocker locker(&registry().mutex);
+        b->chunks.push_back(events);
+    }
+
+    Event& e = b->chunks[chunk][n % k_chunkSize];
+    e.start = start;
+    e.end = end;
+    e.id = id;
+    b->count.store(n + 1, std::memory_order_release);
+}
+
+void Profiler::clear()
+{
+    Registry& r = registry();
+    QMutexLocker locker(&r.mutex);
+    for (size_t i = 0; i < r.buffers.size(); i++)
+        r.buffers[i]->count.store(0, std::memory_order_release);
+}
+
+bool Profiler::saveChromeTrace( const QString& filename )
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+    {
+        qWarning("Cannot write %s", qPrintable(filename));
+        return false;
+    }
+
+    Registry& r = registry();
+    QMutexLocker locker(&r.mutex);
+
+    QTextStream out(&file);
+    out << "{\"traceEvents\":[\n";
+    bool first = true;
+    for (size_t i = 0; i < r.buffers.size(); i++)
+    {
+        const ThreadBuffer* b = r.buffers[i];
+        int n = b->count.load(std::memory_order_acquire);
+        if (n == 0)
+            continue;
+
+        out << (first ? "" : ",\n")
+            << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << b->tid
+            << ",\"args\":{\"name\":\"" << escaped(b->name) << "\"}}";
+        first = false;
+
+        for (int k = 0; k < n; k++)
+        {
+            const Event& e = b->chunks[k / k_chunkSize][k % k_chunkSize];
+            // Microseconds, as expected by the trace viewers
+            out << ",\n{\"name\":\"" << escaped(r.names.value(e.id))
+                << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << b->tid
+                << ",\"ts\":" << QString::number(e.start * 1e-3, 'f', 3)
+                << ",\"dur\":" << QString::number((e.end - e.start) * 1e-3, 'f', 3) << "}";
+        }
+    }
+    out << "\n]}\n";
+
+    return true;
+}
+
+QList<ProfilerStage> Profiler::stages()
+{
+    Registry& r = registry();
+    QMutexLocker locker(&r.mutex);
+
+    std::vector< std::vector<qint64> > durations(r.names.size());
+    for (size_t i = 0; i < r.buffers.size(); i++)
+    {
+        const ThreadBuffer* b = r.buffers[i];
+        int n = b->count.load(std::memory_order_acquire);
+        for (int k = 0; k < n; k++)
+        {
+            const Event& e = b->chunks[k / k_chunkSize][k % k_chunkSize];
+            durations[e.id].push_back(e.end - e.start);
+        }
+    }
+
+    QList<ProfilerStage> stages;
+    for (int id = 0; id < int(durations.size()); id++)
+    {
+        std::vector<qint64>& d = durations[id];
+        if (d.empty())
+            continue;
+        std::sort(d.begin(), d.end());
+        double total = 0.0;
+        for (size_t k = 0; k < d.size(); k++)
+            total += d[k];
+
+        ProfilerStage s;
+        s.name = r.names.at(id);
+        s.calls = int(d.size());
+        s.mean = total * 1e-6 / d.size();
+        s.p50 = percentile(d, 0.50);
+        s.p95 = percentile(d, 0.95);
+        s.p99 = percentile(d, 0.99);
+        stages << s;
+    }
+    return stages;
+}
+
+QString Profiler::summary()
+{
+    QString text;
+    QTextStream out(&text);
+    out << QString("%1 %2 %3 %4 %5 %6\n").arg("stage", -40).arg("calls", 8)
+           .arg("mean (ms)", 10).arg("p50 (ms)", 10).arg("p95 (ms)", 10).arg("p99 (ms)", 10);
+
+    QList<ProfilerStage> all = stages();
+    for (int i = 0; i < all.size(); i++)
+    {
+        const ProfilerStage& s = all.at(i);
+        out << QString("%1 %2 %3 %4 %5 %6\n").arg(s.name, -40).arg(s.calls, 8)
+               .arg(s.mean, 10, 'f', 3).arg(s.p50, 10, 'f', 3)
+               .arg(s.p95, 10, 'f', 3).arg(s.p99, 10, 'f', 3);
+    }
+    out.flush();
+    return text;
+}
@@ -15,6 +15,7 @@ See the COPYING file for details.
 #include <QTreeView>
 #include <QMainWindow>
 #include <QMenu>
+#include <QThread>
 
 using namespace trimesh;
 
@@ -147,6 +148,18 @@ int Stats::findTimer( const QString& name, const Record* parent )
     return index;
 }
 
+int Stats::findTimer( int id, const Record* parent )
+{
+    for (int i = 0; i < _records[TIMER].size(); i++)
+    {
+        Record* timer = _records[TIMER][i];
+        if (timer->id == id &&
+            (parent == 0 || timer->parent == parent))
+            return i;
+    }
+    return -1;
+}
+
 int Stats::findTimer( const Record* pointer )
 {
     int index = -1;
@@ -217,14 +230,33 @@ void Stats::removeCounter( int which )
     delete counter;
 }
 
+bool Stats::isOwnerThread() const
+{
+    return QThread::currentThread() == thread();
+}
+
 void Stats::startTimer( const QString& name )
 {
-    int index = findTimer(name, _timer_stack.isEmpty() ? 0 : _timer_stack.last());  
+    startTimer(Profiler::timerId(name));
+}
+
+void Stats::stopTimer( const QString& name )
+{
+    stopTimer(Profiler::timerId(name));
+}
+
+void Stats::startTimer( int id )
+{
+    if (!isOwnerThread())
+        return;
+
+    int index = findTimer(id, _timer_stack.isEmpty() ? 0 : _timer_stack.last());  
     if (index == -1)
     {
         index = _records[TIMER].size();
         Record* newtimer = new Record();;
-        newtimer->name = name;
+        newtimer->name = Profiler::timerName(id);
+        newtimer->id = id;
         newtimer->category = TIMER;
         newtimer->stamp = now();
         newtimer->value = 0;
@@ -253,13 +285,16 @@ void Stats::startTimer( const QString& name )
     _timer_stack.append(_records[TIMER][index]);
 }
 
-void Stats::stopTimer( const QString& name )
+void Stats::stopTimer( int id )
 {
 #ifdef QT_NO_DEBUG
-    Q_UNUSED(name);
+    Q_UNUSED(id);
 #endif
+    if (!isOwnerThread())
+        return;
+
     assert( _timer_stack.size() > 0);
-    assert( _timer_stack.last()->name == name );
+    assert( _timer_stack.last()->id == id );
     Record* rec = _timer_stack.last();
 
     rec->value += now() - rec->stamp;
@@ -270,6 +305,9 @@ void Stats::stopTimer( const QString& name )
 
 void Stats::setCounter( const QString& name, float value )
 {
+    if (!isOwnerThread())
+        return;
+
     int index = findCounter(name);  
     if (index == -1)
     {
@@ -295,6 +333,9 @@ void Stats::setCounter( const QString& name, float value )
 
 void Stats::addToCounter( const QString& name, float value )
 {
+    if (!isOwnerThread())
+        return;
+
     int index = findCounter(name);  
     if (index == -1)
     {
@@ -0,0 +1,71 @@
+/*****************************************************************************\
+
+ASAttractionField.h
+Authors:
+    Pierre Benard (pierre.benard@laposte.net),
+    Forrester Cole (fcole@csail.mit.edu),
+    Jingwan Lu (jingwanl@princeton.edu)
+Copyright (c) 2012 Pierre Benard, Forrester Cole, Jingwan Lu
+
+libas is distributed under the terms of the GNU General Public License.
+See the COPYING file for details.
+
+\*****************************************************************************/
+
+#ifndef ATTRACTIONFIELD_H_
+#define ATTRACTIONFIELD_H_
+
+#include "GQImage.h"
+
+#include <QList>
+#include <vector>
+
+class ASContour;
+
+// Blurred gradient of the reference image evaluated by tiles, only near the
+// contours. Tiles far from every vertex are left to zero, and a tile whose
+// source pixels did not change since the previous frame is not recomputed.
+// Computed tiles are identical to the full image evaluation.
+class ASAttractionField {
+public:
+    ASAttractionField();
+
+    void compute(int iter, const GQFloatImage& refImg, const QList<ASContour*>& contours,
+                 float margin, GQFloatImage& fext);
+    void clear();
+
+    int nbComputedTiles() const { return _nbComputed; }
+    int nbCachedTiles() const { return _nbCached; }
+
+protected:
+    void reset(int iter, int width, int height, GQFloatImage& fext);
+    void markTiles(const QList<ASContour*>& contours, float margin);
+    bool sourceChanged(const GQFloatImage& refImg, int tile) const;
+    void copySource(const GQFloatImage& refImg, int tile);
+    void computeTile(const GQFloatImage& refImg, int tile, GQFloatImage& fext,
+                     std::vector<float>& buffer, std::vector<float>& scratch) const;
+    void clearTile(int tile, GQFloatImage& fext) const;
+    void tileRect(int tile, int border, int& x0, int& y0, int& x1, int& y1) const;
+
+private:
+    enum TileState { EMPTY, VALID };
+
+    int _iter;
+    int _width;
+    int _height;
+    int _nbTilesX;
+    int _nbTilesY;
+    int _support;
+
+    std::vector<unsigned char> _needed;
+    std::vector<unsigned char> _state;
+    std::vector<int>           _neededTiles;
+
+    // First channel of the reference image, kept around the valid tiles
+    std::vector<float> _prevSource;
+
+    int _nbComputed;
+    int _nbCached;
+};
+
+#endif /* ATTRACTIONFIELD_H_ */
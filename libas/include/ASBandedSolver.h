@@ -0,0 +1,68 @@
+/*****************************************************************************\
+
+ASBandedSolver.h
+Authors:
+    Pierre Benard (pierre.benard@laposte.net),
+    Forrester Cole (fcole@csail.mit.edu),
+    Jingwan Lu (jingwanl@princeton.edu)
+Copyright (c) 2012 Pierre Benard, Forrester Cole, Jingwan Lu
+
+libas is distributed under the terms of the GNU General Public License.
+See the COPYING file for details.
+
+\*****************************************************************************/
+
+#ifndef BANDEDSOLVER_H_
+#define BANDEDSOLVER_H_
+
+#include "GQInclude.h"
+
+#include <vector>
+
+// LDL^T solver for the symmetric pentadiagonal systems built by ASDeform.
+// Cyclic systems (closed contours) are handled with the Sherman-Morrison-
+// Woodbury formula on the 2x2 corner blocks. Both coordinates are solved
+// in a single pass. Buffers are kept between calls and only grow.
+class ASBandedSolver {
+public:
+    ASBandedSolver();
+
+    // Cyclic systems need at least 6 rows so that corners and band do not overlap
+    static bool supports(int n, bool cyclic) { return cyclic ? n >= 6 : n >= 2; }
+
+    void reset(int n, bool cyclic);
+
+    // Accumulate A(i,j); only the lower half (j <= i) is stored
+    void add(int i, int j, float value);
+    void scale(float s);
+    void addToDiagonal(float value);
+
+    bool factorize();
+    void solve(vec2* x) const;
+
+    int size() const { return _n; }
+    bool cyclic() const { return _cyclic; }
+
+protected:
+    bool factorizeBand();
+    void solveBand(vec2* x) const;
+
+private:
+    int  _n;
+    bool _cyclic;
+
+    // A(i,i), A(i,i-1), A(i,i-2), overwritten by D and L
+    std::vector<float> _d;
+    std::vector<float> _l1;
+    std::vector<float> _l2;
+
+    // Lower corner block: _corner[r][c] = A(n-2+r, c)
+    float _corner[2][2];
+
+    // Woodbury correction for cyclic systems
+    float _gamma;
+    std::vector<vec2> _z;
+    float _capInv[2][2];
+};
+
+#endif /* BANDEDSOLVER_H_ */
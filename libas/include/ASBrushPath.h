@@ -18,6 +18,7 @@ See the COPYING file for details.
 
 #include "ASBrushVertex.h"
 #include "ASBrushPathFitting.h"
+#include "ASRandom.h"
 #include "GQShaderManager.h"
 
 class ASBrushPathFitting;
@@ -55,12 +56,17 @@ class ASBrushPath : public QObject {
 public:
     ASBrushPath(ASContour*c, int start, int end, float slope, float intercept);
     ASBrushPath(float slope, vec2 offset);
+    // Shares the vertices of both paths, call detachVertices() before deleting it
     ASBrushPath(ASBrushPath &bp1, ASBrushPath &bp2);
 
     ~ASBrushPath();
 
     int indexOf(ASBrushVertex* v) { return _vertices.indexOf(v); }
 
+    // Given by ASSnakes when the path is first indexed, -1 until then
+    int id() const { return _id; }
+    void setId(int id) { _id = id; }
+
     float slope() const;
     float phase() const { return _phase; }
     float level() const { return _level; }
@@ -76,6 +82,7 @@ public:
 
     vec2 offset() const;
     void setOffset(vec2 offset);
+    void randomOffset(ASRandom& random);
 
     bool isReversed() const { return _reversed; }
     void setReversed(bool b) { _reversed = b; }
@@ -105,6 +112,7 @@ public:
     ASBrushPath* split(int idx1, int idx2, ASVertexContour* newV);
     ASBrushPath* split(int idx);
     QVector<ASBrushPath*> splitToMultSegments(const QVector<fittingSegment>& segmentInfoSet);
+    void detachVertices() { _vertices.clear(); }
     void trimLast()  { _vertices.pop_back();  }
     void trimFirst() { _vertices.pop_front(); }
 
@@ -147,6 +155,8 @@ public slots:
 
 private:
 
+    int _id;
+
     // Parameterization
     float _slope;
     float _phase;
@@ -46,6 +46,23 @@ struct fittingSegment
     }
 };
 
+//running sums of the sample positions, for constant time window fits
+struct fittingMoments
+{
+    double x, y, xx, xy, yy, xxx, xxy, xyy, yyy;
+
+    fittingMoments() : x(0), y(0), xx(0), xy(0), yy(0), xxx(0), xxy(0), xyy(0), yyy(0) {}
+
+    fittingMoments operator-(const fittingMoments& m) const
+    {
+        fittingMoments r;
+        r.x = x - m.x; r.y = y - m.y;
+        r.xx = xx - m.xx; r.xy = xy - m.xy; r.yy = yy - m.yy;
+        r.xxx = xxx - m.xxx; r.xxy = xxy - m.xxy; r.xyy = xyy - m.xyy; r.yyy = yyy - m.yyy;
+        return r;
+    }
+};
+
 struct controlInfo
 {
     vec2 c0;
@@ -59,7 +76,8 @@ class ASBrushPathFitting
 public:
 
     ~ASBrushPathFitting();
-    static ASBrushPathFitting& instance() { return _instance; }
+    // Fitting context of the calling thread, its buffers are reused from one call to the next
+    static ASBrushPathFitting& threadContext();
     const QVector<fittingSegment>& getSegmentInfoSet() const { return _segmentInfoSet;}
 
     //fitting multiple line segments
@@ -79,22 +97,33 @@ private:
     //for all
     QVector <vec2> _samplePointSet; //store the sample points (May not be all the input points from the tracking snake )
 
+    //prefix sums of the sample positions relative to _origin: _moments[i] covers samples [0,i)
+    QVector <fittingMoments> _moments;
+    vec2 _origin;
+
+    //dynamic program over the segment ends, buffers reused from one call to the next
+    QVector <float> _totalCost;
+    QVector <fittingSegment> _lastSegment;
+
+    void  initSamples(const ASBrushPath* bp);
+    void  backtrackSegments(int numSamples);
+    fittingMoments windowMoments(int first, int last) const { return _moments[last+1] - _moments[first]; }
+
     void  updateOffset(ASBrushPath* bp) const;
     float calculateDifference(vec2 input, vec2 fitted) const;
 
     //for fitting both lines and clothoids
     void  heightLineFit(int numPoints, const vec2 *points, float &m, float &b) const;
     void  widthLineFit(int numPoints, const vec2 *points, float &m, float &b) const;
-    float LineFit(int numPoints, const vec2 *points, float &A, float &B, float &C) const;
-    float circularArcFit(int n, const vec2 *points, float &centerX, float &centerY, float &radius) const;
-    void  recurseThroughWalkMatrix(QVector <QVector <int> > walkMatrix, int begin, int end, bool *segmentEnd) const;
-    float totalLeastSquareFit(int numPoints, const vec2 *points, float &A, float &B, float &C) const;
-    float testLine(int numPoints, const vec2 *points, float &A, float &B, float &C) const;
+    //fit the samples first..last inclusive
+    float LineFit(int first, int last, float &A, float &B, float &C) const;
+    float circularArcFit(int first, int last, float &centerX, float &centerY, float &radius) const;
+    float totalLeastSquareFit(int first, int last, float &A, float &B, float &C) const;
+    float testLine(int first, int last, float &A, float &B, float &C) const;
 
     //for fitting multiple lines
     QVector<fittingSegment> _segmentInfoSet;
 
-    static ASBrushPathFitting _instance;
 };
 
 
@@ -48,7 +48,7 @@ public:
     void setSample(ASVertexContour* s);
 
     ASBrushPath* path() const { return _path; }
-    void setPath(ASBrushPath* p) { _path = p; }
+    void setPath(ASBrushPath* p) { _path = p; _sample->brushVerticesChanged(); }
     ASBrushVertex* removeFromBrushPath();
 
     float param() const { return _param; }
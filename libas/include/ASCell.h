@@ -24,6 +24,9 @@ public:
     ASCell(const int r, const int c);
     virtual ~ASCell();
 
+    // Empty the cell but keep the list capacities, so that pooled cells can be reused
+    void reset(int r, int c);
+
     int row() const { return _row; }
     int column() const { return _col; }
 
@@ -42,23 +45,22 @@ public:
     bool containsEndPoint(ASVertexContour *v) { return _endPoints.contains(v); }
     void addEndPoint(ASVertexContour* v, bool checkPresence=true);
 
-    inline int nbClipVertices() const { return _clipVertices.size(); }
-    inline ASClipVertex* clipVertex(int i) const { return _clipVertices.at(i); }
-
-    void addAndSetCovered(ASClipVertex *v);
-    void addAndSetUncovered(ASClipVertex *v);
-    void addClipVertex(ASClipVertex *v);
-
-    const QList<ASClipVertex*>& clipVertices() { return _clipVertices; }
+    // Clip vertices are a range of the arrays owned by ASSimpleGrid, starting at clipIndex()
+    inline int nbClipVertices() const { return _nbClipVertices; }
+    inline ASClipVertex* clipVertex(int i) const { return _clipVertices[i]; }
+    inline int clipIndex() const { return _clipIndex; }
+    void setClipVertices(ASClipVertex* const* first, int count, int index) { _clipVertices = first; _nbClipVertices = count; _clipIndex = index; }
 
 protected:
 
     QList<ASVertexContour*> _contourVertices;
     QList<ASVertexContour*> _endPoints;
-    QList<ASClipVertex*> _clipVertices;
+    ASClipVertex* const* _clipVertices;
+    int _nbClipVertices;
+    int _clipIndex;
 
-    const int _row;
-    const int _col;
+    int _row;
+    int _col;
 };
 
 #endif /* CELL_H_ */
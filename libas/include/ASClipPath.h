@@ -19,6 +19,8 @@ See the COPYING file for details.
 #include <QMap>
 #include <QList>
 
+#include <vector>
+
 #include "GQInclude.h"
 #include "GQImage.h"
 
@@ -27,9 +29,9 @@ class ASClipPath;
 class ASClipVertex {
 public:
     ASClipVertex(vec3 v, vec2 coord, int idx, ASClipPath *p, float vis, float s) :
-            _index(idx), _clipPath(p), _v(v), _atlasCoord(coord), _covered(false), _visibility(vis), _strength(s) {}
+            _index(idx), _clipPath(p), _v(v), _atlasCoord(coord), _covered(false), _uncoveredIndex(-1), _visibility(vis), _strength(s) {}
     ASClipVertex(vec3 v, vec3 v3D, vec2 coord, int idx, ASClipPath *p, float vis, float s) :
-            _index(idx), _clipPath(p), _v(v), _v3D(v3D), _atlasCoord(coord), _covered(false), _visibility(vis), _strength(s) {}
+            _index(idx), _clipPath(p), _v(v), _v3D(v3D), _atlasCoord(coord), _covered(false), _uncoveredIndex(-1), _visibility(vis), _strength(s) {}
     ~ASClipVertex() {}
 
     int index() const { return _index; }
@@ -46,6 +48,10 @@ public:
     void setCovered() { _covered = true; }
     void setUncovered() { _covered = false; }
 
+    // Position in the uncovered set of ASSnakes, -1 if not in it
+    int  uncoveredIndex() const { return _uncoveredIndex; }
+    void setUncoveredIndex(int i) { _uncoveredIndex = i; }
+
     float visibility() const { return _visibility; }
 
     void setClipPath(ASClipPath* p) { _clipPath = p; }
@@ -69,6 +75,7 @@ private:
     vec2 _atlasCoord;
 
     bool _covered;
+    int  _uncoveredIndex;
 
     float _visibility;
 
@@ -81,10 +88,14 @@ private:
 
 class ASClipPath {
 public:
-    ASClipPath();
+    ASClipPath(bool ownsVertices = true);
     ASClipPath(ASClipPath &p, int idx);
     ~ASClipPath();
 
+    // Empties the path, keeping the list storage for reuse
+    void reset();
+    bool ownsVertices() const { return _ownsVertices; }
+
     void addSegment(const GQFloatImage &samples, const GQFloatImage &visibility, float offset, float numSamples, int atlasWrapWidth);
     void addVertex(ASClipVertex* v) { _clipVertices<<v; }
 
@@ -106,6 +117,8 @@ protected:
 
     QList<ASClipVertex*> _clipVertices;
     QList<int> _endPointsIdx;
+
+    bool _ownsVertices;
 };
 
 class ASClipPathSet
@@ -118,6 +131,25 @@ public:
                         const QVector<vec> &sample_positions,
                         const QVector<vec2> &sample_tangents,
                         const QVector<float> &sample_strengths);
+    // Same without a GL context, viewport and depth range given explicitly
+    void initFromPoints(const QVector<vec> &sample_positions2D,
+                        const QVector<vec> &sample_positions,
+                        const QVector<vec2> &sample_tangents,
+                        const QVector<float> &sample_strengths,
+                        const GLint viewport[4], const GLdouble depthRange[2]);
+
+    // Raw line samples as a N x 1 x 9 float image (2D position, 3D position,
+    // tangent, strength), as recorded for offline replays.
+    static bool saveSamples(const QString& filename,
+                            const QVector<vec> &sample_positions2D,
+                            const QVector<vec> &sample_positions,
+                            const QVector<vec2> &sample_tangents,
+                            const QVector<float> &sample_strengths);
+    static bool loadSamples(const QString& filename,
+                            QVector<vec> &sample_positions2D,
+                            QVector<vec> &sample_positions,
+                            QVector<vec2> &sample_tangents,
+                            QVector<float> &sample_strengths);
 
     ASClipPath* operator[]( int i ) { return _paths[i]; }
     const ASClipPath* operator[]( int i ) const { return _paths[i]; }
@@ -130,6 +162,8 @@ public:
     void draw(bool drawTangent, int width, int height) const;
 
     int viewportWidth() const { return _viewport[2]; }
+    const GLint* viewport() const { return _viewport; }
+    const GLdouble* depthRange() const { return _depthRange; }
     static vec clipToViewport(const vec4& v, const GLint viewport[], const GLdouble depthRange[]);
     vec clipToViewport(const vec4& v) const;
 
@@ -138,6 +172,10 @@ protected:
     QList<ASClipPath*>    _paths;
     QMap<int,ASClipPath*> _paths_map;
 
+    // Storage recycled by initFromPoints from one frame to the next
+    QList<ASClipPath*>        _pathPool;
+    std::vector<ASClipVertex> _vertexPool;
+
     GLdouble _depthRange[2];
     GLint   _viewport[4];
 };
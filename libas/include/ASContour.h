@@ -20,6 +20,8 @@ See the COPYING file for details.
 #include "ASVertexContour.h"
 #include "ASEdgeContour.h"
 #include "ASBrushPath.h"
+#include "ASBandedSolver.h"
+#include "ASRandom.h"
 
 #include <QList>
 #include <QColor>
@@ -65,9 +67,28 @@ public:
 
     float length() const { return _length; }
 
+    // Packed copies of the per-vertex data for the hot sweeps. The vertices
+    // still own it: computeLength() fills the rest lengths, computeTangent()
+    // the others, and they go stale as soon as a vertex moves.
+    const QVector<vec2>&  packedPositions()   const { return _positions; }
+    const QVector<vec2>&  packedTangents()    const { return _tangents; }
+    const QVector<vec2>&  packedNormals()     const { return _normals; }
+    const QVector<float>& packedRestLengths() const { return _restLengths; }
+
     ASVertexContour* at(int index);
     const ASVertexContour* at(int index) const;
 
+    // Factorized relaxation system (and its alpha, beta, step), kept from one
+    // frame to the next while the contour keeps its number of vertices
+    ASBandedSolver& relaxationSolver() { return _relaxationSolver; }
+    vec3& relaxationParams() { return _relaxationParams; }
+
+    // Unique among the contours of its ASSnakes since the last clear()
+    int id() const { return _id; }
+
+    // Stream of the brush path overdraw and merging, seeded every frame
+    ASRandom& random() { return _random; }
+
     void draw(const vec3 color=vec3(1.0,1.0,1.0), const bool drawParam = false) const;
     void draw3D(const GLdouble *model , const GLdouble *proj , const GLint *view, const vec3 color=vec3(1.0,1.0,1.0), const bool drawParam = false) const;
     void drawClosestEdge3D(const GLdouble *model, const GLdouble *proj, const GLint *view) const;
@@ -118,6 +139,7 @@ protected:
 
 private:
     ASSnakes* _ac;
+    int _id;
 
     QList<ASVertexContour*> _vertexList;
 
@@ -125,6 +147,16 @@ private:
     bool _isNew;
     float _length;
 
+    QVector<vec2>  _positions;
+    QVector<vec2>  _tangents;
+    QVector<vec2>  _normals;
+    QVector<float> _restLengths;
+
+    ASBandedSolver _relaxationSolver;
+    vec3           _relaxationParams;
+
+    ASRandom _random;
+
     QVector<vec2> _segmentPointSet;
     QList<ASBrushPath*> _brushPaths;
     QList<ASBrushPath*> _newBrushPaths;
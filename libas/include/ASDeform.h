@@ -24,11 +24,27 @@ See the COPYING file for details.
 #include <Eigen/SparseCholesky>
 
 #include "GQImage.h"
+#include "ASBandedSolver.h"
 
 class ASContour;
 class ASBrushPath;
 class ASSimpleGrid;
 
+// Work done by ASDeform::iterate, summed over the contours of a frame
+struct ASDeformStats {
+    ASDeformStats() : solves(0), factorizations(0), reusedFactorizations(0),
+                      converged(0), maxDisplacement(0.f), sumDisplacement(0.f) {}
+    void add(const ASDeformStats& s);
+
+    int solves;
+    int factorizations;
+    int reusedFactorizations;
+    int converged;
+    // Vertex displacement of the last solve (max, and sum of the per-contour means)
+    float maxDisplacement;
+    float sumDisplacement;
+};
+
 class ASDeform {
 public:
 
@@ -38,11 +54,14 @@ public:
     ASDeform();
     virtual ~ASDeform();
 
-    void iterate(ASContour& c, GQFloatImage &fext);
+    void iterate(ASContour& c, GQFloatImage &fext, ASDeformStats* stats = NULL);
+
+    // Internal forces system (I + step*K) for a contour of n vertices
+    static void buildMatrix(SparseMatrixType &A_dyn, int n, bool closed, float alpha, float beta, float step);
+    static void buildMatrix(ASBandedSolver &A_band, int n, bool closed, float alpha, float beta, float step);
 
 protected:
     void buildRhs(ASContour &c, DenseMatrixType &Vin, DenseMatrixType &Fext, GQFloatImage &fext, float tangentReg, int contourSize);
-    void buildMatrix(SparseMatrixType &A_dyn, ASContour &c, float alpha, float beta);
 
 private:
 
@@ -0,0 +1,71 @@
+/*****************************************************************************\
+
+ASRandom.h
+Authors:
+    Pierre Benard (pierre.benard@laposte.net),
+    Forrester Cole (fcole@csail.mit.edu),
+    Jingwan Lu (jingwanl@princeton.edu)
+Copyright (c) 2012 Pierre Benard, Forrester Cole, Jingwan Lu
+
+Counter-based random streams (SplitMix64): the n-th draw is a hash of the
+key and n, and the key a hash of the frame, the stage and an id (contour,
+...). Draws thus only depend on where they are made, not on other threads
+or other rand() users, and seeded replays are identical for any number of
+threads. Also usable as the generator of std::shuffle.
+
+libas is distributed under the terms of the GNU General Public License.
+See the COPYING file for details.
+
+\*****************************************************************************/
+
+#ifndef RANDOM_H_
+#define RANDOM_H_
+
+#include <QtGlobal>
+
+class ASRandom {
+public:
+    typedef quint32 result_type;
+
+    // Stages drawing from the streams, part of the key
+    enum Stream {
+        GRID_ORIGIN,
+        COVERAGE,
+        BRUSH_PATHS
+    };
+
+    ASRandom(quint64 frame = 0, Stream stream = GRID_ORIGIN, quint64 id = 0) { seed(frame, stream, id); }
+
+    void seed(quint64 frame, Stream stream, quint64 id = 0)
+    {
+        _key = mix(mix(mix(frame) ^ quint64(stream)) ^ id);
+        _counter = 0;
+    }
+
+    result_type operator()() { return result_type(draw(_counter++) >> 32); }
+
+    static result_type min() { return 0; }
+    static result_type max() { return 0xFFFFFFFFu; }
+
+    // In [0,n)
+    int index(int n) { return int((quint64((*this)()) * quint64(n)) >> 32); }
+    // In [0,1)
+    float uniform() { return ((*this)() >> 8) * (1.f / 16777216.f); }
+
+    // n-th draw of the stream, whatever the draws made so far
+    quint64 draw(quint64 n) const { return mix(_key + (n + 1) * 0x9E3779B97F4A7C15ULL); }
+
+private:
+    // splitmix64 finalizer
+    static quint64 mix(quint64 z)
+    {
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    quint64 _key;
+    quint64 _counter;
+};
+
+#endif /* RANDOM_H_ */
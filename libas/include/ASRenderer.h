@@ -20,6 +20,9 @@ See the COPYING file for details.
 
 #include "ASSnakes.h"
 
+#include <QHash>
+#include <vector>
+
 class ASRenderer
 {
 public:
@@ -31,11 +34,40 @@ public:
     void drawClosestEdge3D(const GLdouble *model, const GLdouble *proj, const GLint *view) const;
     void drawBrushPaths(bool black) const;
 
+    typedef struct {
+        vec4 vertex_0;
+        vec4 vertex_1;
+        vec4 path_start_end;
+        vec4 offset;
+        vec4 param;
+    } Segment;
+
+    // Segments [start,start+count) of the brush path with the given id
+    typedef struct {
+        int id;
+        int start;
+        int count;
+    } PathRange;
+
     void renderStrokes();
     void drawSpine();
 
+    // Stroke segments of the snakes, and where each brush path put them. No
+    // GL call, so that it can run on the tracking thread; the brush paths
+    // are cleaned and tapered in place.
+    static void buildSegments(ASSnakes& snakes, std::vector<Segment>& segments,
+                              std::vector<PathRange>& ranges, float texture_length);
+    float textureLength() const;
+    // Uploads segments made by buildSegments() (swapped with the
+    // internal ones) and draws them
+    void renderStrokes(std::vector<Segment>& segments, std::vector<PathRange>& ranges);
+    // Draws the segments of the last upload again
+    void drawStrokes();
+
 protected:
     bool makePathVertexFBO();
+    bool uploadPathVertices();
+    void uploadSegments(int start, int end);
     void updateStyle();
 
     ASSnakes* _snakes;
@@ -53,8 +85,18 @@ protected:
     NPRStyle            _globalStyle;
     GQFramebufferObject _path_verts_fbo;
     int   _clip_buf_width;
+    int   _clip_buf_height;
     int   _total_segments;
 
+    // Segments of this frame and of the last upload, kept across frames
+    // so that only the brush paths that changed are sent to the textures
+    std::vector<Segment>   _segments;
+    std::vector<Segment>   _uploaded;
+    std::vector<PathRange> _ranges;
+    std::vector<PathRange> _uploaded_ranges;
+    QHash<int,int>         _uploaded_by_id;
+    std::vector<float>     _upload_buf;
+
     GQVertexBufferSet  _vertex_buffer_set;
     bool _vbo_initialized;
 };
@@ -19,12 +19,21 @@ See the COPYING file for details.
 #include "ASContour.h"
 #include "ASClipPath.h"
 
+#include <vector>
+
+// Cells are stored in a flat open-addressing table (linear probing) and
+// recycled from one frame to the next. The clip vertices of all the cells
+// live in a single array sorted by cell (counting sort in init), each cell
+// pointing to its own range. Their positions, tangents and visibilities are
+// copied alongside (one array per coordinate) for the closest edge queries.
 class ASSimpleGrid
 {
 public:
     ASSimpleGrid();
+    ~ASSimpleGrid();
 
-    void init(int width, ASClipPathSet& pathSet);
+    // The origin of the cells is drawn from the stream of this frame
+    void init(int width, ASClipPathSet& pathSet, quint64 frame);
 
     void clear();
 
@@ -35,43 +44,97 @@ public:
 
     vec2i origin() const { return _oGrid; }
 
-    inline void posToCellCoord(vec2 pos, float& r, float& c);
-    inline int posToKey(vec2 pos);
-    inline int posToKey(vec2 pos, vec2i& offsets);
+    inline void posToCellCoord(vec2 pos, float& r, float& c) const;
+    inline int posToKey(vec2 pos) const;
+    inline int posToKey(vec2 pos, vec2i& offsets) const;
 
-    inline bool contains(int key) { return _hashTable.contains(key); }
-    inline void insert(int key, ASCell* cell) { _hashTable.insert(key,cell); }
+    inline bool contains(int key) const { return find(key) != NULL; }
+    inline ASCell* find(int key) const;
+    inline ASCell* operator[](int key) const { return find(key); }
 
-    inline ASCell*& operator[](int key) { return _hashTable[key]; }
+    // Return the cell of this key, creating it at (r,c) if needed
+    ASCell* insert(int key, int r, int c);
+    ASCell* insert(vec2 pos);
 
-    const QHash<int,ASCell*>& hash() { return _hashTable; }
+    // Cells in insertion order
+    int nbCells() const { return _nbCells; }
+    ASCell* cell(int i) const { return _cells[i]; }
+    int key(int i) const { return _keys[i]; }
 
     void addSnakeToGrid(ASContour* contour);
 
+    // Closest clip vertex to "pos" in the 2x2 cells around it, within a
+    // squared distance of maxDist2, with |tangent.t| >= minDot and a
+    // visibility >= minVisibility. Ties go to the lowest address.
+    ASClipVertex* findClosestClipVertex(vec2 pos, vec2 tangent, float minDot,
+                                        float maxDist2, float minVisibility) const;
+    // Same for n positions and tangents, e.g. those of a contour
+    void findClosestClipVertices(int n, const vec2* positions, const vec2* tangents,
+                                 float minDot, float maxDist2, float minVisibility,
+                                 ASClipVertex** closest) const;
+
     void startDrawGrid(vec2i o_grid, int step, bool drawLines=true);
     void stopDrawGrid();
 
 private:
-    QHash<int,ASCell*> _hashTable;
+    inline int slot(int key) const;
+    void rehash(int capacity);
+    int cellIndex(int key, int r, int c);
+    inline void neighborCells(vec2 pos, const ASCell* cells[4]) const;
+    void closestInCell(const ASCell* cell, vec2 pos, vec2 tangent, float minDot,
+                       float maxDist2, float minVisibility,
+                       float& best, ASClipVertex*& closest) const;
+
+    // Open-addressing table: cell index per slot, -1 if empty
+    std::vector<int> _slotKeys;
+    std::vector<int> _slotCells;
+    unsigned int     _slotMask;
+
+    // Cell pool, the first _nbCells are in use
+    std::vector<ASCell*> _cells;
+    std::vector<int>     _keys;
+    int _nbCells;
+
+    // Clip vertices sorted by cell
+    std::vector<ASClipVertex*> _clipVertices;
+    std::vector<int>           _clipCells;
+    std::vector<int>           _clipOffsets;
+    std::vector<float>         _clipX, _clipY;
+    std::vector<float>         _clipTx, _clipTy;
+    std::vector<float>         _clipVisibility;
+
     int   _nbCols;
     vec2i _oGrid;
     int _cellSize;
 };
 
-inline void ASSimpleGrid::posToCellCoord(vec2 pos, float& r, float& c) {
+inline int ASSimpleGrid::slot(int key) const {
+    unsigned int h = unsigned(key) * 2654435761u;
+    unsigned int s = (h ^ (h >> 16)) & _slotMask;
+    while(_slotCells[s] >= 0 && _slotKeys[s] != key)
+        s = (s + 1) & _slotMask;
+    return s;
+}
+
+inline ASCell* ASSimpleGrid::find(int key) const {
+    int c = _slotCells[slot(key)];
+    return c >= 0 ? _cells[c] : NULL;
+}
+
+inline void ASSimpleGrid::posToCellCoord(vec2 pos, float& r, float& c) const {
     float i = (pos[0] - _oGrid[0])/float(_cellSize);
     float j = (pos[1] - _oGrid[1])/float(_cellSize);
     r = floor(i);
     c = floor(j);
 }
 
-inline int ASSimpleGrid::posToKey(vec2 pos) {
+inline int ASSimpleGrid::posToKey(vec2 pos) const {
     float r,c;
     posToCellCoord(pos,r,c);
     return c+_nbCols*r;
 }
 
-inline int ASSimpleGrid::posToKey(vec2 pos, vec2i& offsets) {
+inline int ASSimpleGrid::posToKey(vec2 pos, vec2i& offsets) const {
     float i = (pos[0] - _oGrid[0])/float(_cellSize);
     float j = (pos[1] - _oGrid[1])/float(_cellSize);
     float r = floor(i);
@@ -83,4 +146,12 @@ inline int ASSimpleGrid::posToKey(vec2 pos, vec2i& offsets) {
     return c+_nbCols*r;
 }
 
+inline void ASSimpleGrid::neighborCells(vec2 pos, const ASCell* cells[4]) const {
+    vec2i offsets;
+    int key = posToKey(pos,offsets);
+    for (int i = 0 ; i < 2; ++i)
+        for (int j = 0 ; j < 2; ++j)
+            cells[2*i+j] = find(key + i*offsets[1] + j*offsets[0]*_nbCols);
+}
+
 #endif // SIMPLEGRID_H
@@ -18,6 +18,8 @@ See the COPYING file for details.
 #include "ASContour.h"
 #include "ASSimpleGrid.h"
 #include "ASDeform.h"
+#include "ASAttractionField.h"
+#include "ASRandom.h"
 
 #include "GQImage.h"
 #include "GQFramebufferObject.h"
@@ -37,12 +39,22 @@ public:
     void clear();
 
     void updateRefImage(GQTexture2D* refImg, GQFloatImage* geomFlow, GQFloatImage* denseFlow, ASClipPathSet& pathSet, bool useMotion=true);
+    // Same, with the attraction field computed on the CPU (no GL context needed)
+    void updateRefImage(const GQFloatImage& refImg, GQFloatImage* geomFlow, GQFloatImage* denseFlow, ASClipPathSet& pathSet, bool useMotion=true);
+    // Tracking step given the attraction field (gradient in the first two channels)
+    void update(GQFloatImage& fext, GQFloatImage* geomFlow, GQFloatImage* denseFlow, ASClipPathSet& pathSet, bool useMotion=true);
 
     int nbContours() const { return _contourList.size(); }
     ASContour* at(int i) const { return _contourList.at(i); }
 
-    int nbBrushPaths() const;
-    ASBrushPath* brushPath(int i);
+    // Flat index of the brush paths, rebuilt by init() and at the end of each
+    // tracking step, or on access once invalidated. The ids are kept by a
+    // path from one frame to the next.
+    int nbBrushPaths() const { updateBrushPathIndex(); return _brushPaths.size(); }
+    ASBrushPath* brushPath(int i) const { updateBrushPathIndex(); return _brushPaths.value(i, NULL); }
+    ASBrushPath* brushPathById(int id) const { updateBrushPathIndex(); return _brushPathsById.value(id, NULL); }
+    // To call after adding or deleting brush paths from outside
+    void invalidateBrushPaths() { _brushPathsDirty = true; }
 
     float coverRadius() const { return _coverRadius; }
     float sMin() const { return _sMin; }
@@ -55,6 +67,9 @@ public:
 
     void setNoConnect(bool connect){ _noConnectivity = connect; }
 
+    // Contours are created by the serial stages only
+    int newContourId() { return _nextContourId++; }
+
     ASClipVertex* findClosestEdgeRef(vec2 pos, vec2 tangent, bool useVisibility, float coverage);
 
 public slots:
@@ -85,8 +100,15 @@ protected:
     void splitAtJunctions();
     void splitContoursTangent();
     void markCoverage();
+    void addUncovered(ASClipVertex* cv);
+    void removeUncovered(ASClipVertex* cv);
+    void clearUncovered();
+    ASContour* addSeedContour(ASClipVertex* cv);
     void findClosestEdgeRef();
     void advect(GQFloatImage* geomFlow, GQFloatImage* denseFlow);
+    void advectContours(GQFloatImage* geomFlow, GQFloatImage* denseFlow, bool useMotion);
+    void computeAttractionField(const GQFloatImage& refImg);
+    void track(GQFloatImage& fext, ASClipPathSet& pathSet);
 
     void printContours();
     void printSimpleGrid();
@@ -96,14 +118,24 @@ protected:
     void fitBrushPath(); //fit line, arc, or spline to the brushpath
 
 private:
+    void updateBrushPathIndex() const { if(_brushPathsDirty) indexBrushPaths(); }
+    void indexBrushPaths() const;
 
     QList<ASContour*> _contourList;
 
     ASSimpleGrid _simpleGrid;
+    // Scratch buffer of findClosestEdgeRef()
+    std::vector<ASClipVertex*> _closestClipVertices;
 
     ASDeform _deformer;
 
     GQTexture2D* _refImg;
+    GQFloatImage _fext;
+    GQFloatImage _refPixels;
+    // Scratch buffers of the full frame blur
+    std::vector<float> _blurBuffer;
+    std::vector<float> _blurScratch;
+    ASAttractionField _attractionField;
 
     bool _noConnectivity;
 
@@ -116,7 +148,17 @@ private:
 
     int _width;
 
-    QList<ASClipVertex*> _uncovered;
+    // Swap-remove set, the clip vertices store their index
+    QVector<ASClipVertex*> _uncovered;
+
+    // Tracked frames since clear(), part of the keys of the random streams
+    quint64 _frame;
+    int     _nextContourId;
+
+    mutable QVector<ASBrushPath*>   _brushPaths;
+    mutable QHash<int,ASBrushPath*> _brushPathsById;
+    mutable int                     _nextBrushPathId;
+    mutable bool                    _brushPathsDirty;
 
     GQFramebufferObject off;
 };
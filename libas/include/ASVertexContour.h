@@ -84,7 +84,9 @@ public:
     float r() const { return _r; }
 
     void computeTangent();
+    void computeTangent(const vec2& prev_pos, const vec2& fol_pos);
     void computeCurvature();
+    void computeCurvature(const vec2& prev_pos, const vec2& fol_pos);
     void computeMetricParameters();
 
     void updatePosition(vec2 pos);
@@ -105,7 +107,11 @@ public:
     int  nbBrushVertices() const { return _brushVertices.size(); }
     ASBrushVertex* brushVertex(int i) const { return _brushVertices.at(i); }
     bool containsBrushVertex(ASBrushVertex* v) { return _brushVertices.contains(v); }
+    // Number of brush paths going through this vertex and the following one.
+    // Cached until the brush vertices of either (or their paths) change.
     float overdraw() const;
+    // To be called when a brush vertex of this sample moves to another path
+    void brushVerticesChanged() { _brushRevision++; }
 
     float confidence() const { return _confidence; }
     void  setConfidence( float conf) { _confidence=conf; }
@@ -154,6 +160,17 @@ protected:
 
     QList<ASBrushVertex*> _brushVertices;
 
+    int sharedBrushPaths(const ASVertexContour* next) const;
+    int sharedBrushPathsFromSets(const ASVertexContour* next) const;
+
+    // Unique, so that a new following vertex at the address of a deleted one is noticed
+    quint64 _serial;
+    int     _brushRevision;
+    mutable float   _overdraw;
+    mutable quint64 _overdrawFollowing;
+    mutable int     _overdrawRevision;
+    mutable int     _overdrawFollowingRevision;
+
     bool _hidden;
 };
 
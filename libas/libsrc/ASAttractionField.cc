@@ -0,0 +1,203 @@
+/*****************************************************************************\
+
+ASAttractionField.cc
+Authors:
+    Pierre Benard (pierre.benard@laposte.net),
+    Forrester Cole (fcole@csail.mit.edu),
+    Jingwan Lu (jingwanl@princeton.edu)
+Copyright (c) 2012 Pierre Benard, Forrester Cole, Jingwan Lu
+
+libas is distributed under the terms of the GNU General Public License.
+See the COPYING file for details.
+
+\*****************************************************************************/
+
+#include "ASAttractionField.h"
+#include "ASContour.h"
+
+#include "GQCPUImageProcessing.h"
+
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+static const int k_tileSize = 32;
+
+ASAttractionField::ASAttractionField()
+{
+    _nbComputed = _nbCached = 0;
+    clear();
+}
+
+void ASAttractionField::clear()
+{
+    // Forces a full reset on the next compute
+    _iter = -1;
+    _width = _height = 0;
+    _nbTilesX = _nbTilesY = 0;
+}
+
+void ASAttractionField::reset(int iter, int width, int height, GQFloatImage& fext)
+{
+    _iter = iter;
+    _width = width;
+    _height = height;
+    _nbTilesX = (width + k_tileSize - 1) / k_tileSize;
+    _nbTilesY = (height + k_tileSize - 1) / k_tileSize;
+    _support = GQCPUImageProcessing::blurSupport(iter);
+
+    fext.resize(width,height,4);
+    memset(fext.raster(), 0, sizeof(float)*4*width*height);
+
+    _state.assign(_nbTilesX*_nbTilesY, EMPTY);
+    _prevSource.resize(width*height);
+}
+
+void ASAttractionField::tileRect(int tile, int border, int& x0, int& y0, int& x1, int& y1) const
+{
+    int tx = tile % _nbTilesX;
+    int ty = tile / _nbTilesX;
+    x0 = std::max(0, tx*k_tileSize - border);
+    y0 = std::max(0, ty*k_tileSize - border);
+    x1 = std::min(_width,  (tx+1)*k_tileSize + border);
+    y1 = std::min(_height, (ty+1)*k_tileSize + border);
+}
+
+void ASAttractionField::markTiles(const QList<ASContour*>& contours, float margin)
+{
+    _needed.assign(_nbTilesX*_nbTilesY, 0);
+    _neededTiles.clear();
+
+    for(int i=0; i<contours.size(); i++){
+        // Vertex positions, the contiguous copies are not refreshed after advection
+        const QList<ASVertexContour*>& vertices = contours.at(i)->vertices();
+        for(int j=0; j<vertices.size(); j++){
+            vec2 p = vertices.at(j)->position();
+            if(isnan(p[0]) || isnan(p[1]))
+                continue;
+            int x0 = std::max(0, int(floor((p[0]-margin) / k_tileSize)));
+            int y0 = std::max(0, int(floor((p[1]-margin) / k_tileSize)));
+            int x1 = std::min(_nbTilesX-1, int(floor((p[0]+margin) / k_tileSize)));
+            int y1 = std::min(_nbTilesY-1, int(floor((p[1]+margin) / k_tileSize)));
+            for(int ty=y0; ty<=y1; ty++){
+                for(int tx=x0; tx<=x1; tx++){
+                    int t = ty*_nbTilesX + tx;
+                    if(!_needed[t]){
+                        _needed[t] = 1;
+                        _neededTiles.push_back(t);
+                    }
+                }
+            }
+        }
+    }
+}
+
+bool ASAttractionField::sourceChanged(const GQFloatImage& refImg, int tile) const
+{
+    int x0, y0, x1, y1;
+    tileRect(tile, _support, x0, y0, x1, y1);
+
+    const int c = refImg.chan();
+    for(int y=y0; y<y1; y++){
+        const float* src  = refImg.raster() + c*y*_width;
+        const float* prev = &_prevSource[y*_width];
+        if(c == 1){
+            if(memcmp(src+x0, prev+x0, sizeof(float)*(x1-x0)) != 0)
+                return true;
+        }else{
+            for(int x=x0; x<x1; x++)
+                if(src[c*x] != prev[x])
+                    return true;
+        }
+    }
+    return false;
+}
+
+void ASAttractionField::copySource(const GQFloatImage& refImg, int tile)
+{
+    int x0, y0, x1, y1;
+    tileRect(tile, _support, x0, y0, x1, y1);
+
+    const int c = refImg.chan();
+    for(int y=y0; y<y1; y++){
+        const float* src = refImg.raster() + c*y*_width;
+        float* prev = &_prevSource[y*_width];
+        for(int x=x0; x<x1; x++)
+            prev[x] = src[c*x];
+    }
+}
+
+void ASAttractionField::computeTile(const GQFloatImage& refImg, int tile, GQFloatImage& fext,
+                                    std::vector<float>& buffer, std::vector<float>& scratch) const
+{
+    // Source region: the tile and the pixels its blurred gradient depends on
+    int rx0, ry0, rx1, ry1;
+    tileRect(tile, _support, rx0, ry0, rx1, ry1);
+    int tx0, ty0, tx1, ty1;
+    tileRect(tile, 0, tx0, ty0, tx1, ty1);
+
+    const int rw = rx1 - rx0;
+    const int rh = ry1 - ry0;
+    buffer.resize(rw*rh);
+    scratch.resize(rw*rh);
+
+    const int c = refImg.chan();
+    for(int y=0; y<rh; y++){
+        const float* src = refImg.raster() + c*((ry0+y)*_width + rx0);
+        float* dst = &buffer[y*rw];
+        for(int x=0; x<rw; x++)
+            dst[x] = src[c*x];
+    }
+
+    GQCPUImageProcessing::blurAndGradRegion(_iter, &buffer[0], &scratch[0], rw, rh,
+                                            tx0-rx0, ty0-ry0, tx1-tx0, ty1-ty0,
+                                            fext.raster() + 4*(ty0*_width + tx0), _width);
+}
+
+void ASAttractionField::clearTile(int tile, GQFloatImage& fext) const
+{
+    int x0, y0, x1, y1;
+    tileRect(tile, 0, x0, y0, x1, y1);
+    for(int y=y0; y<y1; y++)
+        memset(fext.raster() + 4*(y*_width + x0), 0, sizeof(float)*4*(x1-x0));
+}
+
+void ASAttractionField::compute(int iter, const GQFloatImage& refImg, const QList<ASContour*>& contours,
+                                float margin, GQFloatImage& fext)
+{
+    if(iter != _iter || refImg.width() != _width || refImg.height() != _height ||
+            fext.width() != _width || fext.height() != _height || fext.chan() != 4)
+        reset(iter, refImg.width(), refImg.height(), fext);
+
+    markTiles(contours, margin);
+
+    // A valid tile was needed last frame, so its source region was saved
+    const int nbNeeded = _neededTiles.size();
+    int nbComputed = 0;
+    #pragma omp parallel reduction(+:nbComputed)
+    {
+        std::vector<float> buffer, scratch;
+        #pragma omp for schedule(dynamic,4)
+        for(int i=0; i<nbNeeded; i++){
+            int t = _neededTiles[i];
+            if(_state[t] == VALID && !sourceChanged(refImg,t))
+                continue;
+            computeTile(refImg, t, fext, buffer, scratch);
+            _state[t] = VALID;
+            nbComputed++;
+        }
+    }
+    _nbComputed = nbComputed;
+    _nbCached = nbNeeded - nbComputed;
+
+    // Tiles left behind by the contours go back to zero
+    for(int t=0; t<int(_state.size()); t++){
+        if(_state[t] == VALID && !_needed[t]){
+            clearTile(t, fext);
+            _state[t] = EMPTY;
+        }
+    }
+
+    for(int i=0; i<nbNeeded; i++)
+        copySource(refImg, _neededTiles[i]);
+}
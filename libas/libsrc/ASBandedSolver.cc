@@ -0,0 +1,198 @@
+/*****************************************************************************\
+
+ASBandedSolver.cc
+Authors:
+    Pierre Benard (pierre.benard@laposte.net),
+    Forrester Cole (fcole@csail.mit.edu),
+    Jingwan Lu (jingwanl@princeton.edu)
+Copyright (c) 2012 Pierre Benard, Forrester Cole, Jingwan Lu
+
+libas is distributed under the terms of the GNU General Public License.
+See the COPYING file for details.
+
+\*****************************************************************************/
+
+#include "ASBandedSolver.h"
+
+#include <math.h>
+
+static const float k_minPivot = 1e-12f;
+
+ASBandedSolver::ASBandedSolver()
+{
+    _n = 0;
+    _cyclic = false;
+    _gamma = 0.f;
+}
+
+void ASBandedSolver::reset(int n, bool cyclic)
+{
+    Q_ASSERT(supports(n,cyclic));
+
+    _n = n;
+    _cyclic = cyclic;
+
+    // assign() keeps the capacity, so no allocation once the buffers are big enough
+    _d.assign(n,0.f);
+    _l1.assign(n,0.f);
+    _l2.assign(n,0.f);
+    _corner[0][0] = _corner[0][1] = _corner[1][0] = _corner[1][1] = 0.f;
+}
+
+void ASBandedSolver::add(int i, int j, float value)
+{
+    if(j > i)
+        return; // symmetric, the upper half is added by row j
+
+    int d = i-j;
+    if(d == 0){
+        _d[i] += value;
+    }else if(d == 1){
+        _l1[i] += value;
+    }else if(d == 2){
+        _l2[i] += value;
+    }else{
+        Q_ASSERT(_cyclic && i >= _n-2 && j < 2);
+        _corner[i-_n+2][j] += value;
+    }
+}
+
+void ASBandedSolver::scale(float s)
+{
+    for(int i=0; i<_n; ++i){
+        _d[i]  *= s;
+        _l1[i] *= s;
+        _l2[i] *= s;
+    }
+    for(int r=0; r<2; ++r)
+        for(int c=0; c<2; ++c)
+            _corner[r][c] *= s;
+}
+
+void ASBandedSolver::addToDiagonal(float value)
+{
+    for(int i=0; i<_n; ++i)
+        _d[i] += value;
+}
+
+/************************************************************/
+/*                     Factorization                        */
+/************************************************************/
+
+bool ASBandedSolver::factorizeBand()
+{
+    for(int i=0; i<_n; ++i){
+        float d = _d[i];
+        float l2 = 0.f, l1 = 0.f;
+        if(i >= 2){
+            l2 = _l2[i] / _d[i-2];
+            d -= l2 * l2 * _d[i-2];
+        }
+        if(i >= 1){
+            float a = _l1[i];
+            if(i >= 2)
+                a -= l2 * _d[i-2] * _l1[i-1];
+            l1 = a / _d[i-1];
+            d -= l1 * l1 * _d[i-1];
+        }
+        if(fabs(d) < k_minPivot || isnan(d))
+            return false;
+        _l2[i] = l2;
+        _l1[i] = l1;
+        _d[i]  = d;
+    }
+    return true;
+}
+
+bool ASBandedSolver::factorize()
+{
+    if(!_cyclic)
+        return factorizeBand();
+
+    // A = B + U V^T with U = [gamma*I; 0; E^T], V^T = [I, 0, E/gamma]
+    // where E is the upper-right corner block (E^T = _corner).
+    _gamma = -_d[0];
+    if(fabs(_gamma) < k_minPivot)
+        return false;
+
+    float cc[2][2];
+    for(int r=0; r<2; ++r)
+        for(int s=0; s<2; ++s)
+            cc[r][s] = (_corner[r][0]*_corner[s][0] + _corner[r][1]*_corner[s][1]) / _gamma;
+
+    _d[0] -= _gamma;
+    _d[1] -= _gamma;
+    _d[_n-2]  -= cc[0][0];
+    _d[_n-1]  -= cc[1][1];
+    _l1[_n-1] -= cc[1][0];
+
+    if(!factorizeBand())
+        return false;
+
+    // Z = B^-1 U, both columns at once
+    _z.assign(_n,vec2(0.f,0.f));
+    _z[0] = vec2(_gamma,0.f);
+    _z[1] = vec2(0.f,_gamma);
+    _z[_n-2] = vec2(_corner[0][0],_corner[0][1]);
+    _z[_n-1] = vec2(_corner[1][0],_corner[1][1]);
+    solveBand(&_z[0]);
+
+    // Capacitance matrix I + V^T Z
+    float cap[2][2];
+    for(int k=0; k<2; ++k){
+        vec2 vz = _z[k] + (_corner[0][k]/_gamma) * _z[_n-2] + (_corner[1][k]/_gamma) * _z[_n-1];
+        cap[k][0] = (k==0 ? 1.f : 0.f) + vz[0];
+        cap[k][1] = (k==1 ? 1.f : 0.f) + vz[1];
+    }
+    float det = cap[0][0]*cap[1][1] - cap[0][1]*cap[1][0];
+    if(fabs(det) < k_minPivot || isnan(det))
+        return false;
+    _capInv[0][0] =  cap[1][1] / det;
+    _capInv[0][1] = -cap[0][1] / det;
+    _capInv[1][0] = -cap[1][0] / det;
+    _capInv[1][1] =  cap[0][0] / det;
+
+    return true;
+}
+
+/************************************************************/
+/*                         Solve                            */
+/************************************************************/
+
+void ASBandedSolver::solveBand(vec2* x) const
+{
+    // L z = b
+    for(int i=1; i<_n; ++i){
+        x[i] -= _l1[i] * x[i-1];
+        if(i >= 2)
+            x[i] -= _l2[i] * x[i-2];
+    }
+    // D y = z
+    for(int i=0; i<_n; ++i)
+        x[i] /= _d[i];
+    // L^T x = y
+    for(int i=_n-2; i>=0; --i){
+        x[i] -= _l1[i+1] * x[i+1];
+        if(i+2 < _n)
+            x[i] -= _l2[i+2] * x[i+2];
+    }
+}
+
+void ASBandedSolver::solve(vec2* x) const
+{
+    solveBand(x);
+
+    if(!_cyclic)
+        return;
+
+    // x = y - Z (I + V^T Z)^-1 V^T y
+    vec2 vy[2];
+    for(int k=0; k<2; ++k)
+        vy[k] = x[k] + (_corner[0][k]/_gamma) * x[_n-2] + (_corner[1][k]/_gamma) * x[_n-1];
+
+    vec2 w0 = _capInv[0][0] * vy[0] + _capInv[0][1] * vy[1];
+    vec2 w1 = _capInv[1][0] * vy[0] + _capInv[1][1] * vy[1];
+
+    for(int i=0; i<_n; ++i)
+        x[i] -= _z[i][0] * w0 + _z[i][1] * w1;
+}
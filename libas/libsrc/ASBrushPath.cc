@@ -19,6 +19,7 @@ See the COPYING file for details.
 #include "GQDraw.h"
 
 #include <QDebug>
+#include <QAtomicInt>
 
 
 static dkBool  k_drawNormalDirection("BrushPaths->Draw->Normal", false);
@@ -40,7 +41,7 @@ static dkBool  k_drawContour("Fitting->Draw->Original Contour", true);
        dkFloat k_arcRadiusWeight("Fitting->Arcs->Radius weight",1.0);
 
 ASBrushPath::ASBrushPath(ASContour*c, int start, int end, float slope, float intercept) :
-        _slope(slope), _phase(intercept), _reversed(false) {
+        _id(-1), _slope(slope), _phase(intercept), _reversed(false) {
 
     vec2 offset(0.f,0.f);
 
@@ -59,18 +60,19 @@ ASBrushPath::ASBrushPath(ASContour*c, int start, int end, float slope, float int
     _fact = -1;
 
     if(k_randomOffsets) {
-        randomizeOffset(true);
+        randomOffset(c->random());
     } else {
         _offset = vec2(0,0);
     }
 
     assignDebugColor();
 
-    connect(&k_randomize,SIGNAL(valueChanged(bool)),this,SLOT(randomizeOffset(bool)));
+    // Direct, brush paths may be created on the fitting threads
+    connect(&k_randomize,SIGNAL(valueChanged(bool)),this,SLOT(randomizeOffset(bool)),Qt::DirectConnection);
 }
 
 ASBrushPath::ASBrushPath(float slope, vec2 offset) :
-        _slope(slope), _closed(false), _reversed(false)
+        _id(-1), _slope(slope), _closed(false), _reversed(false)
 {
     assignDebugColor();
     _newFitting = true;
@@ -78,10 +80,10 @@ ASBrushPath::ASBrushPath(float slope, vec2 offset) :
     _level = -1;
     _fact = -1;
     _offset = offset;
-    connect(&k_randomize,SIGNAL(valueChanged(bool)),this,SLOT(randomizeOffset(bool)));
+    connect(&k_randomize,SIGNAL(valueChanged(bool)),this,SLOT(randomizeOffset(bool)),Qt::DirectConnection);
 }
 
-ASBrushPath::ASBrushPath(ASBrushPath &bp1, ASBrushPath &bp2) {
+ASBrushPath::ASBrushPath(ASBrushPath &bp1, ASBrushPath &bp2) : _id(-1) {
     _vertices.append(bp1._vertices);
     _vertices.append(bp2._vertices);
     computeArcLength();
@@ -108,6 +110,15 @@ void ASBrushPath::randomizeOffset(bool b) {
     }
 }
 
+void ASBrushPath::randomOffset(ASRandom& random) {
+    if(k_fixOffset){
+        _offset = vec2(k_offsetStrengthT,k_offsetStrengthN);
+    }else{
+        _offset[0] = k_offsetStrengthT <= 0 ? 0 : random.index(k_offsetStrengthT)-float(k_offsetStrengthT)/2.0f;
+        _offset[1] = k_offsetStrengthN <= 0 ? 0 : random.index(k_offsetStrengthN)-float(k_offsetStrengthN)/2.0f;
+    }
+}
+
 vec2 ASBrushPath::offset() const {
     if(_reversed)
         return -_offset;
@@ -124,7 +135,7 @@ float ASBrushPath::slope() const {
 }
 
 void ASBrushPath::assignDebugColor() {
-    static int counter = 0;
+    static QAtomicInt counter(0);
     int r = counter++ % ncolors;
     _debug_color = QColor(color_list_BP[r]);
 }
@@ -428,7 +439,7 @@ QVector<ASBrushPath*> ASBrushPath::fitting()
     if(!k_randomOffsets)
         _offset = vec2(0,0);
 
-    ASBrushPathFitting fit = ASBrushPathFitting::instance();
+    ASBrushPathFitting& fit = ASBrushPathFitting::threadContext();
 
     ACBrushpathStyleMode mode = (ACBrushpathStyleMode) k_fittingMode.index();
 
@@ -17,6 +17,8 @@ See the COPYING file for details.
 
 #include <fstream>
 #include <limits.h>
+#include <limits>
+#include <algorithm>
 #include <QDebug>
 #include "assert.h"
 
@@ -25,7 +27,11 @@ See the COPYING file for details.
 #include <math.h>
 #endif
 
-ASBrushPathFitting ASBrushPathFitting::_instance;
+ASBrushPathFitting& ASBrushPathFitting::threadContext()
+{
+    static thread_local ASBrushPathFitting context;
+    return context;
+}
 
 #define MIN_DISTANCE_FROM_ZERO 0.001
 #define CURV_FACTOR sqrt(M_PI/2.0)
@@ -46,34 +52,23 @@ ASBrushPathFitting::~ASBrushPathFitting()
     _samplePointSet.clear();
 }
 
-float ASBrushPathFitting::totalLeastSquareFit(int numPoints, const vec2 *points, float &A, float &B, float &C) const
+float ASBrushPathFitting::totalLeastSquareFit(int first, int last, float &A, float &B, float &C) const
 {
-    float sumX = 0, sumY = 0, sumXY = 0;
-    for (int i=0; i<numPoints; i++)
-    {
-        sumX += points[i][0];
-        sumY += points[i][1];
-        sumXY += points[i][0] * points[i][1];
-    }
-    float meanX = sumX / numPoints;
-    float meanY = sumY / numPoints;
-    float meanXY = sumXY / numPoints;
+    fittingMoments m = windowMoments(first, last);
+    double numPoints = last - first + 1;
 
-    float varianceX = 0;
-    float varianceY = 0;
-    for (int i=0; i<numPoints; i++)
-    {
-        varianceX += (points[i][0]-meanX) * (points[i][0]-meanX);
-        varianceY += (points[i][1]-meanY) * (points[i][1]-meanY);
-    }
-    varianceX /= numPoints;
-    varianceY /= numPoints;
+    double meanX = m.x / numPoints;
+    double meanY = m.y / numPoints;
+    double meanXY = m.xy / numPoints;
+
+    float varianceX = m.xx / numPoints - meanX * meanX;
+    float varianceY = m.yy / numPoints - meanY * meanY;
     float varianceXY = meanXY - meanX * meanY;
 
     float theta = M_PI_2;
     if(varianceXY!=0)
         theta = atan((varianceY - varianceX - sqrt((varianceY - varianceX) * (varianceY - varianceX) + 4 * varianceXY * varianceXY)) / (2 * varianceXY));
-    float n = meanX * cos(theta) + meanY * sin(theta);
+    float n = (meanX + _origin[0]) * cos(theta) + (meanY + _origin[1]) * sin(theta);
     float error = varianceX * cos(theta) * cos(theta) + varianceXY * sin(2 * theta) + varianceY * sin(theta) * sin(theta);
 
     A = cos(theta);
@@ -90,35 +85,21 @@ float ASBrushPathFitting::totalLeastSquareFit(int numPoints, const vec2 *points,
 
 }
 
-float ASBrushPathFitting::circularArcFit(int n, const vec2 *points, float &centerX, float &centerY, float &radius) const
+float ASBrushPathFitting::circularArcFit(int first, int last, float &centerX, float &centerY, float &radius) const
 {
-    double A, B, C, D, E, aM, bM, rM=0;
+    double A, B, C, D, E, aM, bM;
 
 
     //fit the circular Arc using Modified Least-Squares Methods in paper "A Few Methods for Fitting Circles to Data"
 
-    double x=0, x2=0, xy=0, y=0, y2=0, xy2=0, x3=0, yx2=0, y3=0;
-    double xs, ys;
-    for (int i=0; i<n; i++)
-    {
-        x += points[i][0];
-        y += points[i][1];
-        xs = points[i][0] * points[i][0];
-        ys = points[i][1] * points[i][1];
-        x2 += xs;
-        y2 += ys;
-        xy += points[i][1] * points[i][0];
-        xy2 += ys * points[i][0];
-        yx2 += xs * points[i][1];
-        x3 += xs * points[i][0];
-        y3 += ys * points[i][1];
-    }
+    fittingMoments m = windowMoments(first, last);
+    double n = last - first + 1;
 
-    A = n * x2 - x * x;
-    B = n * xy - x * y;
-    C = n * y2 - y * y;
-    D = 0.5 * (n * xy2 - x * y2 + n * x3 - x * x2);
-    E = 0.5 * (n * yx2 - y * x2 + n * y3 - y * y2);
+    A = n * m.xx - m.x * m.x;
+    B = n * m.xy - m.x * m.y;
+    C = n * m.yy - m.y * m.y;
+    D = 0.5 * (n * m.xyy - m.x * m.yy + n * m.xxx - m.x * m.xx);
+    E = 0.5 * (n * m.xxy - m.y * m.xx + n * m.yyy - m.y * m.yy);
 
     double divide;
     if (fabs(A*C - B*B) < 0.00000001)
@@ -128,40 +109,39 @@ float ASBrushPathFitting::circularArcFit(int n, const vec2 *points, float &cente
     aM = (D*C - B*E) / divide;
     bM = (A*E - B*D) / divide;
 
-    for (int i=0; i<n; i++)
+    //the radius is the mean distance to the center, and the fitting error
+    //sum((radius - dist)^2) = sum(dist^2) - n * radius^2
+    double sumDist = 0, sumDist2 = 0;
+    for (int i=first; i<=last; i++)
     {
-        rM += sqrt((points[i][0] - aM) * (points[i][0] - aM) + (points[i][1] - bM) * (points[i][1] - bM));
+        double dx = _samplePointSet[i][0] - _origin[0] - aM;
+        double dy = _samplePointSet[i][1] - _origin[1] - bM;
+        sumDist2 += dx * dx + dy * dy;
+        sumDist += sqrt(dx * dx + dy * dy);
     }
-    rM /= n;
+    double rM = sumDist / n;
 
-    centerX = aM;
-    centerY = bM;
+    centerX = aM + _origin[0];
+    centerY = bM + _origin[1];
     radius = rM;
 
-    //calculate the fitting error
-    double error = 0;
-    double dist;
-    for (int i=0; i<n; i++)
-    {
-        dist = radius - sqrt((points[i][0] - centerX)*(points[i][0] - centerX) + (points[i][1] - centerY)*(points[i][1] - centerY));
-        error += dist * dist;
-    }
-    return error;
+    return std::max(0.0, sumDist2 - n * rM * rM);
 }
 
-float ASBrushPathFitting::testLine(int numPoints, const vec2 *points, float &A, float &B, float &C) const
+float ASBrushPathFitting::testLine(int first, int last, float &A, float &B, float &C) const
 {
-    float fittingError = totalLeastSquareFit(numPoints, points, A, B, C);
+    float fittingError = totalLeastSquareFit(first, last, A, B, C);
 
     //when the line fitting error is very small, it means, the three points are almost colinear
     //then instead of doing the real circle fitting, fit a fixed size circle to the three points
     if (fittingError < 1)
     {
+        int numPoints = last - first + 1;
+        const vec2 *points = &_samplePointSet[first];
+        fittingMoments m = windowMoments(first, last);
+
         float error1 = 0, error2 = 0;
-        vec2 center = vec2(0, 0), center1, center2;
-        for (int i=0; i<numPoints; i++)
-            center += points[i];
-        center /= float(numPoints);
+        vec2 center = _origin + vec2(m.x / numPoints, m.y / numPoints), center1, center2;
 
         vec2 normalDir1 = vec2(A, B);
         normalize(normalDir1);
@@ -197,9 +177,9 @@ float ASBrushPathFitting::testLine(int numPoints, const vec2 *points, float &A,
     return -1;
 }
 
-float ASBrushPathFitting::LineFit(int numPoints, const vec2 *points, float &A, float &B, float &C) const
+float ASBrushPathFitting::LineFit(int first, int last, float &A, float &B, float &C) const
 {
-    return totalLeastSquareFit(numPoints, points, A, B, C);
+    return totalLeastSquareFit(first, last, A, B, C);
 }
 
 void ASBrushPathFitting::widthLineFit(int numPoints, const vec2 *points, float &m, float &b) const
@@ -264,25 +244,6 @@ void ASBrushPathFitting::heightLineFit(int numPoints, const vec2 *points, float
 
 }
 
-void ASBrushPathFitting::recurseThroughWalkMatrix(QVector <QVector <int> > walkMatrix, int begin, int end, bool *segmentEnd) const
-{
-
-    if (begin+1>=end) {
-        segmentEnd[begin]=true;
-        segmentEnd[end]=true;
-    }
-
-    if (walkMatrix[begin][end]==-1) {
-        segmentEnd[begin]=true;
-        segmentEnd[end]=true;
-    }
-    else {
-        recurseThroughWalkMatrix(walkMatrix, begin, walkMatrix[begin][end], segmentEnd);
-        recurseThroughWalkMatrix(walkMatrix, walkMatrix[begin][end], end, segmentEnd);
-    }
-
-}
-
 void ASBrushPathFitting::updateOffset(ASBrushPath* bp) const
 {
     int numSamples = bp->nbVertices();
@@ -451,126 +412,83 @@ float ASBrushPathFitting::calculateDifference(vec2 input, vec2 fitted) const
 }
 
 
-void ASBrushPathFitting::findBreakingPositionForLine(float eachSegmentCost, const ASBrushPath* bp)
+void ASBrushPathFitting::initSamples(const ASBrushPath* bp)
 {
-    _segmentInfoSet.clear();
-
     int numSamples = bp->nbVertices();
 
-    _samplePointSet.clear();
+    _samplePointSet.resize(numSamples);
+    _moments.resize(numSamples+1);
 
-    //using all the input points for fitting lines
+    //using all the input points for fitting
     for (int i=0; i<numSamples; i++)
     {
-        _samplePointSet.push_back(bp->at(i)->sample()->position());
+        _samplePointSet[i] = bp->at(i)->sample()->position();
     }
 
-    QVector <QVector <float> > errorMatrix(numSamples, QVector<float>(numSamples,0));
-    QVector <QVector <int> >   walkMatrix(numSamples, QVector<int>(numSamples,-1));
-    QVector <QVector <float> > AMatrix(numSamples, QVector<float>(numSamples,0));
-    QVector <QVector <float> > BMatrix(numSamples, QVector<float>(numSamples,0));
-    QVector <QVector <float> > CMatrix(numSamples, QVector<float>(numSamples,0));
-
-    //populate first diagonal (cost of line segment between neighbouring points)
-    for (int i=0; i<numSamples-1; i++) {
-        errorMatrix[i][i+1]=eachSegmentCost;
-        vec2 points[2];
-        points[0] = _samplePointSet[i];
-        points[1] = _samplePointSet[i+1];
-        LineFit(2, points, AMatrix[i][i+1], BMatrix[i][i+1], CMatrix[i][i+1]);
-    }
-
-    float minError, fitError;
-    int minIndex;
-    //iterate through remaining diagonals
-    for (int j=2; j<numSamples; j++) { //the length of segment
-        for (int i=0; i+j<numSamples; i++) {
-
-            //do linear regression on segments between i and i+j inclusive
-            //if that error + penalty for segment is less than
-            //sum of errors [i][i+j-1] and [i+1][i+j], then use that
-            //otherwise, use sum of [i][i+j-1] and [i+1][i+j]
-
-            vec2 *points=new vec2[j+1];
-            for (int each=i;each<=i+j;each++) {
-                points[each-i]=_samplePointSet[each];
-            }
-
-            fitError = LineFit(j+1, points, AMatrix[i][i+j], BMatrix[i][i+j], CMatrix[i][i+j]);
-
-            minError=fitError+eachSegmentCost;
-            minIndex=-1;
-
-            for (int each=i+1;each<i+j;each++) { //check each partitioning at this level
-                if (errorMatrix[i][each]+errorMatrix[each][i+j]<minError) {
-                    minIndex=each;
-                    minError=errorMatrix[i][each]+errorMatrix[each][i+j];
-                }
-            }
-
-            walkMatrix[i][i+j]=minIndex;
-            errorMatrix[i][i+j]=minError;
+    //moments relative to the first sample to limit the cancellation
+    _origin = numSamples > 0 ? _samplePointSet[0] : vec2(0,0);
+    for (int i=0; i<numSamples; i++)
+    {
+        double x = _samplePointSet[i][0] - _origin[0];
+        double y = _samplePointSet[i][1] - _origin[1];
+        fittingMoments &m = _moments[i+1];
+        m = _moments[i];
+        m.x += x;
+        m.y += y;
+        m.xx += x * x;
+        m.xy += x * y;
+        m.yy += y * y;
+        m.xxx += x * x * x;
+        m.xxy += x * x * y;
+        m.xyy += x * y * y;
+        m.yyy += y * y * y;
+    }
+
+    _totalCost.fill(0, numSamples);
+    _lastSegment.resize(numSamples);
+}
 
-            delete[] points;
-        }
-    }
+void ASBrushPathFitting::backtrackSegments(int numSamples)
+{
+    _segmentInfoSet.clear();
 
-    //use walk matrix and determine partitions
-    bool *segmentEnd = new bool[numSamples];
-    for (int i=0;i<numSamples;i++) {
-        segmentEnd[i]=false;
-    }
-    recurseThroughWalkMatrix(walkMatrix, 0, numSamples-1, segmentEnd);
+    for (int end=numSamples-1; end>0; end=_lastSegment[end].start)
+        _segmentInfoSet.push_back(_lastSegment[end]);
 
-    //intersect linear regressed lines
-    int endIndex = -1;
-    int endNextIndex = -1;
+    std::reverse(_segmentInfoSet.begin(), _segmentInfoSet.end());
+}
 
-    for (int j=1;j<numSamples;j++) {
-        if (segmentEnd[j]) {
-            endIndex=j;
-            break;
-        }
-    }
+// Optimal partition of the brush path into line segments, each segment
+// costing its fitting error plus eachSegmentCost. _totalCost[j] is the cost
+// of the best partition of the samples 0..j, and _lastSegment[j] the last
+// segment of that partition.
+void ASBrushPathFitting::findBreakingPositionForLine(float eachSegmentCost, const ASBrushPath* bp)
+{
+    _segmentInfoSet.clear();
 
-    _segmentInfoSet.push_back(fittingSegment(0, endIndex, AMatrix[0][endIndex], BMatrix[0][endIndex], CMatrix[0][endIndex], errorMatrix[0][endIndex]));
-    for (int i=0;i<numSamples-1;i++) {
-        if (segmentEnd[i]) {
-            for (int j=i+1;j<numSamples;j++) {
-                if (segmentEnd[j]) {
-                    endIndex=j;
-                    break;
-                }
-            }
+    int numSamples = bp->nbVertices();
+    if (numSamples < 2)
+        return;
 
-            endNextIndex=endIndex;
-            for (int j=endIndex+1;j<numSamples;j++) {
-                if (segmentEnd[j]) {
-                    endNextIndex=j;
-                    break;
-                }
-            }
+    initSamples(bp);
 
-            if (endNextIndex>endIndex) { //this is an intersection between two lines
+    float A, B, C, fitError, cost;
+    for (int j=1; j<numSamples; j++) {
+        _totalCost[j] = std::numeric_limits<float>::max();
+        for (int i=0; i<j; i++) {
+            fitError = LineFit(i, j, A, B, C);
 
-                float A2 = AMatrix[endIndex][endNextIndex];
-                float B2 = BMatrix[endIndex][endNextIndex];
-                float C2 = CMatrix[endIndex][endNextIndex];
-                float error = errorMatrix[endIndex][endNextIndex];
+            //the cost of line segment between neighbouring points is the penalty only
+            cost = (j == i+1) ? eachSegmentCost : fitError + eachSegmentCost;
 
-                _segmentInfoSet.push_back(fittingSegment(endIndex, endNextIndex, A2, B2, C2, error));
+            if (_totalCost[i] + cost < _totalCost[j]) {
+                _totalCost[j] = _totalCost[i] + cost;
+                _lastSegment[j] = fittingSegment(i, j, A, B, C, cost);
             }
-
         }
     }
 
-    delete[] segmentEnd;
-
-    errorMatrix.clear();
-    walkMatrix.clear();
-    AMatrix.clear();
-    BMatrix.clear();
-    CMatrix.clear();
+    backtrackSegments(numSamples);
 }
 
 double ASBrushPathFitting::determineSweepingAngle(ASBrushPath *bp, vec2 center, double radius)
@@ -633,6 +551,8 @@ double ASBrushPathFitting::determineSweepingAngle(ASBrushPath *bp, vec2 center,
     return sweepingAngle;
 }
 
+// Same partition as findBreakingPositionForLine with circular arcs of at
+// least three samples, penalized by their difference to targetRadius.
 int ASBrushPathFitting::findBreakingPositionForArc(float segmentCost, float targetRadius, float radiusWeight, const ASBrushPath* bp)
 {
     float eachSegmentCost = segmentCost;
@@ -640,140 +560,46 @@ int ASBrushPathFitting::findBreakingPositionForArc(float segmentCost, float targ
     _segmentInfoSet.clear();
 
     int numSamples = bp->nbVertices();
-
-    _samplePointSet.clear();
-
-    //using all the input points for fitting lines
-    for (int i=0; i<numSamples; i++) {
-        _samplePointSet.push_back(bp->at(i)->sample()->position());
-    }
-
-    QVector <QVector <float> > errorMatrix(numSamples, QVector<float>(numSamples,0));
-    QVector <QVector <int> >   walkMatrix(numSamples, QVector<int>(numSamples,0));
-    QVector <QVector <float> > AMatrix(numSamples, QVector<float>(numSamples,0)); //x of circle center
-    QVector <QVector <float> > BMatrix(numSamples, QVector<float>(numSamples,0)); //y of circle center
-    QVector <QVector <float> > CMatrix(numSamples, QVector<float>(numSamples,0)); //radius or circle
-
-    for (int i=0;i<numSamples;i++) {
-        for (int j=0;j<numSamples;j++) {
-            errorMatrix[i][j] = 0.0;
-            walkMatrix[i][j] = -1;
-        }
-    }
-
-    //populate first diagonal (cost of circle segment fitting three points)
-    for (int i=0;i+2<numSamples;i++) {
-        errorMatrix[i][i+2] = eachSegmentCost;
-        vec2 points[3];
-        points[0] = _samplePointSet[i];
-        points[1] = _samplePointSet[i+1];
-        points[2] = _samplePointSet[i+2];
-
-        if (testLine(3, points, AMatrix[i][i+2], BMatrix[i][i+2], CMatrix[i][i+2]) < 0)
-            circularArcFit(3, points, AMatrix[i][i+2], BMatrix[i][i+2], CMatrix[i][i+2]);
-
-        float radius = CMatrix[i][i+2] - targetRadius;
-        errorMatrix[i][i+2] += radius * radius * radiusWeight * 10;
-    }
-
-    float minError, fitError, differFromTargetRadiusError;
-    int minIndex;
-    //iterate through remaining diagonals
-    for (int j=3;j<numSamples;j++) { //the length of segment
-        for (int i=0;i+j<numSamples;i++) {
-
-            // do linear regression on segments between i and i+j inclusive
-            // if that error + penalty for segment is less than
-            //sum of errors [i][i+j-1] and [i+1][i+j], then use that
-            // otherwise, use sum of [i][i+j-1] and [i+1][i+j]
-
-            vec2 *points=new vec2[j+1];
-            for (int each=i;each<=i+j;each++) {
-                points[each-i] = _samplePointSet[each];
+    if (numSamples < 2)
+        return 0;
+
+    if (numSamples == 2) {
+        _segmentInfoSet.push_back(fittingSegment(0, 1, 0, 0, 0, 0));
+        return 1;
+    }
+
+    initSamples(bp);
+
+    float A, B, C, fitError, cost;
+    for (int j=2; j<numSamples; j++) {
+        _totalCost[j] = std::numeric_limits<float>::max();
+        //a partition cannot end at sample 1
+        for (int i=0; i+2<=j; i = (i==0) ? 2 : i+1) {
+
+            if (j == i+2) {
+                //cost of circle segment fitting three points
+                if (testLine(i, j, A, B, C) < 0)
+                    circularArcFit(i, j, A, B, C);
+                fitError = 0;
+            } else {
+                int colinear = testLine(i, j, A, B, C);
+                if (colinear<0)
+                    fitError = circularArcFit(i, j, A, B, C);
+                else
+                    fitError = colinear;
             }
 
-            int colinear = testLine(j+1, points, AMatrix[i][i+j], BMatrix[i][i+j], CMatrix[i][i+j]);
-            if (colinear<0)
-                fitError = circularArcFit(j+1, points, AMatrix[i][i+j], BMatrix[i][i+j], CMatrix[i][i+j]);
-            else
-                fitError = colinear;
-
-            float radius = CMatrix[i][i+j] - targetRadius;
-            differFromTargetRadiusError = radius * radius * radiusWeight * 10;
-
-            minError = fitError + eachSegmentCost + differFromTargetRadiusError;
-            minIndex = -1;
+            float radius = C - targetRadius;
+            cost = fitError + eachSegmentCost + radius * radius * radiusWeight * 10;
 
-            for (int each=i+2;each<i+j-1;each++) { //check each partitioning at this level
-                if (errorMatrix[i][each]+errorMatrix[each][i+j]<minError) {
-                    minIndex = each;
-                    minError = errorMatrix[i][each]+errorMatrix[each][i+j];
-                }
+            if (_totalCost[i] + cost < _totalCost[j]) {
+                _totalCost[j] = _totalCost[i] + cost;
+                _lastSegment[j] = fittingSegment(i, j, A, B, C, cost);
             }
-
-            walkMatrix[i][i+j] = minIndex;
-            errorMatrix[i][i+j] = minError;
-
-            delete[] points;
-        }
-    }
-
-    //use walk matrix and determine partitions
-    bool *segmentEnd=new bool[numSamples];
-    for (int i=0;i<numSamples;i++) {
-        segmentEnd[i]=false;
-    }
-    recurseThroughWalkMatrix(walkMatrix, 0, numSamples-1, segmentEnd);
-
-    //intersect linear regressed lines
-    int endIndex = -1;
-    int endNextIndex = -1;
-
-    for (int j=1;j<numSamples;j++) {
-        if (segmentEnd[j]) {
-            endIndex=j;
-            break;
         }
     }
 
-    _segmentInfoSet.push_back(fittingSegment(0, endIndex, AMatrix[0][endIndex], BMatrix[0][endIndex], CMatrix[0][endIndex], errorMatrix[0][endIndex]));
-    for (int i=0;i<numSamples-1;i++) {
-        if (segmentEnd[i]) {
-            for (int j=i+1;j<numSamples;j++) {
-                if (segmentEnd[j]) {
-                    endIndex=j;
-                    break;
-                }
-            }
-
-            endNextIndex=endIndex;
-            for (int j=endIndex+1;j<numSamples;j++) {
-                if (segmentEnd[j]) {
-                    endNextIndex=j;
-                    break;
-                }
-            }
-
-            if (endNextIndex>endIndex) { //this is an intersection between two lines
-
-                float A2=AMatrix[endIndex][endNextIndex];
-                float B2=BMatrix[endIndex][endNextIndex];
-                float C2=CMatrix[endIndex][endNextIndex];
-                float error = errorMatrix[endIndex][endNextIndex];
-
-                _segmentInfoSet.push_back(fittingSegment(endIndex, endNextIndex, A2, B2, C2, error));
-            }
-
-        }
-    }
-
-    delete[] segmentEnd;
-
-    errorMatrix.clear();
-    walkMatrix.clear();
-    AMatrix.clear();
-    BMatrix.clear();
-    CMatrix.clear();
+    backtrackSegments(numSamples);
 
     return _segmentInfoSet.size();
 }
@@ -15,10 +15,21 @@ See the COPYING file for details.
 #include "ASCell.h"
 #include "ASContour.h"
 
-ASCell::ASCell(const int r, const int c) : _row(r), _col(c) {}
+ASCell::ASCell(const int r, const int c) : _clipVertices(0), _nbClipVertices(0), _clipIndex(0), _row(r), _col(c) {}
 
 ASCell::~ASCell() {}
 
+void ASCell::reset(int r, int c) {
+    _row = r;
+    _col = c;
+    // QList::clear() would release the storage
+    _contourVertices.erase(_contourVertices.begin(),_contourVertices.end());
+    _endPoints.erase(_endPoints.begin(),_endPoints.end());
+    _clipVertices = 0;
+    _nbClipVertices = 0;
+    _clipIndex = 0;
+}
+
 void ASCell::addContourVertex(ASVertexContour* v, bool checkPresence) {
     if(checkPresence){
         if(!_contourVertices.contains(v))
@@ -58,19 +69,3 @@ void ASCell::addEndPoint(ASVertexContour* v, bool checkPresence) {
         _endPoints << v;
     }
 }
-
-void ASCell::addClipVertex(ASClipVertex *v) {
-    _clipVertices << v;
-}
-
-void ASCell::addAndSetCovered(ASClipVertex *v) {
-    v->setCovered();
-    if (!_clipVertices.contains(v))
-        addClipVertex(v);
-}
-
-void ASCell::addAndSetUncovered(ASClipVertex* v) {
-    v->setUncovered();
-    if (!_clipVertices.contains(v))
-        addClipVertex(v);
-}
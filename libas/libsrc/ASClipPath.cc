@@ -65,14 +65,23 @@ void ASClipPath::computeLambda() {
     }
 }
 
-ASClipPath::ASClipPath() {}
+ASClipPath::ASClipPath(bool ownsVertices) : _ownsVertices(ownsVertices) {}
 
 ASClipPath::~ASClipPath() {
-    qDeleteAll(_clipVertices);
+    if(_ownsVertices)
+        qDeleteAll(_clipVertices);
     _clipVertices.clear();
     _endPointsIdx.clear();
 }
 
+void ASClipPath::reset() {
+    if(_ownsVertices)
+        qDeleteAll(_clipVertices);
+    // erase() does not release the storage, unlike clear()
+    _clipVertices.erase(_clipVertices.begin(),_clipVertices.end());
+    _endPointsIdx.erase(_endPointsIdx.begin(),_endPointsIdx.end());
+}
+
 inline vec2 indexToCoordinate( float index, float buf_size )
 {
     return vec2(fmod(index,buf_size), floor(index / buf_size) );
@@ -196,7 +205,7 @@ void ASClipPath::draw(bool drawTangent) {
     }
 }
 
-ASClipPath::ASClipPath(ASClipPath &p, int idx) {
+ASClipPath::ASClipPath(ASClipPath &p, int idx) : _ownsVertices(p._ownsVertices) {
     for(int i=p.size()-1; i>idx; --i){
         ASClipVertex* v = p._clipVertices.at(i);
         v->setClipPath(this);
@@ -207,8 +216,13 @@ ASClipPath::ASClipPath(ASClipPath &p, int idx) {
 }
 
 ASClipPathSet::~ASClipPathSet() {
-    qDeleteAll(_paths);
+    foreach(ASClipPath* p, _paths){
+        if(p->ownsVertices())
+            delete p;
+    }
     _paths.clear();
+    qDeleteAll(_pathPool);
+    _pathPool.clear();
     _paths_map.clear();
 }
 
@@ -253,25 +267,115 @@ void ASClipPathSet::draw(bool drawTangent, int width, int height) const {
     GQDraw::stopScreenCoordinatesSystem();
 }
 
+static const int k_sampleChannels = 9;
+
+bool ASClipPathSet::saveSamples(const QString& filename,
+                                const QVector<vec>& sample_positions2D,
+                                const QVector<vec>& sample_positions,
+                                const QVector<vec2>& sample_tangents,
+                                const QVector<float>& sample_strengths)
+{
+    int nbSamples = sample_positions.size();
+    GQFloatImage img(nbSamples,1,k_sampleChannels);
+    for(int i=0; i<nbSamples; i++){
+        float* p = img.raster() + i*k_sampleChannels;
+        for(int k=0; k<3; k++){
+            p[k]   = sample_positions2D[i][k];
+            p[3+k] = sample_positions[i][k];
+        }
+        p[6] = sample_tangents[i][0];
+        p[7] = sample_tangents[i][1];
+        p[8] = sample_strengths[i];
+    }
+    return img.save(filename);
+}
+
+bool ASClipPathSet::loadSamples(const QString& filename,
+                                QVector<vec>& sample_positions2D,
+                                QVector<vec>& sample_positions,
+                                QVector<vec2>& sample_tangents,
+                                QVector<float>& sample_strengths)
+{
+    GQFloatImage img;
+    if(!img.load(filename) || (img.width() > 0 && img.chan() != k_sampleChannels)){
+        qWarning("ASClipPathSet::loadSamples: cannot read %s", qPrintable(filename));
+        return false;
+    }
+
+    int nbSamples = img.width();
+    sample_positions2D.resize(nbSamples);
+    sample_positions.resize(nbSamples);
+    sample_tangents.resize(nbSamples);
+    sample_strengths.resize(nbSamples);
+    for(int i=0; i<nbSamples; i++){
+        const float* p = img.raster() + i*k_sampleChannels;
+        sample_positions2D[i] = vec(p[0],p[1],p[2]);
+        sample_positions[i]   = vec(p[3],p[4],p[5]);
+        sample_tangents[i]    = vec2(p[6],p[7]);
+        sample_strengths[i]   = p[8];
+    }
+    return true;
+}
+
 void ASClipPathSet::initFromPoints(const QVector<vec>& sample_positions2D,
                                    const QVector<vec>& sample_positions,
                                    const QVector<vec2>& sample_tangents,
                                    const QVector<float>& sample_strengths)
 {
-    glGetDoublev(GL_DEPTH_RANGE, _depthRange);
-    glGetIntegerv (GL_VIEWPORT, _viewport);
+    GLint viewport[4];
+    GLdouble depthRange[2];
+    glGetDoublev(GL_DEPTH_RANGE, depthRange);
+    glGetIntegerv (GL_VIEWPORT, viewport);
 
-    qDeleteAll(_paths);
-    _paths.clear();
+    initFromPoints(sample_positions2D, sample_positions, sample_tangents,
+                   sample_strengths, viewport, depthRange);
+}
+
+void ASClipPathSet::initFromPoints(const QVector<vec>& sample_positions2D,
+                                   const QVector<vec>& sample_positions,
+                                   const QVector<vec2>& sample_tangents,
+                                   const QVector<float>& sample_strengths,
+                                   const GLint viewport[4], const GLdouble depthRange[2])
+{
+    for(int i=0; i<4; i++)
+        _viewport[i] = viewport[i];
+    _depthRange[0] = depthRange[0];
+    _depthRange[1] = depthRange[1];
+
+    // Paths added from outside own their vertices, the pooled ones are recycled
+    foreach(ASClipPath* p, _paths){
+        if(p->ownsVertices())
+            delete p;
+    }
+    _paths.erase(_paths.begin(),_paths.end());
 
-    for(int i=0; i < sample_positions.size(); ++i){
-        ASClipPath* p = new ASClipPath();
+    int nbSamples = sample_positions.size();
+    int nbAllocs = 0;
+
+    // Vertices live in a single array; growing it invalidates last frame's
+    // pointers, which are not valid after this call anyway.
+    _vertexPool.clear();
+    if(int(_vertexPool.capacity()) < nbSamples){
+        _vertexPool.reserve(std::max(size_t(nbSamples), 2*_vertexPool.capacity()));
+        nbAllocs++;
+    }
+    while(_pathPool.size() < nbSamples){
+        _pathPool << new ASClipPath(false);
+        nbAllocs++;
+    }
+
+    for(int i=0; i < nbSamples; ++i){
+        ASClipPath* p = _pathPool.at(i);
+        p->reset();
         vec3 projPos = sample_positions2D.at(i);
         vec3 clipPos = clipToViewport(vec4(projPos[0],projPos[1],projPos[2],1.f));
-        ASClipVertex* cv = new ASClipVertex(clipPos, sample_positions.at(i),
-                                              vec2(float(i),0), 0, p, 1.0, sample_strengths.at(i));
+        _vertexPool.push_back(ASClipVertex(clipPos, sample_positions.at(i),
+                                           vec2(float(i),0), 0, p, 1.0, sample_strengths.at(i)));
+        ASClipVertex* cv = &_vertexPool.back();
         cv->setTangent(sample_tangents.at(i));
         p->addVertex(cv);
         _paths << p;
     }
+
+    __SET_COUNTER("Clip samples allocations", nbAllocs);
 }
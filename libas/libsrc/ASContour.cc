@@ -34,9 +34,9 @@ using std::isinf;
 #endif
 
 #include <QSet>
+#include <QAtomicInt>
 
 #include <algorithm>
-#include <random>
 
        dkFloat k_penWidth("Style->Main->Pen width", 2.0);
 static dkBool  k_taperBP("Style->Taper->BP length", false);
@@ -76,7 +76,7 @@ extern dkFloat k_arcRadiusWeight;
 extern dkStringList k_fittingMode;
 
 ASContour::ASContour(ASSnakes* ac) :
-        _ac(ac), _closed(false), _isNew(true), _length(0.0)
+        _ac(ac), _id(ac->newContourId()), _closed(false), _isNew(true), _length(0.0), _relaxationParams(-1.f,-1.f,-1.f)
 {
     assignDebugColor();
 }
@@ -84,6 +84,8 @@ ASContour::ASContour(ASSnakes* ac) :
 ASContour::ASContour(ASSnakes* ac, ASClipPath &p, float visTh) {
 
     _ac = ac;
+    _id = ac->newContourId();
+    _relaxationParams = vec3(-1.f,-1.f,-1.f);
 
     int idx = 0;
 
@@ -144,7 +146,7 @@ ASContour::~ASContour() {
     clear();
 }
 
-static int counter=0;
+static QAtomicInt counter(0);
 
 void ASContour::assignDebugColor() {
     int r = counter++ % ncolors;
@@ -179,31 +181,62 @@ void ASContour::initParameterization() {
 }
 
 void ASContour::computeTangent() {
-    ContourIterator it = iterator();
-    while(it.hasNext()){
-        ASVertexContour* v = it.next();
-        v->computeTangent();
+    int n = nbVertices();
+    _positions.resize(n);
+    _tangents.resize(n);
+    _normals.resize(n);
+    if(n == 0)
+        return;
+
+    vec2* p = _positions.data();
+    for(int i=0; i<n; ++i)
+        p[i] = _vertexList.at(i)->position();
+
+    for(int i=0; i<n; ++i){
+        const vec2& prev_pos = (i > 0)   ? p[i-1] : (_closed ? p[n-1] : p[i]);
+        const vec2& fol_pos  = (i < n-1) ? p[i+1] : (_closed ? p[0]   : p[i]);
+        ASVertexContour* v = _vertexList.at(i);
+        v->computeTangent(prev_pos,fol_pos);
+        _tangents[i] = v->tangent();
+        _normals[i]  = v->normal();
     }
 }
 
 void ASContour::computeCurvature() {
-    ContourIterator it = iterator();
-    while(it.hasNext()){
-        ASVertexContour* v = it.next();
-        v->computeCurvature();
+    int n = nbVertices();
+    if(n < 2){
+        ContourIterator it = iterator();
+        while(it.hasNext())
+            it.next()->computeCurvature();
+        return;
+    }
+
+    _positions.resize(n);
+    vec2* p = _positions.data();
+    for(int i=0; i<n; ++i)
+        p[i] = _vertexList.at(i)->position();
+
+    for(int i=0; i<n; ++i){
+        // open ends reuse their only neighbour
+        int prev = (i > 0)   ? i-1 : (_closed ? n-1 : i+1);
+        int fol  = (i < n-1) ? i+1 : (_closed ? 0   : prev);
+        _vertexList.at(i)->computeCurvature(p[prev],p[fol]);
     }
 }
 
 void ASContour::computeLength() {
+    int n = nbVertices();
     _length = 0.0;
+    _restLengths.resize(std::max(n-1,0));
     at(0)->setArcLength(_length);
-    for(int i=0; i<nbVertices()-1; ++i){
-        ASVertexContour* v = at(i);
+    for(int i=0; i<n-1; ++i){
+        ASVertexContour* v = _vertexList.at(i);
         ASEdgeContour*   e = v->edge();
         Q_ASSERT(e != NULL);
         e->computeDirection();
+        _restLengths[i] = e->restLength();
         _length += e->length();
-        at(i+1)->setArcLength(_length);
+        _vertexList.at(i+1)->setArcLength(_length);
     }
 }
 
@@ -745,24 +778,26 @@ void ASContour::mergeBrushPaths() {
 
         // Check if the merged BP wouldn't be split by abstraction
 
-        ASBrushPathFitting fit = ASBrushPathFitting::instance();
+        ASBrushPathFitting& fit = ASBrushPathFitting::threadContext();
         ACBrushpathStyleMode mode = (ACBrushpathStyleMode) k_fittingMode.index();;
 
         if (mode == AS_BRUSHPATH_LINE){
-            ASBrushPath* mergeBP = new ASBrushPath(*bv2->path(),*bv1->path());
+            ASBrushPath mergeBP(*bv2->path(),*bv1->path());
 
             float lineSegmentCost = k_lineSegmentCost * 0.75f; //0.75 for hysteresis
-            fit.findBreakingPositionForLine(lineSegmentCost, mergeBP);
+            fit.findBreakingPositionForLine(lineSegmentCost, &mergeBP);
+            mergeBP.detachVertices();
             if(fit.getSegmentInfoSet().size()>1)
                 continue;
 
         }else if (mode == AS_BRUSHPATH_ARC){
-            ASBrushPath* mergeBP = new ASBrushPath(*bv2->path(),*bv1->path());
+            ASBrushPath mergeBP(*bv2->path(),*bv1->path());
 
             float arcSegmentCost = k_arcSegmentCost * 0.75f; //0.75 for hysteresis
             float arcTargetRadius = k_arcTargetRadius;
             float arcRadiusWeight = k_arcRadiusWeight;
-            fit.findBreakingPositionForArc(arcSegmentCost, arcTargetRadius, arcRadiusWeight, mergeBP);
+            fit.findBreakingPositionForArc(arcSegmentCost, arcTargetRadius, arcRadiusWeight, &mergeBP);
+            mergeBP.detachVertices();
             if(fit.getSegmentInfoSet().size()>1)
                 continue;
         }
@@ -970,10 +1005,7 @@ void ASContour::brushPathPairs(QList< QPair<ASBrushVertex*,ASBrushVertex*> > &pa
         }
     }
 
-    std::random_device rd;
-    std::mt19937 g(rd());
- 
-    std::shuffle( pairs.begin(), pairs.end(), g);
+    std::shuffle( pairs.begin(), pairs.end(), _random);
 }
 
 /********************************/
@@ -982,7 +1014,7 @@ void ASContour::brushPathPairs(QList< QPair<ASBrushVertex*,ASBrushVertex*> > &pa
 
 void ASContour::recursiveSplit(ASBrushPath* b) {
     if(b->last()->arcLength() > k_targetLength && b->nbVertices()>5){
-        int splitIdx = rand()%(b->nbVertices()/2)+b->nbVertices()/4;
+        int splitIdx = _random.index(b->nbVertices()/2)+b->nbVertices()/4;
         ASBrushPath* newB = b->split(splitIdx);
         recursiveSplit(b);
         newB->computeArcLength();
@@ -1024,7 +1056,7 @@ bool ASContour::updateOverdraw() {
             float firstOverdraw = first->sample()->overdraw();
             if(firstOverdraw > k_targetOverdraw){
                 // could contract
-                float alea = float(rand())/RAND_MAX;
+                float alea = _random.uniform();
                 float proba = k_gammaContract*(1.0-k_targetOverdraw/firstOverdraw);
                 if(alea <= proba){
                     first->removeFromBrushPath();
@@ -1046,7 +1078,7 @@ bool ASContour::updateOverdraw() {
             float prevOverdraw = prev->overdraw();
             if(prevOverdraw < k_targetOverdraw || prevOverdraw == k_targetOverdraw) {
                 // could extend
-                float alea = float(rand())/RAND_MAX;
+                float alea = _random.uniform();
                 float proba = k_gammaExt*(1.0-prevOverdraw/k_targetOverdraw);
                 if(alea <= proba){
                     ASBrushPath* bp = first->path();
@@ -1070,7 +1102,7 @@ bool ASContour::updateOverdraw() {
             float lastOverdraw = prev->overdraw();
             if(lastOverdraw > k_targetOverdraw){
                 // could contract
-                float alea = float(rand())/RAND_MAX;
+                float alea = _random.uniform();
                 float proba = k_gammaContract*(1.0-k_targetOverdraw/lastOverdraw);
                 if(alea <= proba){
                     last->removeFromBrushPath();
@@ -1091,7 +1123,7 @@ bool ASContour::updateOverdraw() {
             float follOverdraw = last->sample()->overdraw();
             if(follOverdraw < k_targetOverdraw || follOverdraw == k_targetOverdraw) {
                 // could extend
-                float alea = float(rand())/RAND_MAX;
+                float alea = _random.uniform();
                 float proba = k_gammaExt*(1.0-follOverdraw/k_targetOverdraw);
                 if(alea <= proba){
                     ASBrushPath* bp = last->path();
@@ -29,6 +29,19 @@ static dkFloat k_step("Contours->Relaxation->Time step", 0.5f);
 static dkInt   k_numIter("Contours->Relaxation->Iterations", 25);
 static dkInt   k_resamplingFreq("Contours->Resampling->Frequency", 5);
 static dkInt   k_maxResampling("Contours->Resampling->Max iter.", 100);
+static dkBool  k_bandedSolver("Contours->Relaxation->Banded solver", false);
+static dkBool  k_earlyTermination("Contours->Relaxation->Early termination", false);
+static dkFloat k_convergenceTol("Contours->Relaxation->Convergence tol.", 0.01f, 0.f, 10.f, 0.005f);
+
+void ASDeformStats::add(const ASDeformStats& s)
+{
+    solves += s.solves;
+    factorizations += s.factorizations;
+    reusedFactorizations += s.reusedFactorizations;
+    converged += s.converged;
+    maxDisplacement = std::max(maxDisplacement, s.maxDisplacement);
+    sumDisplacement += s.sumDisplacement;
+}
 
 ASDeform::ASDeform() {
     _max_solver_iter = 100;
@@ -52,40 +65,43 @@ const float k_smallest_spring = 0.01;
 void ASDeform::buildRhs(ASContour &c, DenseMatrixType &Vin, DenseMatrixType &Fext,
                       GQFloatImage &fext, float tangentReg, int contourSize)
 {
-    ASContour::ContourIterator it = c.iterator();
-    int idx = 0;
-    vec2 tangent;
     float f_tg = 0.0;
 
     c.computeLength();
 
     c.computeTangent();
 
-    while(it.hasNext()){
-        ASVertexContour* v = it.next();
+    // Linear sweep over the copies packed by computeLength/computeTangent
+    const vec2*  P = c.packedPositions().constData();
+    const vec2*  T = c.packedTangents().constData();
+    const vec2*  N = c.packedNormals().constData();
+    const float* L = c.packedRestLengths().constData();
+
+    for(int idx=0; idx<contourSize; idx++){
 
-        vec2 vPos = v->position();
+        vec2 vPos = P[idx];
         vec2 fspring(0.f,0.f);
         //Spring force for the interior points => preserve length and regular spacing
         vec2 dPos;
         float restLength;
-        if(!v->isLast()){
-            dPos = v->following()->position();
-            restLength = v->edge()->restLength();
+        if(idx < contourSize-1){
+            dPos = P[idx+1];
+            restLength = L[idx];
             vec2 dir = dPos-vPos;
             float distDV = len(dir);
             distDV = std::max(distDV, k_smallest_spring);
             fspring += float(k_lenghtStiffness * (1.0 - restLength/distDV)) * dir;
-        } else if(!v->isFirst()) {
-            dPos = v->previous()->position();
-            restLength = v->previous()->edge()->restLength();
+        } else if(idx > 0) {
+            dPos = P[idx-1];
+            restLength = L[idx-1];
             vec2 dir = dPos-vPos;
             float distDV = len(dir);
             distDV = std::max(distDV, k_smallest_spring);
             fspring += float(k_lenghtStiffness * (1.0 - restLength/distDV)) * dir;
         }
 
-        tangent = v->tangent();
+        vec2 tangent = T[idx];
+        vec2 normal  = N[idx];
         vec2 p = vPos;
 
         //Input positions
@@ -100,6 +116,7 @@ void ASDeform::buildRhs(ASContour &c, DenseMatrixType &Vin, DenseMatrixType &Fex
         }else if(tangentReg > 0){
 
             //Delinguette and Montagnat 2000
+            ASVertexContour* v = c.vertices().at(idx);
             v->computeMetricParameters();
             // uniform vertex spacing
             float epsilon = v->metricParameter();
@@ -110,11 +127,9 @@ void ASDeform::buildRhs(ASContour &c, DenseMatrixType &Vin, DenseMatrixType &Fex
         if (p[0]<fext.width() && p[1]<fext.height() && p[0]>=0 && p[1]>=0){
             b = vec2(fext.pixel(int(p[0]),int(p[1]),0),fext.pixel(int(p[0]),int(p[1]),1));
         }
-        vec2 fx = (b DOT v->normal()) * v->normal();
+        vec2 fx = (b DOT normal) * normal;
         Fext.coeffRef(idx,0) = fx[0] + tangentReg*f_tg * tangent[0] + fspring[0];
         Fext.coeffRef(idx,1) = fx[1] + tangentReg*f_tg * tangent[1] + fspring[1];
-
-        idx++;
     }
 }
 
@@ -122,67 +137,112 @@ void ASDeform::buildRhs(ASContour &c, DenseMatrixType &Vin, DenseMatrixType &Fex
 /*      		Internal Forces                     */
 /************************************************************/
 
-void ASDeform::buildMatrix(SparseMatrixType &A_dyn, ASContour &c, float alpha, float beta){
+static inline void stencilIndices(int i, int contourSize, bool closed, int idx[5])
+{
+    int iplus1 = i+1;
+    int iplus2 = i+2;
+    int iminus1 = i-1;
+    int iminus2 = i-2;
+
+    if(closed)
+    {
+        if(iminus1 < 0){
+            iminus1 += contourSize;
+        }
 
-    int contourSize = c.nbVertices();
+        if(iminus2 < 0){
+            iminus2 += contourSize;
+        }
 
-    int iplus1, iplus2, iminus1, iminus2;
-    // Internal Forces
-    for (int i=0; i<contourSize; ++i){
+        if(iplus1 >= contourSize){
+            iplus1 -= contourSize ;
+        }
 
-        iplus1 = i+1;
-        iplus2 = i+2;
-        iminus1 = i-1;
-        iminus2 = i-2;
+        if(iplus2 >= contourSize){
+            iplus2 -= contourSize;
+        }
+    }else{
+        if(iminus1 < 0){
+            iminus1 = -iminus1-1;
+        }
 
-        if(c.isClosed())
-        {
-            if(iminus1 < 0){
-                iminus1 += contourSize;
-            }
+        if(iminus2 < 0){
+            iminus2 = -iminus2-1;
+        }
 
-            if(iminus2 < 0){
-                iminus2 += contourSize;
-            }
+        if(iplus1 >= contourSize){
+            iplus1 = 2*contourSize-1 - iplus1;
+        }
 
-            if(iplus1 >= contourSize){
-                iplus1 -= contourSize ;
-            }
+        if(iplus2 >= contourSize){
+            iplus2 = 2*contourSize-1 - iplus2;
+        }
+    }
 
-            if(iplus2 >= contourSize){
-                iplus2 -= contourSize;
-            }
-        }else{
-            if(iminus1 < 0){
-                iminus1 = -iminus1-1;
-            }
+    idx[0] = iminus2;
+    idx[1] = iminus1;
+    idx[2] = i;
+    idx[3] = iplus1;
+    idx[4] = iplus2;
+}
 
-            if(iminus2 < 0){
-                iminus2 = -iminus2-1;
-            }
+void ASDeform::buildMatrix(SparseMatrixType &A_dyn, int contourSize, bool closed, float alpha, float beta, float step){
 
-            if(iplus1 >= contourSize){
-                iplus1 = 2*contourSize-1 - iplus1;
-            }
+    int idx[5];
+    // Internal Forces
+    for (int i=0; i<contourSize; ++i){
 
-            if(iplus2 >= contourSize){
-                iplus2 = 2*contourSize-1 - iplus2;
-            }
-        }
+        stencilIndices(i,contourSize,closed,idx);
 
-        A_dyn.coeffRef(i,iminus2) +=                 beta;
-        A_dyn.coeffRef(i,iminus1) +=   - alpha - 4.0*beta;
-        A_dyn.coeffRef(i,i)       += 2.0*alpha + 6.0*beta;
-        A_dyn.coeffRef(i,iplus1)  +=   - alpha - 4.0*beta;
-        A_dyn.coeffRef(i,iplus2)  +=                 beta;
+        A_dyn.coeffRef(i,idx[0]) +=                 beta;
+        A_dyn.coeffRef(i,idx[1]) +=   - alpha - 4.0*beta;
+        A_dyn.coeffRef(i,idx[2]) += 2.0*alpha + 6.0*beta;
+        A_dyn.coeffRef(i,idx[3]) +=   - alpha - 4.0*beta;
+        A_dyn.coeffRef(i,idx[4]) +=                 beta;
     }
 
-    A_dyn *= k_step;
+    A_dyn *= step;
 
     for (int i=0; i<A_dyn.rows(); ++i)
         A_dyn.coeffRef(i,i) += 1.0;
 }
 
+void ASDeform::buildMatrix(ASBandedSolver &A_band, int contourSize, bool closed, float alpha, float beta, float step){
+
+    A_band.reset(contourSize,closed);
+
+    int idx[5];
+    // Same stencil as above, only the lower half is kept
+    for (int i=0; i<contourSize; ++i){
+
+        stencilIndices(i,contourSize,closed,idx);
+
+        A_band.add(i,idx[0],                 beta);
+        A_band.add(i,idx[1],   - alpha - 4.0*beta);
+        A_band.add(i,idx[2], 2.0*alpha + 6.0*beta);
+        A_band.add(i,idx[3],   - alpha - 4.0*beta);
+        A_band.add(i,idx[4],                 beta);
+    }
+
+    A_band.scale(step);
+    A_band.addToDiagonal(1.0);
+}
+
+// Buffers of iterate(), per thread since the contours may be relaxed in
+// parallel. Only reallocated when the size of the contour changes.
+struct ASDeformScratch {
+    ASDeform::DenseMatrixType Vin, Fext, Vout_x, Vout_y;
+    std::vector<vec2> Vout;
+    ASDeform::SparseMatrixType A;
+    Eigen::SimplicialLDLT<ASDeform::SparseMatrixType> sparseLDLT;
+};
+
+static ASDeformScratch& deformScratch()
+{
+    static thread_local ASDeformScratch scratch;
+    return scratch;
+}
+
 inline float clamp(float value, float valMin, float valMax)
 {
     return std::min(std::max(valMin,value),valMax);
@@ -192,50 +252,104 @@ inline float clamp(float value, float valMin, float valMax)
 /*              	CHOLMOD Solver                      */
 /************************************************************/
 
-void ASDeform::iterate(ASContour &c, GQFloatImage &fext)
+void ASDeform::iterate(ASContour &c, GQFloatImage &fext, ASDeformStats* stats)
 {
-    for(int iter=0; iter<k_resamplingFreq; iter++){
+    // The system only depends on the size, the closure and the parameters
+    ASBandedSolver& bandedSolver = c.relaxationSolver();
+    vec3& bandedParams = c.relaxationParams();
+    vec3 params(k_alpha, k_beta, k_step);
 
-        int contourSize = c.nbVertices();
+    ASDeformScratch& scratch = deformScratch();
+    DenseMatrixType& Vin = scratch.Vin;
+    DenseMatrixType& Fext = scratch.Fext;
+    DenseMatrixType& Vout_x = scratch.Vout_x;
+    DenseMatrixType& Vout_y = scratch.Vout_y;
+    std::vector<vec2>& Vout = scratch.Vout;
+    SparseMatrixType& A = scratch.A;
+    Eigen::SimplicialLDLT<SparseMatrixType>& sparseLDLT = scratch.sparseLDLT;
 
-        // Input positions Vin
-        DenseMatrixType Vin(contourSize,2);
-        // External forces Fext
-        DenseMatrixType Fext = DenseMatrixType(contourSize,2);
+    ASDeformStats s;
+    bool converged = false;
 
-        SparseMatrixType A = SparseMatrixType(contourSize,contourSize);
+    for(int iter=0; iter<k_resamplingFreq && !converged; iter++){
 
-        buildMatrix(A, c, k_alpha, k_beta);
+        int contourSize = c.nbVertices();
 
-        Eigen::SimplicialLDLT<SparseMatrixType> sparseLDLT(A);
-        sparseLDLT.compute(A);
+        // Input positions Vin and external forces Fext
+        Vin.resize(contourSize,2);
+        Fext.resize(contourSize,2);
+
+        bool banded = k_bandedSolver && ASBandedSolver::supports(contourSize,c.isClosed());
+        if(banded){
+            if(bandedSolver.size() == contourSize && bandedSolver.cyclic() == c.isClosed() && bandedParams == params){
+                s.reusedFactorizations++;
+            }else{
+                buildMatrix(bandedSolver, contourSize, c.isClosed(), k_alpha, k_beta, k_step);
+                banded = bandedSolver.factorize();
+                bandedParams = banded ? params : vec3(-1.f,-1.f,-1.f);
+                s.factorizations++;
+            }
+        }
+        if(!banded){
+            A.resize(contourSize,contourSize);
+            buildMatrix(A, contourSize, c.isClosed(), k_alpha, k_beta, k_step);
+            sparseLDLT.compute(A);
+            s.factorizations++;
+        }
 
         for(int i=0; i<int(k_numIter/float(k_resamplingFreq)); i++){
 
             buildRhs(c,Vin,Fext,fext,k_tangentReg,contourSize);
 
-            // Right-hand side and future out position
-            DenseMatrixType Vout_x = DenseMatrixType( Vin.col(0) + k_step * Fext.col(0) );
-            DenseMatrixType Vout_y = DenseMatrixType( Vin.col(1) + k_step * Fext.col(1) );
-
-            Vout_x = sparseLDLT.solve(Vout_x);
-            Vout_y = sparseLDLT.solve(Vout_y);
+            if(banded){
+                // Both coordinates in one pass
+                Vout.resize(contourSize);
+                for(int j=0; j<contourSize; j++)
+                    Vout[j] = vec2(Vin(j,0) + k_step * Fext(j,0), Vin(j,1) + k_step * Fext(j,1));
+                bandedSolver.solve(&Vout[0]);
+            }else{
+                // Right-hand side and future out position
+                Vout_x = Vin.col(0) + k_step * Fext.col(0);
+                Vout_y = Vin.col(1) + k_step * Fext.col(1);
+
+                Vout_x = sparseLDLT.solve(Vout_x);
+                Vout_y = sparseLDLT.solve(Vout_y);
+            }
 
             // Update vertex positions
+            float maxDisp = 0.f, sumDisp = 0.f;
             ASContour::ContourIterator it = c.iterator();
             while(it.hasNext()){
                 ASVertexContour* v = it.next();
-                float x = clamp(Vout_x(v->index()),0,fext.width()-1);
-                float y = clamp(Vout_y(v->index()),0,fext.height()-1);
+                float x = banded ? Vout[v->index()][0] : Vout_x(v->index());
+                float y = banded ? Vout[v->index()][1] : Vout_y(v->index());
+                x = clamp(x,0,fext.width()-1);
+                y = clamp(y,0,fext.height()-1);
                 if(//(idx > 1) && (idx < contourSize-2) &&
                         !isnan(x) && !isnan(y)){
+                    float d = dist(v->position(),vec2(x,y));
+                    maxDisp = std::max(maxDisp,d);
+                    sumDisp += d;
                     v->updatePosition(vec2(x,y));
                 }
             }
             c.computeLength();
+
+            s.solves++;
+            s.maxDisplacement = maxDisp;
+            s.sumDisplacement = sumDisp / contourSize;
+            if(k_earlyTermination && maxDisp < k_convergenceTol){
+                converged = true;
+                break;
+            }
         }
 
         int nbIter = 0;
         while(c.resample() && nbIter < k_maxResampling) nbIter++;
     }
+
+    if(converged)
+        s.converged++;
+    if(stats)
+        stats->add(s);
 }
@@ -18,6 +18,8 @@ See the COPYING file for details.
 #include "GQDraw.h"
 #include "Stats.h"
 
+#include <string.h>
+
 static dkFloat k_lineWidth("Contours->Draw->Thickness", 1.0,0.1,100.0,1.0);
 static dkBool  k_drawVerticies("Contours->Draw->Vertices", true);
 
@@ -37,6 +39,9 @@ extern dkFloat k_overshootTh;
 ASRenderer::ASRenderer()
 {
     _vbo_initialized = false;
+    _clip_buf_width = 0;
+    _clip_buf_height = 0;
+    _total_segments = 0;
 }
 
 void ASRenderer::init(ASSnakes* snakes)
@@ -123,6 +128,37 @@ void ASRenderer::drawBrushPaths(bool black) const
     glDisable(GL_LINE_SMOOTH);
 }
 
+void ASRenderer::uploadSegments(int start, int end)
+{
+    // One call per texture and per row covered by [start,end)
+    while (start < end){
+        int x = start % _clip_buf_width;
+        int y = start / _clip_buf_width;
+        int count = std::min(end-start, _clip_buf_width-x);
+
+        _upload_buf.resize(count*4);
+        float* buf = &_upload_buf[0];
+        for (int b = 0; b < NUM_BRUSHPATH_BUFFERS; b++){
+            for (int k = 0; k < count; k++){
+                const Segment& seg = _segments[start+k];
+                const vec4* attrib = &seg.vertex_0;
+                switch (b){
+                case BRUSHPATH_VERTEX_0_ID:  attrib = &seg.vertex_0; break;
+                case BRUSHPATH_VERTEX_1_ID:  attrib = &seg.vertex_1; break;
+                case BRUSHPATH_START_END_ID: attrib = &seg.path_start_end; break;
+                case BRUSHPATH_OFFSET_ID:    attrib = &seg.offset; break;
+                case BRUSHPATH_PARAM_ID:     attrib = &seg.param; break;
+                default: break;
+                }
+                for (int c = 0; c < 4; c++)
+                    buf[k*4+c] = (*attrib)[c];
+            }
+            _path_verts_fbo.loadSubColorTexturef(b, buf, x, y, count, 1);
+        }
+        start += count;
+    }
+}
+
 void ASRenderer::updateStyle()
 {
     _globalStyle.penStyle("Base Style")->setTexture(k_texture);
@@ -136,6 +172,23 @@ void ASRenderer::renderStrokes()
 {
     makePathVertexFBO();
     reportGLError();
+    drawStrokes();
+}
+
+void ASRenderer::renderStrokes(std::vector<Segment>& segments, std::vector<PathRange>& ranges)
+{
+    _segments.swap(segments);
+    _ranges.swap(ranges);
+    uploadPathVertices();
+    reportGLError();
+    drawStrokes();
+}
+
+void ASRenderer::drawStrokes()
+{
+    if(_clip_buf_width == 0)
+        return; // nothing uploaded yet
+
     updateStyle();
 
     GQShaderRef shader = GQShaderManager::bindProgram("stroke_render_snakes");
@@ -258,35 +311,46 @@ void ASRenderer::drawSpine()
     glPopMatrix();
 }
 
-typedef struct {
-    vec4 vertex_0;
-    vec4 vertex_1;
-    vec4 path_start_end;
-    vec4 offset;
-    vec4 param;
-} Segment;
+// Clean segments between two changed paths uploaded anyway, to save calls
+static const int k_maxCleanGap = 32;
+
+float ASRenderer::textureLength() const
+{
+    const NPRPenStyle* vis_focus = _globalStyle.penStyle("Base Style");
+    float texture_length=16;
+    if(vis_focus->texture()){
+        const GQTexture* vis_focus_tex = vis_focus->texture();
+        texture_length = vis_focus_tex->width();
+    }
+    return texture_length;
+}
 
 bool ASRenderer::makePathVertexFBO()
 {
-    QList<Segment> segments;
+    buildSegments(*_snakes, _segments, _ranges, textureLength());
+    return uploadPathVertices();
+}
+
+void ASRenderer::buildSegments(ASSnakes& snakes, std::vector<Segment>& segments,
+                               std::vector<PathRange>& ranges, float texture_length)
+{
+    segments.clear();
+    ranges.clear();
 
     // Load the snakes into the images.
     int segment_counter = 0;
     float num_samples_offset = 0.0f;
     float arc_length_offset = 0.0f;
 
-    const NPRPenStyle* vis_focus = _globalStyle.penStyle("Base Style");
-    float texture_length=16;
-    if(vis_focus->texture()){
-        const GQTexture* vis_focus_tex = vis_focus->texture();
-        texture_length = vis_focus_tex->width();
-    }
     float length_scale = k_lengthScale.value();
 
-    for (int i = 0; i < _snakes->nbContours(); i++){
-        ASContour* contour = _snakes->at(i);
+    for (int i = 0; i < snakes.nbContours(); i++){
+        ASContour* contour = snakes.at(i);
 
+        int nbBrushPathsBefore = contour->nbBrushPaths();
         contour->cleanBrushPath();
+        if(contour->nbBrushPaths() != nbBrushPathsBefore)
+            snakes.invalidateBrushPaths();
 
         int nbBrushPaths = contour->nbBrushPaths();
 
@@ -303,6 +367,10 @@ bool ASRenderer::makePathVertexFBO()
             ASBrushPath* brushPath = contour->brushPath(idx);
             brushPath->computeArcLength();
 
+            // Counts set below, the path can end with a continue
+            PathRange range = { brushPath->id(), int(segments.size()), 0 };
+            ranges.push_back(range);
+
             int nverts = brushPath->nbVertices();
             if(brushPath->isClosed())
                 nverts+=1;
@@ -380,7 +448,7 @@ bool ASRenderer::makePathVertexFBO()
                             vec4 param(brushPath->param(- length * (ido+1))*fact,brushPath->param(arcLength)*fact,level,level);
                             seg.param = param;
 
-                            segments<<seg;
+                            segments.push_back(seg);
                             segment_counter++;
                         }
                         pPos = nPos;
@@ -407,7 +475,7 @@ bool ASRenderer::makePathVertexFBO()
                     vec4 param(brushPath->param(- length)*fact,brushPath->param(0)*fact,level,level);
                     seg.param = param;
 
-                    segments<<seg;
+                    segments.push_back(seg);
                     segment_counter++;
 
                 }
@@ -437,7 +505,7 @@ bool ASRenderer::makePathVertexFBO()
                     vec4 param(brushPath->param(-overshoot)*fact,brushPath->param(0)*fact,level,level);
                     seg.param = param;
 
-                    segments<<seg;
+                    segments.push_back(seg);
                     segment_counter++;
                 }
             }
@@ -461,7 +529,7 @@ bool ASRenderer::makePathVertexFBO()
                 seg.offset = vec4(num_samples_offset,arc_length_offset,num_samples,arc_length);
                 seg.param = vec4(brushPath->param(j)*fact,brushPath->param(j+1)*fact,level,level);
 
-                segments<<seg;
+                segments.push_back(seg);
 
                 segment_counter++;
             }
@@ -487,7 +555,7 @@ bool ASRenderer::makePathVertexFBO()
                 vec4 param(brushPath->param(brushPath->last()->length())*fact,brushPath->param(arc_length)*fact,level,level);
                 seg.param = param;
 
-                segments<<seg;
+                segments.push_back(seg);
 
                 segment_counter++;
             }
@@ -532,7 +600,7 @@ bool ASRenderer::makePathVertexFBO()
                     vec4 param(brushPath->param(brushPath->last()->length())*fact,brushPath->param(brushPath->last()->length() + length)*fact,level,level);
                     seg.param = param;
 
-                    segments<<seg;
+                    segments.push_back(seg);
                     segment_counter++;
 
                     for (int ido = 1; ido <= numOvershootSegment; ido++)
@@ -564,7 +632,7 @@ bool ASRenderer::makePathVertexFBO()
                             vec4 param(brushPath->param(brushPath->last()->length() + (ido-1) * length)*fact,brushPath->param(brushPath->last()->length() + arcLength)*fact,level,level);
                             seg.param = param;
 
-                            segments<<seg;
+                            segments.push_back(seg);
                             segment_counter++;
                         }
                         pPos = nPos;
@@ -597,7 +665,7 @@ bool ASRenderer::makePathVertexFBO()
                     vec4 param(brushPath->param(brushPath->last()->length())*fact,brushPath->param(brushPath->last()->length()+overshoot)*fact,level,level);
                     seg.param = param;
 
-                    segments<<seg;
+                    segments.push_back(seg);
 
                     segment_counter++;
                 }
@@ -613,81 +681,87 @@ bool ASRenderer::makePathVertexFBO()
         }
     }
 
+    for(size_t r=0; r<ranges.size(); r++){
+        int end = (r+1 < ranges.size()) ? ranges[r+1].start : int(segments.size());
+        ranges[r].count = end - ranges[r].start;
+    }
+}
+
+bool ASRenderer::uploadPathVertices()
+{
     // Count the total number of segments.
-    _total_segments = segments.count();
+    _total_segments = _segments.size();
 
-    _clip_buf_width = GQFramebufferObject::maxFramebufferSize();
-    int clip_buf_height = ceil(((double)_total_segments) / (double)_clip_buf_width);
+    // The textures only grow (geometrically) and are reused across frames
+    int width = GQFramebufferObject::maxFramebufferSize();
+    int clip_buf_height = ceil(((double)_total_segments) / (double)width);
     clip_buf_height = std::max(clip_buf_height,1);
-    if (clip_buf_height > _clip_buf_width)
+    if (clip_buf_height > width)
     {
         qCritical("Too many segments for clip buffer (%d, max is %d)\n",
-                  _total_segments, _clip_buf_width*_clip_buf_width);
+                  _total_segments, width*width);
         return false;
     }
-    int max_segments = _clip_buf_width*clip_buf_height;
-
-    _path_verts_fbo.initGL(GL_TEXTURE_RECTANGLE_ARB, GL_RGBA_FLOAT32_ATI,
-                           GQ_ATTACH_NONE, NUM_BRUSHPATH_BUFFERS,
-                           _clip_buf_width, clip_buf_height );
-
-    GQFloatImage vertex_0_img, vertex_1_img, path_start_end_img, offset_img, param_img;
-    vertex_0_img.resize(_clip_buf_width, clip_buf_height, 4);
-    vertex_1_img.resize(_clip_buf_width, clip_buf_height, 4);
-    path_start_end_img.resize(_clip_buf_width, clip_buf_height, 4);
-    offset_img.resize(_clip_buf_width, clip_buf_height, 4);
-    param_img.resize(_clip_buf_width, clip_buf_height, 4);
-
-    float* vertex_0_buf = vertex_0_img.raster();
-    float* vertex_1_buf = vertex_1_img.raster();
-    float* path_start_end_buf = path_start_end_img.raster();
-    float* offset_buf = offset_img.raster();
-    float* param_buf = param_img.raster();
-
-    for (int i = 0; i < max_segments*4; i++){
-        vertex_0_buf[i] = 0.0f;
-        vertex_1_buf[i] = 0.0f;
-        path_start_end_buf[i] = 0.0f;
-        offset_buf[i] = 0.0f;
-        param_buf[i] = 0.0f;
+
+    if (width != _clip_buf_width || clip_buf_height > _clip_buf_height)
+    {
+        _clip_buf_width = width;
+        _clip_buf_height = std::min(width, std::max(clip_buf_height, 2*_clip_buf_height));
+        _path_verts_fbo.initGL(GL_TEXTURE_RECTANGLE_ARB, GL_RGBA_FLOAT32_ATI,
+                               GQ_ATTACH_NONE, NUM_BRUSHPATH_BUFFERS,
+                               _clip_buf_width, _clip_buf_height );
+        _path_verts_fbo.setTextureFilter(GL_NEAREST, GL_NEAREST);
+        _path_verts_fbo.setTextureWrap(GL_CLAMP, GL_CLAMP);
+        _uploaded.clear();
+        _uploaded_ranges.clear();
     }
 
-    for (int i = 0; i < _total_segments; i++){
-        Segment seg = segments.at(i);
-
-        vertex_0_buf[i*4]   = seg.vertex_0[0];
-        vertex_0_buf[i*4+1] = seg.vertex_0[1];
-        vertex_0_buf[i*4+2] = seg.vertex_0[2];
-        vertex_0_buf[i*4+3] = seg.vertex_0[3];
-
-        vertex_1_buf[i*4]   = seg.vertex_1[0];
-        vertex_1_buf[i*4+1] = seg.vertex_1[1];
-        vertex_1_buf[i*4+2] = seg.vertex_1[2];
-        vertex_1_buf[i*4+3] = seg.vertex_1[3];
-
-        path_start_end_buf[i*4]   = seg.path_start_end[0];
-        path_start_end_buf[i*4+1] = seg.path_start_end[1];
-        path_start_end_buf[i*4+2] = seg.path_start_end[2];
-        path_start_end_buf[i*4+3] = seg.path_start_end[3];
-
-        offset_buf[i*4]   = seg.offset[0];
-        offset_buf[i*4+1] = seg.offset[1];
-        offset_buf[i*4+2] = seg.offset[2];
-        offset_buf[i*4+3] = seg.offset[3];
-
-        param_buf[i*4]   = seg.param[0];
-        param_buf[i*4+1] = seg.param[1];
-        param_buf[i*4+2] = seg.param[2];
-        param_buf[i*4+3] = seg.param[3];
+    _uploaded_by_id.clear();
+    for (int r = 0; r < int(_uploaded_ranges.size()); r++)
+        _uploaded_by_id.insert(_uploaded_ranges[r].id, r);
+
+    // Upload the brush paths that moved in the textures or changed since
+    // the last upload. Offsets and path pointers are cumulative, so an
+    // edit shifts the following paths, which are then re-sent as well.
+    int nbUploaded = 0;
+    int nbPathsUploaded = 0;
+    int nbUploadedPrev = _uploaded.size();
+    int runStart = -1;
+    int runEnd = -1;
+    for (size_t r = 0; r < _ranges.size(); r++){
+        const PathRange& range = _ranges[r];
+        if (range.count == 0)
+            continue;
+
+        int prev = range.id >= 0 ? _uploaded_by_id.value(range.id, -1) : -1;
+        if (prev >= 0 && _uploaded_ranges[prev].start == range.start &&
+            _uploaded_ranges[prev].count == range.count &&
+            range.start + range.count <= nbUploadedPrev &&
+            memcmp(&_segments[range.start], &_uploaded[range.start], range.count*sizeof(Segment)) == 0)
+            continue;
+
+        nbPathsUploaded++;
+        if (runStart >= 0 && range.start - runEnd <= k_maxCleanGap){
+            runEnd = range.start + range.count;
+            continue;
+        }
+        if (runStart >= 0){
+            uploadSegments(runStart, runEnd);
+            nbUploaded += runEnd - runStart;
+        }
+        runStart = range.start;
+        runEnd = range.start + range.count;
+    }
+    if (runStart >= 0){
+        uploadSegments(runStart, runEnd);
+        nbUploaded += runEnd - runStart;
     }
+    _uploaded.swap(_segments);
+    _uploaded_ranges.swap(_ranges);
 
-    _path_verts_fbo.loadSubColorTexturef(BRUSHPATH_VERTEX_0_ID, vertex_0_img);
-    _path_verts_fbo.loadSubColorTexturef(BRUSHPATH_VERTEX_1_ID, vertex_1_img);
-    _path_verts_fbo.loadSubColorTexturef(BRUSHPATH_START_END_ID, path_start_end_img);
-    _path_verts_fbo.loadSubColorTexturef(BRUSHPATH_OFFSET_ID, offset_img);
-    _path_verts_fbo.loadSubColorTexturef(BRUSHPATH_PARAM_ID, param_img);
-    _path_verts_fbo.setTextureFilter(GL_NEAREST, GL_NEAREST);
-    _path_verts_fbo.setTextureWrap(GL_CLAMP, GL_CLAMP);
+    __SET_COUNTER("Stroke segments", _total_segments);
+    __SET_COUNTER("Stroke segments uploaded", nbUploaded);
+    __SET_COUNTER("Stroke paths uploaded", nbPathsUploaded);
 
     return true;
 }
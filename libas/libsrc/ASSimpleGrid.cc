@@ -14,59 +14,123 @@ See the COPYING file for details.
 
 #include "ASSimpleGrid.h"
 #include "GQDraw.h"
+#include "ASRandom.h"
+
+#include <algorithm>
+#include <limits>
+
+#if defined(__SSE__) || defined(_M_X64)
+#define AS_USE_SSE
+#include <xmmintrin.h>
+#endif
 
 dkBool k_drawGrid("Contours->Draw->Grid", false);
 
-static int seed = 0;
+static const int k_minSlots = 256;
 
 ASSimpleGrid::ASSimpleGrid()
 {
+    _nbCells = 0;
+    _nbCols = 0;
+    _cellSize = 1;
+    rehash(k_minSlots);
+}
+
+ASSimpleGrid::~ASSimpleGrid()
+{
+    qDeleteAll(_cells);
 }
 
 void ASSimpleGrid::clear()
 {
-    qDeleteAll(_hashTable);
-    _hashTable.clear();
+    // Cells are kept in the pool for the next frame
+    _nbCells = 0;
+    std::fill(_slotCells.begin(),_slotCells.end(),-1);
+}
+
+void ASSimpleGrid::rehash(int capacity)
+{
+    _slotKeys.assign(capacity,0);
+    _slotCells.assign(capacity,-1);
+    _slotMask = capacity-1;
+    for(int i=0; i<_nbCells; ++i){
+        int s = slot(_keys[i]);
+        _slotKeys[s] = _keys[i];
+        _slotCells[s] = i;
+    }
 }
 
-void ASSimpleGrid::init(int width, ASClipPathSet& pathSet)
+int ASSimpleGrid::cellIndex(int key, int r, int c)
+{
+    int s = slot(key);
+    if(_slotCells[s] >= 0)
+        return _slotCells[s];
+
+    // Keep the load factor under 1/2
+    if(2*(_nbCells+1) > int(_slotCells.size())){
+        rehash(2*_slotCells.size());
+        s = slot(key);
+    }
+
+    if(_nbCells < int(_cells.size())){
+        _cells[_nbCells]->reset(r,c);
+        _keys[_nbCells] = key;
+    }else{
+        _cells.push_back(new ASCell(r,c));
+        _keys.push_back(key);
+    }
+    _slotKeys[s] = key;
+    _slotCells[s] = _nbCells;
+
+    return _nbCells++;
+}
+
+ASCell* ASSimpleGrid::insert(int key, int r, int c)
+{
+    return _cells[cellIndex(key,r,c)];
+}
+
+ASCell* ASSimpleGrid::insert(vec2 pos)
+{
+    float r,c;
+    posToCellCoord(pos,r,c);
+    return insert(c+_nbCols*r,r,c);
+}
+
+void ASSimpleGrid::init(int width, ASClipPathSet& pathSet, quint64 frame)
 {
     clear();
     _nbCols = float(width)/_cellSize;
 
     //random origin
-    //srand ( time(NULL) );
-    srand (seed);
-    seed++;
-    _oGrid = vec2i((rand() % _cellSize),(rand() % _cellSize));//vec2i(0,0);//
+    ASRandom random(frame, ASRandom::GRID_ORIGIN);
+    _oGrid = vec2i(random.index(_cellSize),random.index(_cellSize));
 
     if(k_drawGrid){
         startDrawGrid(_oGrid,_cellSize);
         glBegin(GL_POINTS);
     }
 
-    //fill in the grid with the clipped paths
+    //find the cell of each clip vertex and count the vertices per cell
+    _clipCells.clear();
+    _clipOffsets.clear();
     for(int i=0; i<pathSet.size(); ++i){
         ASClipPath *path = pathSet[i];
 
-        ASCell* cell;
-
         for(int j=0; j<path->size(); ++j){
             ASClipVertex *cv = (*path)[j];
             vec2 pos = cv->position2D();
             float r,c;
             posToCellCoord(pos,r,c);
 
-            if(contains(c+_nbCols*r)){
-                cell = _hashTable[c+_nbCols*r];
-            }else{
+            int idx = cellIndex(c+_nbCols*r,r,c);
+            if(idx == int(_clipOffsets.size())){
                 if(k_drawGrid)
                     glVertex2f(r*_cellSize + _oGrid[0],c*_cellSize + _oGrid[1]);
-                cell = new ASCell(r,c);
-                _hashTable[c+_nbCols*r] = cell;
+                _clipOffsets.push_back(0);
             }
-
-            cell->addClipVertex(cv);
+            _clipOffsets[idx]++;
+            _clipCells.push_back(idx);
         }
     }
     if(k_drawGrid){
@@ -74,13 +138,145 @@ void ASSimpleGrid::init(int width, ASClipPathSet& pathSet)
         stopDrawGrid();
     }
 
+    //exclusive prefix sum, then scatter the vertices in path order
+    int sum = 0;
+    for(int i=0; i<_nbCells; ++i){
+        int count = _clipOffsets[i];
+        _clipOffsets[i] = sum;
+        sum += count;
+    }
+    _clipOffsets.push_back(sum);
+    _clipVertices.resize(sum);
+
+    int k = 0;
+    for(int i=0; i<pathSet.size(); ++i){
+        ASClipPath *path = pathSet[i];
+        for(int j=0; j<path->size(); ++j, ++k)
+            _clipVertices[_clipOffsets[_clipCells[k]]++] = (*path)[j];
+    }
+
+    //offsets now point to the end of each range
+    for(int i=0; i<_nbCells; ++i){
+        int first = (i==0) ? 0 : _clipOffsets[i-1];
+        _cells[i]->setClipVertices(sum > 0 ? &_clipVertices[first] : NULL, _clipOffsets[i]-first, first);
+    }
+
+    _clipX.resize(sum);
+    _clipY.resize(sum);
+    _clipTx.resize(sum);
+    _clipTy.resize(sum);
+    _clipVisibility.resize(sum);
+    for(int i=0; i<sum; ++i){
+        ASClipVertex* cv = _clipVertices[i];
+        _clipX[i] = cv->position()[0];
+        _clipY[i] = cv->position()[1];
+        _clipTx[i] = cv->tangent()[0];
+        _clipTy[i] = cv->tangent()[1];
+        _clipVisibility[i] = cv->visibility();
+    }
+}
+
+void ASSimpleGrid::closestInCell(const ASCell* cell, vec2 pos, vec2 tangent, float minDot,
+                                 float maxDist2, float minVisibility,
+                                 float& best, ASClipVertex*& closest) const
+{
+    const float inf = std::numeric_limits<float>::infinity();
+    const int first = cell->clipIndex();
+    const int count = cell->nbClipVertices();
+    if(count == 0)
+        return;
+    const float* X = &_clipX[first];
+    const float* Y = &_clipY[first];
+    const float* TX = &_clipTx[first];
+    const float* TY = &_clipTy[first];
+    const float* V = &_clipVisibility[first];
+
+    // Rejected candidates get an infinite distance
+    float dist[4];
+    int k = 0;
+#ifdef AS_USE_SSE
+    const __m128 px = _mm_set1_ps(pos[0]), py = _mm_set1_ps(pos[1]);
+    const __m128 tx = _mm_set1_ps(tangent[0]), ty = _mm_set1_ps(tangent[1]);
+    const __m128 dotMin = _mm_set1_ps(minDot), distMax = _mm_set1_ps(maxDist2);
+    const __m128 visMin = _mm_set1_ps(minVisibility), rejected = _mm_set1_ps(inf);
+    const __m128 sign = _mm_set1_ps(-0.f);
+    for(; k+4<=count; k+=4){
+        __m128 dx = _mm_sub_ps(_mm_loadu_ps(X+k), px);
+        __m128 dy = _mm_sub_ps(_mm_loadu_ps(Y+k), py);
+        __m128 d  = _mm_add_ps(_mm_mul_ps(dx,dx), _mm_mul_ps(dy,dy));
+        __m128 dot = _mm_andnot_ps(sign, _mm_add_ps(_mm_mul_ps(tx,_mm_loadu_ps(TX+k)),
+                                                    _mm_mul_ps(ty,_mm_loadu_ps(TY+k))));
+        __m128 ok = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(dot,dotMin), _mm_cmple_ps(d,distMax)),
+                               _mm_cmpge_ps(_mm_loadu_ps(V+k),visMin));
+        _mm_storeu_ps(dist, _mm_or_ps(_mm_and_ps(ok,d), _mm_andnot_ps(ok,rejected)));
+        for(int l=0; l<4; ++l){
+            ASClipVertex* cv = _clipVertices[first+k+l];
+            if(dist[l] < best || (dist[l] == best && closest && cv < closest)){
+                best = dist[l];
+                closest = cv;
+            }
+        }
+    }
+#endif
+    for(; k<count; ++k){
+        float dx = X[k] - pos[0], dy = Y[k] - pos[1];
+        float d = dx*dx + dy*dy;
+        float dot = fabs(tangent[0]*TX[k] + tangent[1]*TY[k]);
+        dist[0] = (dot >= minDot && d <= maxDist2 && V[k] >= minVisibility) ? d : inf;
+        ASClipVertex* cv = _clipVertices[first+k];
+        if(dist[0] < best || (dist[0] == best && closest && cv < closest)){
+            best = dist[0];
+            closest = cv;
+        }
+    }
+}
+
+ASClipVertex* ASSimpleGrid::findClosestClipVertex(vec2 pos, vec2 tangent, float minDot,
+                                                  float maxDist2, float minVisibility) const
+{
+    const ASCell* cells[4];
+    neighborCells(pos,cells);
+
+    float best = std::numeric_limits<float>::infinity();
+    ASClipVertex* closest = NULL;
+    for(int i=0; i<4; ++i){
+        if(cells[i])
+            closestInCell(cells[i],pos,tangent,minDot,maxDist2,minVisibility,best,closest);
+    }
+    return closest;
+}
+
+void ASSimpleGrid::findClosestClipVertices(int n, const vec2* positions, const vec2* tangents,
+                                           float minDot, float maxDist2, float minVisibility,
+                                           ASClipVertex** closest) const
+{
+    // Consecutive positions mostly fall in the same cells
+    const ASCell* cells[4] = { NULL, NULL, NULL, NULL };
+    int lastKey = 0;
+    vec2i lastOffsets(0,0);
+
+    for(int v=0; v<n; ++v){
+        vec2i offsets;
+        int key = posToKey(positions[v],offsets);
+        if(v == 0 || key != lastKey || offsets[0] != lastOffsets[0] || offsets[1] != lastOffsets[1]){
+            neighborCells(positions[v],cells);
+            lastKey = key;
+            lastOffsets = offsets;
+        }
+
+        float best = std::numeric_limits<float>::infinity();
+        closest[v] = NULL;
+        for(int i=0; i<4; ++i){
+            if(cells[i])
+                closestInCell(cells[i],positions[v],tangents[v],minDot,maxDist2,minVisibility,best,closest[v]);
+        }
+    }
 }
 
 void ASSimpleGrid::addSnakeToGrid(ASContour* contour)
 {
     ASContour::ContourIterator it = contour->iterator();
 
-    ASCell* cell;
     int idx=0;
 
     while(it.hasNext()){
@@ -89,13 +285,7 @@ void ASSimpleGrid::addSnakeToGrid(ASContour* contour)
         float r,c;
         posToCellCoord(v->position(),r,c);
 
-        int key = c+_nbCols*r;
-        if(contains(key)){
-            cell = _hashTable[key];
-        }else{
-            cell = new ASCell(r,c);
-            _hashTable[key] = cell;
-        }
+        ASCell* cell = insert(c+_nbCols*r,r,c);
         if(k_drawGrid)
             glVertex2f((r+0.5)*_cellSize + _oGrid[0],(c+0.5)*_cellSize + _oGrid[1]);
         cell->addContourVertex(v,false);
@@ -16,6 +16,7 @@ See the COPYING file for details.
 #include "ASEdgeContour.h"
 #include "ASClipPath.h"
 #include "GQGPUImageProcessing.h"
+#include "GQCPUImageProcessing.h"
 #include <QDebug>
 #include <QTextStream>
 #include <QDir>
@@ -32,6 +33,10 @@ See the COPYING file for details.
 
 static dkBool  k_enableRelaxation("Contours->Relaxation->Activate", true);
 static dkInt   k_blurIter("Contours->Relaxation->Blur iterations", 2, 0, 100, 1);
+static dkBool  k_cpuAttraction("Contours->Relaxation->CPU attraction field", false);
+static dkBool  k_tiledAttraction("Contours->Relaxation->Tiled attraction field", false);
+static dkFloat k_tileMargin("Contours->Relaxation->Tile margin", 16.0f, 0.f, 200.f, 1.f);
+static dkBool  k_parallelRelaxation("Contours->Relaxation->Parallel", false);
 static dkFloat k_samplingMax("Contours->Resampling->s max", 6.0f);
 static dkFloat k_samplingMin("Contours->Resampling->s min", 4.0f);
        dkFloat k_coverRadius("Contours->Topology->Cover radius", 5.0f);
@@ -43,6 +48,7 @@ static dkBool  k_useAdvection("Contours->Advection", true);
 static dkBool  k_relAdvection("Contours->Adv. relative", true);
 
 static dkInt   k_iterCoverage("Contours->Topology->Cover iter",10);
+static dkInt   k_coverageBatch("Contours->Topology->Cover seeds per pass", 1, 1, 64, 1);
 static dkFloat k_minLength("Contours->Topology->Min length", 2.0,0.0,10000.0,0.5);
 static dkFloat k_minLengthHyst("Contours->Topology->Min length hyst", 0.5,0.0,1.0,0.1);
 static dkBool  k_enableTopology("Contours->Topology->Activate", true);
@@ -59,12 +65,17 @@ static dkBool  k_useVisibility("Contours->Topology->Visibility", false);
 extern dkFloat k_visibilityTh;
 static dkBool  k_initBP("BrushPaths->Confidence->Init",false);
 static dkBool  k_mergeBP("BrushPaths->Merge->Activate", true);
+static dkBool  k_parallelBP("BrushPaths->Parallel", false);
 
 dkFloat k_trimRatio("Contours->Topology->Trim ratio", 1.5f,0.1f,100.f,1.f);
 
 ASSnakes::ASSnakes()
 {
     _refImg = NULL;
+    _frame = 0;
+    _nextContourId = 0;
+    _nextBrushPathId = 0;
+    _brushPathsDirty = false;
     _sMax = k_samplingMax.value();
     _sMin = k_samplingMin.value();
 }
@@ -79,6 +90,12 @@ void ASSnakes::clear()
     qDeleteAll(_contourList);
     _contourList.clear();
     _simpleGrid.clear();
+    _frame = 0;
+    _nextContourId = 0;
+    _brushPaths.clear();
+    _brushPathsById.clear();
+    _nextBrushPathId = 0;
+    _brushPathsDirty = false;
 }
 
 void ASSnakes::init(ASClipPathSet& pathSet, bool noConnectivity)
@@ -117,6 +134,8 @@ void ASSnakes::init(ASClipPathSet& pathSet, bool noConnectivity)
     }
     minLengthCleaning();
     remove();
+
+    indexBrushPaths();
 }
 
 void ASSnakes::setSMin(double min) {
@@ -135,45 +154,132 @@ void ASSnakes::setCoverRadius(double radius) {
 void ASSnakes::updateRefImage(GQTexture2D* refImg, GQFloatImage* geomFlow, GQFloatImage* denseFlow, ASClipPathSet& pathSet, bool useMotion)
 {
     _refImg = refImg;
-    _width = refImg->width();
 
-    /******************* ADVECTION **********************/
+    advectContours(geomFlow, denseFlow, useMotion);
+
+    /************ Attraction field computation **********/
+    {
+        __TIME_CODE_BLOCK("Attraction field");
+        if(k_cpuAttraction){
+            // Only the channel used by the gradient is read back
+            refImg->readPixels(_refPixels, 1);
+            computeAttractionField(_refPixels);
+        }else{
+            // Blur and gradient on the GPU
+            GQGPUImageProcessing::blurAndGrad(k_blurIter, refImg, _fext);
+            _attractionField.clear();
+        }
+    }
+
+    track(_fext, pathSet);
+}
+
+void ASSnakes::updateRefImage(const GQFloatImage& refImg, GQFloatImage* geomFlow, GQFloatImage* denseFlow, ASClipPathSet& pathSet, bool useMotion)
+{
+    _refImg = NULL;
+
+    advectContours(geomFlow, denseFlow, useMotion);
+
+    /************ Attraction field computation **********/
+    {
+        __TIME_CODE_BLOCK("Attraction field");
+        computeAttractionField(refImg);
+    }
+
+    track(_fext, pathSet);
+}
+
+void ASSnakes::update(GQFloatImage& fext, GQFloatImage* geomFlow, GQFloatImage* denseFlow, ASClipPathSet& pathSet, bool useMotion)
+{
+    advectContours(geomFlow, denseFlow, useMotion);
+    track(fext, pathSet);
+}
+
+void ASSnakes::advectContours(GQFloatImage* geomFlow, GQFloatImage* denseFlow, bool useMotion)
+{
     if(k_useAdvection && useMotion) {
         __TIME_CODE_BLOCK("Advection");
         advect(geomFlow,denseFlow);
     }
+}
 
-    GQFloatImage fext(_width,_refImg->height(),4);
+void ASSnakes::computeAttractionField(const GQFloatImage& refImg)
+{
+    if(k_tiledAttraction){
+        // Only around the advected contours
+        _attractionField.compute(k_blurIter, refImg, _contourList, k_tileMargin, _fext);
+        __SET_COUNTER("Attraction tiles computed", _attractionField.nbComputedTiles());
+        __SET_COUNTER("Attraction tiles cached", _attractionField.nbCachedTiles());
+    }else{
+        GQCPUImageProcessing::blurAndGrad(k_blurIter, refImg, _fext, _blurBuffer, _blurScratch);
+        _attractionField.clear();
+    }
+}
 
-    buildSimpleGrid(pathSet);
+void ASSnakes::track(GQFloatImage& fext, ASClipPathSet& pathSet)
+{
+    _frame++;
+    _width = fext.width();
 
-    /************ Attraction field computation **********/
+    // Resampling and topology delete brush paths, reindexed by fitBrushPath()
+    _brushPathsDirty = true;
 
-    // Blur and gradient on the GPU
-    GQGPUImageProcessing::blurAndGrad(k_blurIter, refImg, fext);
+    buildSimpleGrid(pathSet);
 
     /*************** RELAXATION ****************/
     {
         __TIME_CODE_BLOCK("Relaxation");
-        // Deform the contours
+        ASDeformStats stats;
         for(int i=0; i<_contourList.size(); i++){
             ASContour* c = _contourList[i];
             c->notNew();
             c->computeLength();
             c->checkClosed();
+        }
 
-            if(k_enableRelaxation){
-                _deformer.iterate(*c,fext);
-            }else{
-                while(c->resample()){};
+        // Deform the contours
+        if(k_enableRelaxation && k_parallelRelaxation){
+            // Each contour only reads fext and writes its own vertices.
+            // Largest contours are scheduled first to balance the threads.
+            QList< QPair<int,int> > order;
+            for(int i=0; i<_contourList.size(); i++)
+                order << QPair<int,int>(-_contourList.at(i)->nbVertices(),i);
+            std::sort(order.begin(),order.end());
+
+            const int nbContours = order.size();
+            std::vector<ASDeformStats> contourStats(nbContours);
+            #pragma omp parallel for schedule(dynamic,1)
+            for(int i=0; i<nbContours; i++){
+                _deformer.iterate(*_contourList.at(order.at(i).second),fext,&contourStats[i]);
+            }
+            for(int i=0; i<nbContours; i++)
+                stats.add(contourStats[i]);
+        }else{
+            for(int i=0; i<_contourList.size(); i++){
+                ASContour* c = _contourList[i];
+                if(k_enableRelaxation){
+                    _deformer.iterate(*c,fext,&stats);
+                }else{
+                    while(c->resample()){};
+                }
             }
         }
+
+        __SET_COUNTER("Relaxation solves", stats.solves);
+        __SET_COUNTER("Relaxation factorizations", stats.factorizations);
+        __SET_COUNTER("Relaxation reused factorizations", stats.reusedFactorizations);
+        __SET_COUNTER("Relaxation converged contours", stats.converged);
+        __SET_COUNTER("Relaxation max displacement", stats.maxDisplacement);
+        __SET_COUNTER("Relaxation mean displacement", _contourList.isEmpty() ? 0.f : stats.sumDisplacement / _contourList.size());
     }
 
     /*************** CLEANING ****************/
     addSnakesToGrid();
 
-    findClosestEdgeRef();
+    {
+        __TIME_CODE_BLOCK("Closest edges");
+        findClosestEdgeRef();
+    }
 
     if(k_enableTopology){
 
@@ -183,22 +289,30 @@ void ASSnakes::updateRefImage(GQTexture2D* refImg, GQFloatImage* geomFlow, GQFlo
             remove(); // because "findClosestEdgeRef" decreases the confidence
 
         if(k_enableSplit){
+            __TIME_CODE_BLOCK("Topology: split");
             splitContoursTangent();
         }
 
         if(k_enableTrim){
+            __TIME_CODE_BLOCK("Topology: trim");
             trim();
             remove(); // because "trim" decreases the confidence
         }
 
-        if(k_enableCoverage)
+        if(k_enableCoverage){
+            __TIME_CODE_BLOCK("Topology: coverage");
             coverage(pathSet);
+        }
 
-        if(k_enableSplitAtJunctions)
+        if(k_enableSplitAtJunctions){
+            __TIME_CODE_BLOCK("Topology: junctions");
             splitAtJunctions();
+        }
 
-        if(k_enableMerge)
+        if(k_enableMerge){
+            __TIME_CODE_BLOCK("Topology: merge");
             merge();
+        }
 
         if(k_minLength > 0.0){
             minLengthCleaning();
@@ -213,6 +327,8 @@ void ASSnakes::updateRefImage(GQTexture2D* refImg, GQFloatImage* geomFlow, GQFlo
 
 void ASSnakes::addSnakesToGrid()
 {
+    __TIME_CODE_BLOCK("Grid: snakes");
+
     if(k_drawGrid){
         glPointSize(1.f);
         _simpleGrid.startDrawGrid(_simpleGrid.origin(),_simpleGrid.cellSize(),false);
@@ -233,7 +349,8 @@ void ASSnakes::addSnakesToGrid()
 
 void ASSnakes::buildSimpleGrid(ASClipPathSet& pathSet)
 {
-    _simpleGrid.init(_width, pathSet);
+    __TIME_CODE_BLOCK("Grid: clip vertices");
+    _simpleGrid.init(_width, pathSet, _frame);
 }
 
 void ASSnakes::trimEnd(ASVertexContour** endPt)
@@ -308,12 +425,10 @@ bool ASSnakes::trim()
                     if(_simpleGrid.contains(key2)){
                         cell = _simpleGrid[key2];
 
-                        QList<ASClipVertex*> clipVertices = cell->clipVertices();
-
                         // Check all the clip vertices in this cell that this vertex covers
-                        for(int k=0; k < clipVertices.size() && !notFound; ++k){
+                        for(int k=0; k < cell->nbClipVertices() && !notFound; ++k){
                             bool foundCV=false;
-                            ASClipVertex* cv = clipVertices.at(k);
+                            ASClipVertex* cv = cell->clipVertex(k);
                             if(dist2(cv->position2D(),endPt->position())>_coverRadius) // not covered by this vertex
                                 continue;
 
@@ -385,43 +500,23 @@ void ASSnakes::splitAtIndices(ASContour* c, QList<int>& splitIndices)
             _simpleGrid[key]->removeEndPoint(c->first());
             _simpleGrid[key]->removeContourVertex(c->first());
             c->removeFirstVertex();
-            float r,cc;
-            _simpleGrid.posToCellCoord(c->first()->position(),r,cc);
-            key = cc+_simpleGrid.nbCols()*r;
-            if(!_simpleGrid.contains(key))
-                _simpleGrid.insert(key,new ASCell(r,cc));
-            _simpleGrid[key]->addEndPoint(c->first());
+            _simpleGrid.insert(c->first()->position())->addEndPoint(c->first());
         }else if(idx==c->nbVertices()-1){
             int key = _simpleGrid.posToKey(c->last()->position());
             _simpleGrid[key]->removeEndPoint(c->last());
             _simpleGrid[key]->removeContourVertex(c->last());
             c->removeLastVertex();
-            float r,cc;
-            _simpleGrid.posToCellCoord(c->last()->position(),r,cc);
-            key = cc+_simpleGrid.nbCols()*r;
-            if(!_simpleGrid.contains(key))
-                _simpleGrid.insert(key,new ASCell(r,cc));
-            _simpleGrid[key]->addEndPoint(c->last());
+            _simpleGrid.insert(c->last()->position())->addEndPoint(c->last());
         }else{
             ASContour* newContour = c->split(idx,idx);
 
             ASVertexContour* newEnd = c->last();
-            float r,cc;
-            _simpleGrid.posToCellCoord(newEnd->position(),r,cc);
-            int key = cc+_simpleGrid.nbCols()*r;
-            if(!_simpleGrid.contains(key))
-                _simpleGrid.insert(key,new ASCell(r,cc));
-            _simpleGrid[key]->addEndPoint(newEnd);
+            _simpleGrid.insert(newEnd->position())->addEndPoint(newEnd);
 
             if(newContour != NULL){
                 _contourList<<newContour;
                 ASVertexContour* newStart = newContour->first();
-                float r,cc;
-                _simpleGrid.posToCellCoord(newStart->position(),r,cc);
-                key = cc+_simpleGrid.nbCols()*r;
-                if(!_simpleGrid.contains(key))
-                    _simpleGrid.insert(key,new ASCell(r,cc));
-                _simpleGrid[key]->addEndPoint(newStart);
+                _simpleGrid.insert(newStart->position())->addEndPoint(newStart);
             }
         }
     }
@@ -492,11 +587,11 @@ void ASSnakes::splitContoursTangent()
 
 void ASSnakes::merge()
 {
-    QHashIterator<int,ASCell*> itCell(_simpleGrid.hash());
-    while(itCell.hasNext()){
-        itCell.next();
-        ASCell* cell = itCell.value();
-        int key = itCell.key();
+    // cells created while merging are not visited
+    int nbCells = _simpleGrid.nbCells();
+    for(int n=0; n<nbCells; ++n){
+        ASCell* cell = _simpleGrid.cell(n);
+        int key = _simpleGrid.key(n);
 
         initIterator:
 
@@ -649,12 +744,10 @@ void ASSnakes::merge()
                 newV->setInitialPosition(0.5f*(endPtContour->last()->initialPosition()+closestEndPtContour->first()->initialPosition()));
                 newV->setFinalPosition(0.5f*(endPtContour->last()->finalPosition()+closestEndPtContour->first()->finalPosition()));
                 newV->setClosestClipVertex(closestCV);
-                if(!_simpleGrid.contains(key) || !_simpleGrid[key]){
+                if(!_simpleGrid.contains(key)){
                     float r,c;
                     _simpleGrid.posToCellCoord(midPos,r,c);
-                    ASCell* cell = new ASCell(r,c);
-                    _simpleGrid.insert(key,cell);
-                    assert(_simpleGrid[key]);
+                    _simpleGrid.insert(key,r,c);
                 }
                 assert(_simpleGrid[key]);
                 _simpleGrid[key]->addContourVertex(newV);
@@ -681,11 +774,10 @@ void ASSnakes::merge()
                 newV->setInitialPosition(0.5f*(endPtContour->last()->initialPosition()+closestEndPtContour->first()->initialPosition()));
                 newV->setFinalPosition(0.5f*(endPtContour->last()->finalPosition()+closestEndPtContour->first()->finalPosition()));
                 newV->setClosestClipVertex(closestCV);
-                if(!_simpleGrid.contains(key) || !_simpleGrid[key]){
+                if(!_simpleGrid.contains(key)){
                     float r,c;
                     _simpleGrid.posToCellCoord(midPos,r,c);
-                    ASCell* cell = new ASCell(r,c);
-                    _simpleGrid[key] = cell;
+                    _simpleGrid.insert(key,r,c);
                 }
                 assert(_simpleGrid[key]);
                 _simpleGrid[key]->addContourVertex(newV);
@@ -714,11 +806,10 @@ void ASSnakes::merge()
                 newV->setInitialPosition(0.5f*(endPtContour->first()->initialPosition()+closestEndPtContour->last()->initialPosition()));
                 newV->setFinalPosition(0.5f*(endPtContour->first()->finalPosition()+closestEndPtContour->last()->finalPosition()));
                 newV->setClosestClipVertex(closestCV);
-                if(!_simpleGrid.contains(key) || !_simpleGrid[key]){
+                if(!_simpleGrid.contains(key)){
                     float r,c;
                     _simpleGrid.posToCellCoord(midPos,r,c);
-                    ASCell* cell = new ASCell(r,c);
-                    _simpleGrid[key] = cell;
+                    _simpleGrid.insert(key,r,c);
                 }
                 assert(_simpleGrid[key]);
                 _simpleGrid[key]->addContourVertex(newV);
@@ -758,11 +849,10 @@ void ASSnakes::merge()
                 newV->setFinalPosition(0.5f*(endPtContour->first()->finalPosition()+closestEndPtContour->last()->finalPosition()));
                 newV->setClosestClipVertex(closestCV);
 
-                if(!_simpleGrid.contains(key) || !_simpleGrid[key]){
+                if(!_simpleGrid.contains(key)){
                     float r,c;
                     _simpleGrid.posToCellCoord(midPos,r,c);
-                    ASCell* cell = new ASCell(r,c);
-                    _simpleGrid[key] = cell;
+                    _simpleGrid.insert(key,r,c);
                 }
                 assert(_simpleGrid[key]);
                 _simpleGrid[key]->addContourVertex(newV);
@@ -782,11 +872,10 @@ void ASSnakes::merge()
 
 void ASSnakes::splitAtJunctions()
 {
-    QHashIterator<int,ASCell*> itCell(_simpleGrid.hash());
     //all the cells
-    while(itCell.hasNext()){
-        itCell.next();
-        ASCell* cell = itCell.value();
+    int nbCells = _simpleGrid.nbCells();
+    for(int n=0; n<nbCells; ++n){
+        ASCell* cell = _simpleGrid.cell(n);
 
         QListIterator<ASVertexContour*> itEndPoints = cell->endPointsIterator();
 
@@ -963,32 +1052,13 @@ void ASSnakes::removeEndPointsFromGrid(ASContour* oldC)
 
 void ASSnakes::addEndPointsToGrid(ASContour* newC)
 {
-    vec2 pos = newC->last()->position();
-    int key = _simpleGrid.posToKey(pos);
-    if(_simpleGrid.contains(key)){
-        _simpleGrid[key]->addEndPoint(newC->last());
-        _simpleGrid[key]->addContourVertex(newC->last());
-    }else{
-        float r,c;
-        _simpleGrid.posToCellCoord(pos,r,c);
-        ASCell* cell = new ASCell(r,c);
-        _simpleGrid[key] = cell;
-        cell->addContourVertex(newC->last());
-        cell->addEndPoint(newC->last());
-    }
-    pos = newC->first()->position();
-    key = _simpleGrid.posToKey(pos);
-    if(_simpleGrid.contains(key)){
-        _simpleGrid[key]->addEndPoint(newC->first());
-        _simpleGrid[key]->addContourVertex(newC->first());
-    }else{
-        float r,c;
-        _simpleGrid.posToCellCoord(pos,r,c);
-        ASCell* cell = new ASCell(r,c);
-        _simpleGrid[key] = cell;
-        cell->addContourVertex(newC->first());
-        cell->addEndPoint(newC->first());
-    }
+    ASCell* cell = _simpleGrid.insert(newC->last()->position());
+    cell->addEndPoint(newC->last());
+    cell->addContourVertex(newC->last());
+
+    cell = _simpleGrid.insert(newC->first()->position());
+    cell->addEndPoint(newC->first());
+    cell->addContourVertex(newC->first());
 }
 
 void ASSnakes::addStartPoint(ASVertexContour *vertex, ASClipVertex* clipVertex, ASContour* contour)
@@ -1018,15 +1088,14 @@ void ASSnakes::addStartPoint(ASVertexContour *vertex, ASClipVertex* clipVertex,
             int key2 = cell->column()+i*offsets[1]+(cell->row()+j*offsets[0])*_simpleGrid.nbCols();
             if(_simpleGrid.contains(key2)){
                 ASCell* cell2=_simpleGrid[key2];
-                QList<ASClipVertex*> clipVertices = cell2->clipVertices();
-                for(int k=0; k<clipVertices.size(); ++k){
-                    ASClipVertex* cv = clipVertices.at(k);
+                for(int k=0; k<cell2->nbClipVertices(); ++k){
+                    ASClipVertex* cv = cell2->clipVertex(k);
                     if (!cv->isUncovered())
                         continue;
                     float dotProd = fabs(newVertex->tangent() DOT cv->tangent());
                     if(dotProd >= k_dotProdT && dist2(newVertex->position(),cv->position2D())<=_coverRadius){
                         cv->setCovered();
-                        _uncovered.removeAll(cv);
+                        removeUncovered(cv);
                     }
                 }
             }
@@ -1061,15 +1130,14 @@ void ASSnakes::addEndPoint(ASVertexContour *vertex, ASClipVertex* clipVertex, AS
             int key2 = cell->column()+i*offsets[1]+(cell->row()+j*offsets[0])*_simpleGrid.nbCols();
             if(_simpleGrid.contains(key2)){
                 ASCell* cell2=_simpleGrid[key2];
-                QList<ASClipVertex*> clipVertices = cell2->clipVertices();
-                for(int k=0; k<clipVertices.size(); ++k){
-                    ASClipVertex* cv = clipVertices.at(k);
+                for(int k=0; k<cell2->nbClipVertices(); ++k){
+                    ASClipVertex* cv = cell2->clipVertex(k);
                     if (!cv->isUncovered())
                         continue;
                     float dotProd = fabs(newVertex->tangent() DOT cv->tangent());
                     if(dotProd >= k_dotProdT && dist2(newVertex->position(),cv->position2D())<=_coverRadius){
                         cv->setCovered();
-                        _uncovered.removeAll(cv);
+                        removeUncovered(cv);
                     }
                 }
             }
@@ -1078,6 +1146,7 @@ void ASSnakes::addEndPoint(ASVertexContour *vertex, ASClipVertex* clipVertex, AS
 }
 
 bool ASSnakes::extend() {
+    __TIME_CODE_BLOCK("Topology: extend");
     bool modified=false;
 
     for(int idx=0; idx<_contourList.size(); idx++){
@@ -1254,12 +1323,7 @@ void ASSnakes::remove()
 
                     if(contour->nbVertices()>1){
                         v = contour->last();
-                        float r,c;
-                        _simpleGrid.posToCellCoord(v->position(),r,c);
-                        key = c+_simpleGrid.nbCols()*r;
-                        if(!_simpleGrid.contains(key))
-                            _simpleGrid.insert(key,new ASCell(r,c));
-                        _simpleGrid[key]->addEndPoint(v);
+                        _simpleGrid.insert(v->position())->addEndPoint(v);
                     }else if(contour->nbVertices()==1){
                         v = contour->first();
                         key = _simpleGrid.posToKey(v->position());
@@ -1384,18 +1448,14 @@ void ASSnakes::minLengthCleaning()
 
 void ASSnakes::markCoverage()
 {
-    QHashIterator<int,ASCell*> itCell(_simpleGrid.hash());
-    while(itCell.hasNext()){
-        itCell.next();
-        ASCell* cell = itCell.value();
+    for(int n=0; n<_simpleGrid.nbCells(); ++n){
+        ASCell* cell = _simpleGrid.cell(n);
 
-        int key = itCell.key();
+        int key = _simpleGrid.key(n);
         ASVertexContour* v = NULL;
 
-        const QList<ASClipVertex*>& clipVerticies = cell->clipVertices();
-
-        for(int l=0; l < clipVerticies.size(); ++l) {
-            ASClipVertex* cv = clipVerticies.at(l);
+        for(int l=0; l < cell->nbClipVertices(); ++l) {
+            ASClipVertex* cv = cell->clipVertex(l);
 
             if(cv->visibility()<k_visibilityTh)
                 continue;
@@ -1439,14 +1499,88 @@ void ASSnakes::markCoverage()
 
             if(!found){
                 v=NULL;
-                if(!_uncovered.contains(cv) && cv->visibility()>=k_visibilityTh)
-                    _uncovered<<cv;
-                cell->addAndSetUncovered(cv);
+                if(cv->visibility()>=k_visibilityTh)
+                    addUncovered(cv);
+                cv->setUncovered();
             }else{
-                cell->addAndSetCovered(cv);
+                cv->setCovered();
+            }
+        }
+    }
+}
+
+void ASSnakes::addUncovered(ASClipVertex* cv)
+{
+    if(cv->uncoveredIndex()>=0)
+        return;
+    cv->setUncoveredIndex(_uncovered.size());
+    _uncovered << cv;
+}
+
+void ASSnakes::removeUncovered(ASClipVertex* cv)
+{
+    int i = cv->uncoveredIndex();
+    if(i<0)
+        return;
+    ASClipVertex* last = _uncovered.last();
+    _uncovered[i] = last;
+    last->setUncoveredIndex(i);
+    _uncovered.pop_back();
+    cv->setUncoveredIndex(-1);
+}
+
+void ASSnakes::clearUncovered()
+{
+    for(int i=0; i<_uncovered.size(); ++i)
+        _uncovered.at(i)->setUncoveredIndex(-1);
+    _uncovered.clear();
+}
+
+ASContour* ASSnakes::addSeedContour(ASClipVertex* cv)
+{
+    vec2i offsets;
+    ASCell* cell = _simpleGrid[_simpleGrid.posToKey(cv->position2D(),offsets)];
+
+    ASContour* c = new ASContour(this);
+    ASVertexContour* v = new ASVertexContour(c,cv->position2D(),0,cv->position()[2]);
+    v->setTangent(cv->tangent(),false);
+    v->setConfidence(1.0);
+    v->setClosestClipVertex(cv);
+    c->addVertex(v);
+
+    v = new ASVertexContour(c,cv->position2D()+cv->tangent(),1,cv->position()[2]);
+    v->setTangent(cv->tangent(),false);
+    v->setConfidence(1.0);
+    v->setClosestClipVertex(cv);
+    c->first()->setEdge(new ASEdgeContour(c->first(),v));
+    c->addVertex(v);
+
+    for (int i = 0 ; i < 2; ++i) {
+        for (int j = 0 ; j < 2; ++j) {
+            int key = cell->column()+i*offsets[1]+(cell->row()+j*offsets[0])*_simpleGrid.nbCols();
+            if(_simpleGrid.contains(key)){
+                ASCell* cell2=_simpleGrid[key];
+                for(int k=0; k<cell2->nbClipVertices(); ++k){
+                    ASClipVertex* cv2 = cell2->clipVertex(k);
+                    if (!cv2->isUncovered())
+                        continue;
+                    float dotProd = fabs(v->tangent() DOT cv->tangent());
+                    if(dotProd >= k_dotProdT && dist2(v->position(),cv2->position2D())<=_coverRadius){
+                        cv2->setCovered();
+                        removeUncovered(cv2);
+                    }
+                }
             }
         }
     }
+
+    _contourList << c;
+#ifdef VERBOSE
+    qDebug() << "*** add contour "<< (_contourList.size()-1) << "("<<c->nbVertices() << " vertices)";
+#endif
+    _simpleGrid.addSnakeToGrid(c);
+
+    return c;
 }
 
 void ASSnakes::coverage(ASClipPathSet& pathSet)
@@ -1454,7 +1588,7 @@ void ASSnakes::coverage(ASClipPathSet& pathSet)
     /****************************************************/
     /************* Mark uncovered vertices **************/
     /****************************************************/
-    _uncovered.clear();
+    clearUncovered();
     markCoverage();
 
     /****************************************************/
@@ -1474,11 +1608,14 @@ void ASSnakes::coverage(ASClipPathSet& pathSet)
     /****************************************************/
 
     if(_noConnectivity){
-        // No connectivity: stochastic candidates + extension
+        // No connectivity: stochastic candidates + extension.
+        // The seeds only depend on the frame, not on other rand() users.
+        ASRandom random(_frame, ASRandom::COVERAGE);
+
         int prevNbUncovered = nbUncovered+1;
         int iter =  k_iterCoverage;
 
-        QList<ASClipVertex*> tested;
+        QList<ASContour*> seeds;
 
         while(nbUncovered>0 && iter>0){
 
@@ -1486,75 +1623,31 @@ void ASSnakes::coverage(ASClipPathSet& pathSet)
                 iter--;
             prevNbUncovered = nbUncovered;
 
-            ASClipVertex* cv = NULL;
-
-            while(cv==NULL && !_uncovered.isEmpty()){
-                int randCV = floor(float(rand()%_uncovered.size()));
-                cv = _uncovered.takeAt(randCV);
-                if(tested.contains(cv)){
-                    cv=NULL;
-                    continue;
-                }else{
-                    tested<<cv;
-                }
+            // Seeds taken from the uncovered set are grown together by a single extend()
+            seeds.clear();
+            while(seeds.size()<k_coverageBatch && _uncovered.size()>1){
+                ASClipVertex* cv = _uncovered.at(random.index(_uncovered.size()));
+                removeUncovered(cv);
+                seeds << addSeedContour(cv);
             }
-            if(_uncovered.isEmpty() || cv==NULL)
+            if(seeds.isEmpty())
                 break;
 
-            vec2i offsets;
-            ASCell* cell = _simpleGrid[_simpleGrid.posToKey(cv->position2D(),offsets)];
-
-            ASContour* c = new ASContour(this);
-            ASVertexContour* v = new ASVertexContour(c,cv->position2D(),0,cv->position()[2]);
-            v->setTangent(cv->tangent(),false);
-            v->setConfidence(1.0);
-            v->setClosestClipVertex(cv);
-            c->addVertex(v);
-
-            v = new ASVertexContour(c,cv->position2D()+cv->tangent(),1,cv->position()[2]);
-            v->setTangent(cv->tangent(),false);
-            v->setConfidence(1.0);
-            v->setClosestClipVertex(cv);
-            c->first()->setEdge(new ASEdgeContour(c->first(),v));
-            c->addVertex(v);
-
-            for (int i = 0 ; i < 2; ++i) {
-                for (int j = 0 ; j < 2; ++j) {
-                    int key = cell->column()+i*offsets[1]+(cell->row()+j*offsets[0])*_simpleGrid.nbCols();
-                    if(_simpleGrid.contains(key)){
-                        ASCell* cell2=_simpleGrid[key];
-                        for(int k=0; k<cell2->nbClipVertices(); ++k){
-                            ASClipVertex* cv2 = cell2->clipVertex(k);
-                            if (!cv2->isUncovered())
-                                continue;
-                            float dotProd = fabs(v->tangent() DOT cv->tangent());
-                            if(dotProd >= k_dotProdT && dist2(v->position(),cv2->position2D())<=_coverRadius){
-                                cv2->setCovered();
-                                _uncovered.removeAll(cv2);
-                            }
-                        }
-                    }
-                }
-            }
-
-            _contourList << c;
-#ifdef VERBOSE
-            qDebug() << "*** add contour "<< (_contourList.size()-1) << "("<<c->nbVertices() << " vertices)";
-#endif
-            _simpleGrid.addSnakeToGrid(_contourList.last());
-
             extend();
 
-            removeContourFromGrid(c);
-            while(c->resample(true)){};
-            c->checkClosed();
-            c->computeTangent();
-            c->computeLength();
+            for(int s=0; s<seeds.size(); ++s){
+                ASContour* c = seeds.at(s);
+                removeContourFromGrid(c);
+                while(c->resample(true)){};
+                c->checkClosed();
+                c->computeTangent();
+                c->computeLength();
 
-            _simpleGrid.addSnakeToGrid(_contourList.last());
+                _simpleGrid.addSnakeToGrid(c);
 
-            c->removeAllBrushPath();
-            c->initParameterization();
+                c->removeAllBrushPath();
+                c->initParameterization();
+            }
 
             nbUncovered = _uncovered.size();
         }
@@ -1633,48 +1726,15 @@ void ASSnakes::coverage(ASClipPathSet& pathSet)
             }
         }
     }
+
+    // Reset the indices while the clip vertices are still alive
+    clearUncovered();
 }
 
 ASClipVertex* ASSnakes::findClosestEdgeRef(vec2 pos, vec2 tangent, bool useVisibility, float coverage)
 {
-    ASClipVertex *closestClipVertex = NULL;
-    QList<QPair<float,ASClipVertex*> > neighbors;
-
-    vec2i offsets;
-    int key = _simpleGrid.posToKey(pos,offsets);
-
-    for (int i = 0 ; i < 2; ++i) {
-        for (int j = 0 ; j < 2; ++j) {
-            int key2 =  key + i*offsets[1] + j*offsets[0]*_simpleGrid.nbCols();
-            if(_simpleGrid.contains(key2)){
-                ASCell* cell = _simpleGrid[key2];
-
-                for(int k=0; k<cell->nbClipVertices(); ++k){
-                    ASClipVertex *vertex = cell->clipVertex(k);
-
-                    vec2 tangentClipV = vertex->tangent();
-
-                    float dotProd = fabs(tangent DOT tangentClipV);
-
-                    vec3 sample = vertex->position();
-                    sample[2]*=float(_width);
-                    float distance = dist2(vertex->position2D(),pos);
-
-                    if(dotProd>=k_dotProdCov && distance<=coverage
-                            && (!useVisibility || vertex->visibility() >= k_visibilityTh)){
-                        float coef = distance;
-                        neighbors << QPair<float,ASClipVertex*>(coef,vertex);
-                    }
-                }
-            }
-        }
-    }
-    if(!neighbors.isEmpty()){
-        std::sort(neighbors.begin(), neighbors.end());
-        closestClipVertex = neighbors.first().second;
-    }
-
-    return closestClipVertex;
+    return _simpleGrid.findClosestClipVertex(pos, tangent, k_dotProdCov, coverage,
+                                             useVisibility ? float(k_visibilityTh) : -FLT_MAX);
 }
 
 void ASSnakes::findClosestEdgeRef()
@@ -1682,11 +1742,20 @@ void ASSnakes::findClosestEdgeRef()
     for(int l=0; l<_contourList.size(); l++){
         ASContour *contour = _contourList[l];
         contour->computeTangent();
-        ASContour::ContourIterator it = contour->iterator();
 
-        while(it.hasNext()){
+        // computeTangent() packed the positions and tangents
+        int n = contour->nbVertices();
+        _closestClipVertices.resize(n);
+        if(n > 0)
+            _simpleGrid.findClosestClipVertices(n, contour->packedPositions().constData(), contour->packedTangents().constData(),
+                                                k_dotProdCov, _coverRadius,
+                                                k_useVisibility ? float(k_visibilityTh) : -FLT_MAX,
+                                                &_closestClipVertices[0]);
+
+        ASContour::ContourIterator it = contour->iterator();
+        for(int i=0; it.hasNext(); i++){
             ASVertexContour* v = it.next();
-            ASClipVertex* closestClipVertex = findClosestEdgeRef(v->position(),v->tangent(),k_useVisibility,_coverRadius);
+            ASClipVertex* closestClipVertex = _closestClipVertices[i];
 
             if(closestClipVertex==NULL){
                 // closest clip vertex not found
@@ -1776,25 +1845,6 @@ void ASSnakes::advect(GQFloatImage* geomFlow, GQFloatImage* denseFlow)
     }
 }
 
-int ASSnakes::nbBrushPaths() const
-{
-    int sum = 0;
-    foreach(ASContour* c,_contourList)
-        sum += c->nbBrushPaths();
-    return sum;
-}
-
-ASBrushPath* ASSnakes::brushPath(int i)
-{
-    int sum = 0;
-    foreach(ASContour* c,_contourList){
-        sum += c->nbBrushPaths();
-        if(i < sum)
-            return c->brushPath(sum-i-1);
-    }
-    return NULL;
-}
-
 /********************************************************/
 /*              Terminal print functions                */
 /********************************************************/
@@ -1812,11 +1862,8 @@ void ASSnakes::printContours()
 
 void ASSnakes::printSimpleGrid()
 {
-    QHashIterator<int,ASCell*> itCell(_simpleGrid.hash());
-
-    while(itCell.hasNext()){
-        itCell.next();
-        ASCell* cell = itCell.value();
+    for(int n=0; n<_simpleGrid.nbCells(); ++n){
+        ASCell* cell = _simpleGrid.cell(n);
 
         QListIterator<ASVertexContour*> itEndPoints = cell->endPointsIterator();
 
@@ -1847,34 +1894,35 @@ void ASSnakes::fitBrushPath()
         k_initBP.setValue(false);
     }
 
+    // Each contour only touches its own brush paths and draws from its own
+    // random stream, keyed by the frame and its id, so the result does not
+    // depend on the threads.
+    const int nbContours = _contourList.size();
+
     //Brush paths processing
-    for(int i=0; i<_contourList.size(); i++){
+    #pragma omp parallel for schedule(dynamic,1) if(k_parallelBP)
+    for(int i=0; i<nbContours; i++){
         ASContour* c = at(i);
+        c->random().seed(_frame, ASRandom::BRUSH_PATHS, c->id());
         c->computeTangent();
         c->checkClosed();
         int iter = 0;
         while(c->updateOverdraw() && iter<10) iter++;
 
-        int numBrushPath = at(i)->nbBrushPaths();
+        int numBrushPath = c->nbBrushPaths();
         for(int j=0; j<numBrushPath; j++){
             c->brushPath(j)->computeArcLength();
-            QVector<ASBrushPath*> newBrushpathList = at(i)->brushPath(j)->fitting();
+            QVector<ASBrushPath*> newBrushpathList = c->brushPath(j)->fitting();
             if (newBrushpathList.size() > 0){
                 for (int k=0; k<newBrushpathList.size(); k++)
                     c->addBrushPath(newBrushpathList[k]);
             }
         }
-    }
 
-    for(int i=0; i<_contourList.size(); i++){
-        ASContour* c = at(i);
-        int numBrushPath = c->nbBrushPaths();
+        numBrushPath = c->nbBrushPaths();
         for(int j=0; j<numBrushPath; j++)
             c->brushPath(j)->computeTangent();
-    }
 
-    for(int i=0; i<_contourList.size(); i++){
-        ASContour* c = at(i);
         c->fitLinearParam();
 
         if(k_mergeBP){
@@ -1884,5 +1932,30 @@ void ASSnakes::fitBrushPath()
             }
             c->mergeBrushPaths();
         }
+        // Done here rather than by the renderer, so that the index does
+        // not start with paths the renderer would delete
+        c->cleanBrushPath();
+    }
+
+    indexBrushPaths();
+}
+
+void ASSnakes::indexBrushPaths() const
+{
+    _brushPaths.clear();
+    _brushPathsById.clear();
+
+    // Same order as the former walk over the contours, each contour's paths
+    // from the last one. New paths are numbered in this order, so the ids do
+    // not depend on the fitting threads.
+    foreach(ASContour* c,_contourList){
+        for(int j=c->nbBrushPaths()-1; j>=0; j--){
+            ASBrushPath* bp = c->brushPath(j);
+            if(bp->id() < 0)
+                bp->setId(_nextBrushPathId++);
+            _brushPaths << bp;
+            _brushPathsById.insert(bp->id(), bp);
+        }
     }
+    _brushPathsDirty = false;
 }
@@ -23,11 +23,22 @@ See the COPYING file for details.
 
 #include <QSet>
 
+#include <atomic>
+
        dkFloat k_maxConf("BrushPaths->Confidence->Max", 1.0,1.0,100.0,1.0);
 static dkBool  k_useStrength("BrushPaths->Confidence->Use strength", false);
+static dkBool  k_checkOverdraw("Style->Overdraw->Check cache", false);
+
+static std::atomic<quint64> nextSerial(1);
 
 ASVertexContour::ASVertexContour(ASContour* c, const vec2 pos, int i, float z) {
     _contour = c;
+    _serial = nextSerial++;
+    _brushRevision = 0;
+    _overdraw = 0.f;
+    _overdrawFollowing = 0;
+    _overdrawRevision = 0;
+    _overdrawFollowingRevision = 0;
     _position = pos;
     _prePosition = pos;
     _closestEdgePosition = vec3(pos[0],pos[1],z);
@@ -95,6 +106,10 @@ void ASVertexContour::computeTangent() {
         fol_pos = v_fol->position();
     }
 
+    computeTangent(prev_pos,fol_pos);
+}
+
+void ASVertexContour::computeTangent(const vec2& prev_pos, const vec2& fol_pos) {
     _tangent = (fol_pos - prev_pos);
     _r = sqrt(_tangent[0]*_tangent[0] + _tangent[1]*_tangent[1]);
     normalize(_tangent);
@@ -136,8 +151,12 @@ void ASVertexContour::computeCurvature() {
     else
         v_fol = v_prev;
 
-    vec2 seg_prev = v_prev->position() - position();
-    vec2 seg_fol = v_fol->position() - position();
+    computeCurvature(v_prev->position(),v_fol->position());
+}
+
+void ASVertexContour::computeCurvature(const vec2& prev_pos, const vec2& fol_pos) {
+    vec2 seg_prev = prev_pos - position();
+    vec2 seg_fol = fol_pos - position();
     vec2 sum = seg_prev+seg_fol;
     float norm_prev = len(seg_prev);
     normalize(seg_prev);
@@ -334,29 +353,66 @@ void ASVertexContour::setParamFromNeighbors() {
 }
 
 void ASVertexContour::addBrushVertex(ASBrushVertex* b) {
-    if(!_brushVertices.contains(b))
+    if(!_brushVertices.contains(b)){
         _brushVertices << b;
+        _brushRevision++;
+    }
 }
 
 void ASVertexContour::removeBrushVertex(ASBrushVertex* b) {
-    _brushVertices.removeAll(b);
+    if(_brushVertices.removeAll(b) > 0)
+        _brushRevision++;
 }
 
 float ASVertexContour::overdraw() const {
-    float overdraw = 0.0;
+    const ASVertexContour* next = following();
+    if(next == NULL)
+        return 0.f;
+
+    if(_overdrawFollowing != next->_serial || _overdrawRevision != _brushRevision
+            || _overdrawFollowingRevision != next->_brushRevision){
+        _overdraw = sharedBrushPaths(next);
+        _overdrawFollowing = next->_serial;
+        _overdrawRevision = _brushRevision;
+        _overdrawFollowingRevision = next->_brushRevision;
+    }else if(k_checkOverdraw){
+        int expected = sharedBrushPathsFromSets(next);
+        if(expected != int(_overdraw))
+            qWarning("Cached overdraw %d instead of %d at vertex %d", int(_overdraw), expected, _index);
+    }
+    return _overdraw;
+}
+
+int ASVertexContour::sharedBrushPaths(const ASVertexContour* next) const {
+    // A handful of brush vertices per sample, faster than building sets
+    int count = 0;
+    for(int i=0; i<_brushVertices.size(); ++i){
+        ASBrushPath* p = _brushVertices.at(i)->path();
+        bool counted = false;
+        for(int j=0; j<i && !counted; ++j)
+            counted = _brushVertices.at(j)->path() == p;
+        if(counted)
+            continue;
+        for(int j=0; j<next->_brushVertices.size(); ++j){
+            if(next->_brushVertices.at(j)->path() == p){
+                count++;
+                break;
+            }
+        }
+    }
+    return count;
+}
+
+int ASVertexContour::sharedBrushPathsFromSets(const ASVertexContour* next) const {
     QSet<ASBrushPath*> brushPathMap1;
     foreach(ASBrushVertex* bv,_brushVertices){
         brushPathMap1<<bv->path();
     }
     QSet<ASBrushPath*> brushPathMap2;
-    for(int i=0; i<following()->nbBrushVertices(); ++i){
-        brushPathMap2<<following()->brushVertex(i)->path();
+    for(int i=0; i<next->nbBrushVertices(); ++i){
+        brushPathMap2<<next->brushVertex(i)->path();
     }
-
-    QSet<ASBrushPath*> intersection = brushPathMap1.intersect(brushPathMap2);
-
-    overdraw = intersection.size();
-    return overdraw;
+    return brushPathMap1.intersect(brushPathMap2).size();
 }
 
 void ASVertexContour::incrConfidence() {
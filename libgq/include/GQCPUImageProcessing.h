@@ -0,0 +1,46 @@
+/*****************************************************************************\
+
+GQCPUImageProcessing.h
+Authors:
+    Pierre Benard (pierre.benard@laposte.net),
+    Forrester Cole (fcole@csail.mit.edu),
+    Jingwan Lu (jingwanl@princeton.edu)
+Copyright (c) 2012 Pierre Benard, Forrester Cole, Jingwan Lu
+
+libgq is distributed under the terms of the GNU General Public License.
+See the COPYING file for details.
+
+\*****************************************************************************/
+
+#ifndef CPUIMAGEPROCESSING_H_
+#define CPUIMAGEPROCESSING_H_
+
+#include "GQImage.h"
+
+#include <vector>
+
+// CPU counterparts of GQGPUImageProcessing, usable without a GL context.
+// Images are in GL row order (row 0 at the bottom) and edges are clamped,
+// as with the rectangle textures used on the GPU. Rows are processed in
+// parallel with SSE where available. The scratch buffers belong to the
+// caller, so that several trackers may run at the same time.
+class GQCPUImageProcessing {
+public:
+    // Same result as GQGPUImageProcessing::blurAndGrad: "iter" separable
+    // 9-tap Gaussian blurs of the first channel followed by a Sobel
+    // gradient, stored in the first two channels of a 4 channel output.
+    // "buffer" and "scratch" are only reallocated when the size changes.
+    static void blurAndGrad(int iter, const GQFloatImage& image, GQFloatImage& output,
+                            std::vector<float>& buffer, std::vector<float>& scratch);
+
+    // Single threaded variant on a w x h single channel "buffer" (blurred in
+    // place, "scratch" has the same size). Only the gradient of the rectangle
+    // [x0,x0+cw) x [y0,y0+ch) is written, to a 4 channel "output" with
+    // "stride" pixels per row. Pixels closer than blurSupport(iter) to the
+    // sides of the buffer are only exact on the image borders.
+    static void blurAndGradRegion(int iter, float* buffer, float* scratch, int w, int h,
+                                  int x0, int y0, int cw, int ch, float* output, int stride);
+    static int blurSupport(int iter);
+};
+
+#endif /* CPUIMAGEPROCESSING_H_ */
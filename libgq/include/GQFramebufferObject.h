@@ -94,6 +94,9 @@ public:
                                int x = 0, int y = 0 );
     void loadSubColorTexturef( int which, const GQFloatImage& image,
                                int x = 0, int y = 0 );
+    // RGBA float rows, tightly packed
+    void loadSubColorTexturef( int which, const float* data,
+                               int x, int y, int width, int height );
     void readDepthBuffer( GQFloatImage& image ) const;
     void readSubDepthBuffer( int x, int y, int width, int height, 
                              GQFloatImage& image ) const;
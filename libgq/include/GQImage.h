@@ -53,10 +53,15 @@ public:
 
     void clear();
 
-    bool save(const QString& filename, bool flip = true );
+    // .raw files hold the dimensions and the unflipped raster, other
+    // formats go through QImage (quality as in QImage::save)
+    bool save(const QString& filename, bool flip = true, int quality = -1 );
     bool load(const QString& filename);
 
 private:
+    bool saveRaw(const QString& filename);
+    bool loadRaw(const QString& filename);
+
     int _width;
     int _height;
     int _num_chan;
@@ -92,7 +97,7 @@ public:
     void copy( const GQFloatImage& from )
     {
         resize( from._width, from._height, from._num_chan );
-        memcpy( _raster, from._raster, _width*_height*_num_chan );
+        memcpy( _raster, from._raster, _width*_height*_num_chan*sizeof(float) );
     }
 
     void clear();
@@ -106,6 +111,7 @@ protected:
     bool saveQImage(const QString& filename, bool flip);
 
     bool loadPFM(const QString& filename);
+    bool loadFloat(const QString& filename);
 
 private:
     int _width;
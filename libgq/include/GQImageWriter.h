@@ -0,0 +1,62 @@
+/*****************************************************************************\
+
+GQImageWriter.h
+Authors:
+    Pierre Benard (pierre.benard@laposte.net),
+    Forrester Cole (fcole@csail.mit.edu),
+    Jingwan Lu (jingwanl@princeton.edu)
+Copyright (c) 2012 Pierre Benard, Forrester Cole, Jingwan Lu
+
+Saves images on a small pool of encoder threads. Readbacks go into pooled
+images; when every pooled image is waiting to be encoded, acquire() blocks
+until one is written, which bounds the memory and slows the render loop
+down to the encoders instead of queueing frames without limit.
+
+libgq is distributed under the terms of the GNU General Public License.
+See the COPYING file for details.
+
+\*****************************************************************************/
+
+#ifndef _GQ_IMAGE_WRITER_H_
+#define _GQ_IMAGE_WRITER_H_
+
+#include "GQImage.h"
+
+#include <QImage>
+#include <QList>
+#include <QMutex>
+#include <QSemaphore>
+#include <QString>
+#include <QThreadPool>
+
+class GQImageWriter
+{
+public:
+    // 0 picks defaults from the number of cores
+    GQImageWriter(int num_threads = 0, int max_queued = 0);
+    ~GQImageWriter();
+
+    // Pooled image to read a frame into, blocks while the queue is full
+    GQImage* acquire();
+    // Saves an acquired image (see GQImage::save) and recycles it
+    void write(GQImage* image, const QString& filename, bool flip = true, int quality = -1);
+    // Same for an image already on the CPU, blocks while the queue is full
+    void write(const QImage& image, const QString& filename, int quality = -1);
+
+    // Blocks until every queued image is written
+    void flush();
+
+    static GQImageWriter& instance();
+
+protected:
+    friend class GQImageWriterTask;
+    void release(GQImage* image);
+
+    QThreadPool     _pool;
+    QSemaphore      _slots;
+    QMutex          _mutex;
+    QList<GQImage*> _images;
+    QList<GQImage*> _free;
+};
+
+#endif // _GQ_IMAGE_WRITER_H_
@@ -0,0 +1,53 @@
+/*****************************************************************************\
+
+GQReadbackBuffer.h
+Authors:
+    Pierre Benard (pierre.benard@laposte.net),
+    Forrester Cole (fcole@csail.mit.edu),
+    Jingwan Lu (jingwanl@princeton.edu)
+Copyright (c) 2012 Pierre Benard, Forrester Cole, Jingwan Lu
+
+Asynchronous texture readback through a pixel buffer object: start() only
+queues the transfer, map() waits for it and exposes the pixels in place.
+
+libgq is distributed under the terms of the GNU General Public License.
+See the COPYING file for details.
+
+\*****************************************************************************/
+
+#ifndef _GQ_READBACK_BUFFER_H_
+#define _GQ_READBACK_BUFFER_H_
+
+#include "GQInclude.h"
+#include "GQTexture.h"
+
+class GQReadbackBuffer
+{
+public:
+    GQReadbackBuffer();
+    ~GQReadbackBuffer();
+
+    void clear();
+
+    // Queues a copy of level 0 of the texture as 4 float channels
+    void start(const GQTexture2D* texture);
+    bool pending() const { return _pending; }
+
+    // Valid until unmap(), rows in GL order
+    const float* map();
+    // Also drops a transfer that was never mapped
+    void unmap();
+
+    int width() const { return _width; }
+    int height() const { return _height; }
+
+protected:
+    GLuint _id;
+    int    _width;
+    int    _height;
+    qint64 _size;
+    bool   _pending;
+    bool   _mapped;
+};
+
+#endif // _GQ_READBACK_BUFFER_H_
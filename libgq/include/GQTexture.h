@@ -65,6 +65,9 @@ public:
 
     void generateMipmaps();
 
+    // Reads back the first num_channels (1, 3 or 4) of level 0
+    void readPixels( GQFloatImage& image, int num_channels = 4 ) const;
+
     unsigned int width() const { return _width; }
     unsigned int height() const { return _height; }
     unsigned int depth() const { return 1; }
@@ -95,6 +95,9 @@ class GQVertexBufferSet
         int  vboId( GQVertexBufferType semantic ) const;
         int  vboId( const QString& name ) const;
         void copyToVBOs();
+        // Re-uploads one buffer whose source data changed in place
+        void updateVBO( GQVertexBufferType semantic );
+        void updateVBO( const QString& name );
         void deleteVBOs();
         bool vbosLoaded() const;
 
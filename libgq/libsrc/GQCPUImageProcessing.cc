@@ -0,0 +1,205 @@
+/*****************************************************************************\
+
+GQCPUImageProcessing.cc
+Authors:
+    Pierre Benard (pierre.benard@laposte.net),
+    Forrester Cole (fcole@csail.mit.edu),
+    Jingwan Lu (jingwanl@princeton.edu)
+Copyright (c) 2012 Pierre Benard, Forrester Cole, Jingwan Lu
+
+libgq is distributed under the terms of the GNU General Public License.
+See the COPYING file for details.
+
+\*****************************************************************************/
+
+#include "GQCPUImageProcessing.h"
+
+#include <algorithm>
+
+#if defined(__SSE__) || defined(_M_X64)
+#define GQ_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+// Discrete weights of the 5 linearly filtered taps of vblur.frag/hblur.frag
+static const int   k_blurRadius = 4;
+static const float k_blurWeights[k_blurRadius+1] = {
+    0.2270270270f, 0.1945945946f, 0.1216216216f, 0.0540540541f, 0.0162162162f };
+
+static inline int clampIndex(int i, int n)
+{
+    return i < 0 ? 0 : (i >= n ? n-1 : i);
+}
+
+static void verticalBlur(const float* src, float* dst, int w, int h, bool parallel)
+{
+    #pragma omp parallel for schedule(static) if(parallel)
+    for(int y=0; y<h; y++){
+        const float* rows[2*k_blurRadius+1];
+        for(int k=-k_blurRadius; k<=k_blurRadius; k++)
+            rows[k_blurRadius+k] = src + clampIndex(y+k,h)*w;
+        const float* const* r = rows + k_blurRadius;
+        float* out = dst + y*w;
+
+        int x = 0;
+#ifdef GQ_USE_SSE
+        for(; x+4<=w; x+=4){
+            __m128 sum = _mm_mul_ps(_mm_set1_ps(k_blurWeights[0]), _mm_loadu_ps(r[0]+x));
+            for(int k=1; k<=k_blurRadius; k++){
+                __m128 pair = _mm_add_ps(_mm_loadu_ps(r[k]+x), _mm_loadu_ps(r[-k]+x));
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(k_blurWeights[k]), pair));
+            }
+            _mm_storeu_ps(out+x, sum);
+        }
+#endif
+        for(; x<w; x++){
+            float sum = k_blurWeights[0] * r[0][x];
+            for(int k=1; k<=k_blurRadius; k++)
+                sum += k_blurWeights[k] * (r[k][x] + r[-k][x]);
+            out[x] = sum;
+        }
+    }
+}
+
+static inline float horizontalTap(const float* row, int x, int w)
+{
+    float sum = k_blurWeights[0] * row[x];
+    for(int k=1; k<=k_blurRadius; k++)
+        sum += k_blurWeights[k] * (row[clampIndex(x+k,w)] + row[clampIndex(x-k,w)]);
+    return sum;
+}
+
+static void horizontalBlur(const float* src, float* dst, int w, int h, bool parallel)
+{
+    #pragma omp parallel for schedule(static) if(parallel)
+    for(int y=0; y<h; y++){
+        const float* row = src + y*w;
+        float* out = dst + y*w;
+
+        // Clamped borders are done one pixel at a time
+        int x = 0;
+        for(; x<k_blurRadius && x<w; x++)
+            out[x] = horizontalTap(row,x,w);
+#ifdef GQ_USE_SSE
+        for(; x+4+k_blurRadius<=w; x+=4){
+            __m128 sum = _mm_mul_ps(_mm_set1_ps(k_blurWeights[0]), _mm_loadu_ps(row+x));
+            for(int k=1; k<=k_blurRadius; k++){
+                __m128 pair = _mm_add_ps(_mm_loadu_ps(row+x+k), _mm_loadu_ps(row+x-k));
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(k_blurWeights[k]), pair));
+            }
+            _mm_storeu_ps(out+x, sum);
+        }
+#endif
+        for(; x<w; x++)
+            out[x] = horizontalTap(row,x,w);
+    }
+}
+
+// Sobel filter, see gradient.frag. Its sample5 reads (+1,+1) instead of
+// (+1,0); kept so that both implementations produce the same field.
+static inline void sobel(const float* down, const float* mid, const float* up,
+                         int x, int w, float* p)
+{
+    int xl = clampIndex(x-1,w);
+    int xr = clampIndex(x+1,w);
+    p[0] = 3.f*up[xr] + down[xr] - (up[xl] + 2.f*mid[xl] + down[xl]);
+    p[1] = up[xl] + 2.f*up[x] + up[xr] - (down[xl] + 2.f*down[x] + down[xr]);
+    p[2] = 0.f;
+    p[3] = 0.f;
+}
+
+// Gradient of the rectangle [x0,x0+cw) x [y0,y0+ch) of src, written to a
+// 4 channel dst with "stride" pixels per row
+static void gradient(const float* src, int w, int h, int x0, int y0, int cw, int ch,
+                     float* dst, int stride, bool parallel)
+{
+    #pragma omp parallel for schedule(static) if(parallel)
+    for(int y=y0; y<y0+ch; y++){
+        const float* down = src + clampIndex(y-1,h)*w;
+        const float* mid  = src + y*w;
+        const float* up   = src + clampIndex(y+1,h)*w;
+        float* out = dst + 4*((y-y0)*stride - x0);
+
+        int x = x0;
+        const int xEnd = x0+cw;
+        if(x == 0 && x < xEnd)
+            sobel(down,mid,up,x++,w,out);
+#ifdef GQ_USE_SSE
+        const __m128 two   = _mm_set1_ps(2.f);
+        const __m128 three = _mm_set1_ps(3.f);
+        const __m128 zero  = _mm_setzero_ps();
+        for(; x+4<=xEnd && x+5<=w; x+=4){
+            __m128 ul = _mm_loadu_ps(up+x-1),   uc = _mm_loadu_ps(up+x),   ur = _mm_loadu_ps(up+x+1);
+            __m128 ml = _mm_loadu_ps(mid+x-1);
+            __m128 dl = _mm_loadu_ps(down+x-1), dc = _mm_loadu_ps(down+x), dr = _mm_loadu_ps(down+x+1);
+
+            __m128 gx = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(three,ur), dr),
+                                   _mm_add_ps(_mm_add_ps(ul, _mm_mul_ps(two,ml)), dl));
+            __m128 gy = _mm_sub_ps(_mm_add_ps(_mm_add_ps(ul, _mm_mul_ps(two,uc)), ur),
+                                   _mm_add_ps(_mm_add_ps(dl, _mm_mul_ps(two,dc)), dr));
+
+            // Interleave as (gx, gy, 0, 0) pixels
+            __m128 lo = _mm_unpacklo_ps(gx,gy);
+            __m128 hi = _mm_unpackhi_ps(gx,gy);
+            float* p = out + 4*x;
+            _mm_storeu_ps(p,    _mm_movelh_ps(lo,zero));
+            _mm_storeu_ps(p+4,  _mm_movehl_ps(zero,lo));
+            _mm_storeu_ps(p+8,  _mm_movelh_ps(hi,zero));
+            _mm_storeu_ps(p+12, _mm_movehl_ps(zero,hi));
+        }
+#endif
+        for(; x<xEnd; x++)
+            sobel(down,mid,up,x,w,out+4*x);
+    }
+}
+
+void GQCPUImageProcessing::blurAndGrad(int iter, const GQFloatImage& image,
+                                       GQFloatImage& output,
+                                       std::vector<float>& buffer,
+                                       std::vector<float>& scratch)
+{
+    const int w = image.width();
+    const int h = image.height();
+    const int c = image.chan();
+
+    // output is only reallocated when the size changes
+    output.resize(w,h,4);
+    if(w == 0 || h == 0)
+        return;
+
+    // Only the first channel is used by the gradient
+    buffer.resize(w*h);
+    scratch.resize(w*h);
+    const float* in = image.raster();
+    if(c == 1){
+        std::copy(in, in + w*h, buffer.begin());
+    }else{
+        for(int i=0; i<w*h; i++)
+            buffer[i] = in[i*c];
+    }
+
+    for(int it=0; it<iter; it++){
+        verticalBlur(&buffer[0], &scratch[0], w, h, true);
+        horizontalBlur(&scratch[0], &buffer[0], w, h, true);
+    }
+
+    gradient(&buffer[0], w, h, 0, 0, w, h, output.raster(), w, true);
+}
+
+int GQCPUImageProcessing::blurSupport(int iter)
+{
+    // Each pass spreads by the blur radius, then one more pixel for the gradient
+    return iter*k_blurRadius + 1;
+}
+
+void GQCPUImageProcessing::blurAndGradRegion(int iter, float* buffer, float* scratch,
+                                             int w, int h, int x0, int y0, int cw, int ch,
+                                             float* output, int stride)
+{
+    for(int it=0; it<iter; it++){
+        verticalBlur(buffer, scratch, w, h, false);
+        horizontalBlur(scratch, buffer, w, h, false);
+    }
+
+    gradient(buffer, w, h, x0, y0, cw, ch, output, stride, false);
+}
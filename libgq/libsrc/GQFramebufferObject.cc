@@ -413,6 +413,16 @@ void GQFramebufferObject::loadSubColorTexturef( int which, const GQFloatImage& i
     _color_attachments[which]->unbind();
 }
 
+void GQFramebufferObject::loadSubColorTexturef( int which, const float* data,
+                                                int x, int y, int width, int height )
+{
+    assert( which >= 0 && which < _num_color_attachments );
+    assert(x+width <= _width && y+height <= _height);
+    _color_attachments[which]->bind();
+    glTexSubImage2D( _gl_target, 0, x,y,width,height, GL_RGBA, GL_FLOAT, data);
+    _color_attachments[which]->unbind();
+}
+
 void GQFramebufferObject::readSubColorTexturei( int which, int x, int y, int width, int height,
                                                 GQImage& image, int num_channels ) const 
 {
@@ -78,39 +78,74 @@ void GQImage::setPixelChannel( int x, int y, int c, unsigned char value )
     _raster[_num_chan * (x + y*_width) + c] = value;
 }
 
-bool GQImage::save( const QString& filename, bool flip)
+bool GQImage::save( const QString& filename, bool flip, int quality)
 {
-    QImage qi( _width, _height, QImage::Format_ARGB32 );
+    if (filename.endsWith("raw"))
+        return saveRaw(filename);
 
-    if (_num_chan == 3)
-    {
-        for (int i = 0; i < _width*_height; i++)
-            qi.setPixel( i%_width, i/_width, qRgba(_raster[3*i], _raster[3*i + 1], _raster[3*i + 2], 255) );
-    }
-    else if (_num_chan == 4)
+    if (_num_chan != 1 && _num_chan != 3 && _num_chan != 4)
     {
-        for (int i = 0; i < _width*_height; i++)
-            qi.setPixel( i%_width, i/_width, qRgba(_raster[4*i], _raster[4*i + 1], _raster[4*i + 2], _raster[4*i + 3]) );
+        qWarning("GQImage::save: unsupported format (%s).\n", qPrintable(filename));
+        return false;
     }
-    else if (_num_chan == 1)
+
+    // Filled a scan line at a time, flipped on the way
+    QImage qi( _width, _height, QImage::Format_ARGB32 );
+    for (int y = 0; y < _height; y++)
     {
-        for (int i = 0; i < _width*_height; i++)
-            qi.setPixel( i%_width, i/_width, qRgba(_raster[i], _raster[i], _raster[i], 255) );
+        QRgb* dst = (QRgb*)qi.scanLine( flip ? _height - y - 1 : y );
+        const unsigned char* src = scanLine(y);
+        if (_num_chan == 3)
+        {
+            for (int x = 0; x < _width; x++)
+                dst[x] = qRgba(src[3*x], src[3*x + 1], src[3*x + 2], 255);
+        }
+        else if (_num_chan == 4)
+        {
+            for (int x = 0; x < _width; x++)
+                dst[x] = qRgba(src[4*x], src[4*x + 1], src[4*x + 2], src[4*x + 3]);
+        }
+        else
+        {
+            for (int x = 0; x < _width; x++)
+                dst[x] = qRgba(src[x], src[x], src[x], 255);
+        }
     }
-    else
-    {
-        qWarning("GQImage::save: unsupported format (%s).\n", qPrintable(filename));
+
+    return qi.save( filename, 0, quality );
+}
+
+bool GQImage::saveRaw(const QString& filename)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly))
         return false;
-    }
 
-    if (flip)
-        qi = qi.mirrored();
+    int dim[3];
+    dim[0] = width();
+    dim[1] = height();
+    dim[2] = chan();
+    file.write((const char*)&dim[0], sizeof(dim));
+    return file.write((const char*)raster(), dim[0]*dim[1]*dim[2]) == dim[0]*dim[1]*dim[2];
+}
 
-    return qi.save( filename );
+bool GQImage::loadRaw(const QString& filename)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    int dim[3];
+    if (file.read((char*)&dim[0], sizeof(dim)) != sizeof(dim) || !resize(dim[0], dim[1], dim[2]))
+        return false;
+    return file.read((char*)raster(), dim[0]*dim[1]*dim[2]) == dim[0]*dim[1]*dim[2];
 }
 
 bool GQImage::load(const QString& filename)
 {
+    if (filename.endsWith("raw"))
+        return loadRaw(filename);
+
     QImage qi;
     if (qi.load(filename))
     {
@@ -288,7 +323,8 @@ bool GQFloatImage::saveFloat(const QString& filename, bool flip)
     Q_UNUSED(flip);
 
     QFile file(filename);
-    file.open(QIODevice::WriteOnly);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
 
     int dim[3];
     dim[0] = width();
@@ -317,9 +353,8 @@ bool GQFloatImage::savePFM(const QString& filename, bool flip)
     QString version = "Pf";
     if (chan() > 1)
         version = "PF";
-    QString header;
-    header.asprintf("%s\n%d %d\n%.1f\n", qPrintable(version), width(), height(), 
-                   we_are_little_endian() ? -1.0f : 1.0f).toLatin1();
+    QString header = QString::asprintf("%s\n%d %d\n%.1f\n", qPrintable(version), width(), height(),
+                   we_are_little_endian() ? -1.0f : 1.0f);
     file.write(header.toLatin1(), header.toLatin1().size());
 
     int write_chan = std::min(chan(), 3);
@@ -432,6 +467,28 @@ bool GQFloatImage::loadPFM(const QString& filename)
     return true;
 }
 
+bool GQFloatImage::loadFloat(const QString& filename)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    int dim[3];
+    if (file.read((char*)&dim[0], sizeof(dim)) != sizeof(dim) ||
+        dim[0] < 0 || dim[1] < 0 || dim[2] < 0)
+    {
+        file.close();
+        return false;
+    }
+
+    resize(dim[0], dim[1], dim[2]);
+    qint64 size = qint64(dim[0])*dim[1]*dim[2]*sizeof(float);
+    bool ret = (file.read((char*)raster(), size) == size);
+
+    file.close();
+    return ret;
+}
+
 bool GQFloatImage::load(const QString& filename)
 {
     GQImage img;
@@ -439,6 +496,10 @@ bool GQFloatImage::load(const QString& filename)
     {
         return loadPFM(filename);
     }
+    else if (filename.endsWith(".float"))
+    {
+        return loadFloat(filename);
+    }
     else
     {
         bool ret = img.load(filename);
@@ -0,0 +1,111 @@
+/*****************************************************************************\
+
+GQImageWriter.cc
+Authors:
+    Pierre Benard (pierre.benard@laposte.net),
+    Forrester Cole (fcole@csail.mit.edu),
+    Jingwan Lu (jingwanl@princeton.edu)
+Copyright (c) 2012 Pierre Benard, Forrester Cole, Jingwan Lu
+
+libgq is distributed under the terms of the GNU General Public License.
+See the COPYING file for details.
+
+\*****************************************************************************/
+
+#include "GQImageWriter.h"
+
+#include <QRunnable>
+#include <QThread>
+
+#include <algorithm>
+
+class GQImageWriterTask : public QRunnable
+{
+public:
+    GQImageWriterTask(GQImageWriter* writer, GQImage* image, const QImage& qimage,
+                      const QString& filename, bool flip, int quality)
+        : _writer(writer), _image(image), _qimage(qimage),
+          _filename(filename), _flip(flip), _quality(quality) {}
+
+    void run()
+    {
+        bool ok;
+        if (_image)
+            ok = _image->save(_filename, _flip, _quality);
+        else
+            ok = _qimage.save(_filename, 0, _quality);
+        if (!ok)
+            qWarning("Cannot write %s", qPrintable(_filename));
+        _writer->release(_image);
+    }
+
+protected:
+    GQImageWriter* _writer;
+    GQImage*       _image;
+    QImage         _qimage;
+    QString        _filename;
+    bool           _flip;
+    int            _quality;
+};
+
+GQImageWriter::GQImageWriter(int num_threads, int max_queued)
+{
+    if (num_threads <= 0)
+        num_threads = std::max(1, QThread::idealThreadCount() / 2);
+    if (max_queued <= 0)
+        max_queued = 2 * num_threads;
+
+    _pool.setMaxThreadCount(num_threads);
+    _slots.release(max_queued);
+}
+
+GQImageWriter::~GQImageWriter()
+{
+    flush();
+    qDeleteAll(_images);
+}
+
+GQImageWriter& GQImageWriter::instance()
+{
+    static GQImageWriter writer;
+    return writer;
+}
+
+GQImage* GQImageWriter::acquire()
+{
+    _slots.acquire();
+
+    QMutexLocker locker(&_mutex);
+    if (!_free.isEmpty())
+        return _free.takeLast();
+
+    GQImage* image = new GQImage();
+    _images << image;
+    return image;
+}
+
+void GQImageWriter::write(GQImage* image, const QString& filename, bool flip, int quality)
+{
+    _pool.start(new GQImageWriterTask(this, image, QImage(), filename, flip, quality));
+}
+
+void GQImageWriter::write(const QImage& image, const QString& filename, int quality)
+{
+    _slots.acquire();
+    _pool.start(new GQImageWriterTask(this, NULL, image, filename, false, quality));
+}
+
+void GQImageWriter::release(GQImage* image)
+{
+    if (image)
+    {
+        QMutexLocker locker(&_mutex);
+        _free << image;
+    }
+    _slots.release();
+}
+
+void GQImageWriter::flush()
+{
+    _pool.waitForDone();
+}
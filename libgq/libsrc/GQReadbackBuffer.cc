@@ -0,0 +1,101 @@
+/*****************************************************************************\
+
+GQReadbackBuffer.cc
+Authors:
+    Pierre Benard (pierre.benard@laposte.net),
+    Forrester Cole (fcole@csail.mit.edu),
+    Jingwan Lu (jingwanl@princeton.edu)
+Copyright (c) 2012 Pierre Benard, Forrester Cole, Jingwan Lu
+
+libgq is distributed under the terms of the GNU General Public License.
+See the COPYING file for details.
+
+\*****************************************************************************/
+
+#include "GQReadbackBuffer.h"
+
+#include <assert.h>
+
+GQReadbackBuffer::GQReadbackBuffer()
+{
+    _id = 0;
+    _width = _height = 0;
+    _size = 0;
+    _pending = false;
+    _mapped = false;
+}
+
+GQReadbackBuffer::~GQReadbackBuffer()
+{
+    // Like GQFramebufferObject, the GL context may already be gone here
+}
+
+void GQReadbackBuffer::clear()
+{
+    if (_id)
+    {
+        QOpenGLExtraFunctions glFuncs(QOpenGLContext::currentContext());
+        if (_mapped)
+            unmap();
+        glFuncs.glDeleteBuffers(1, &_id);
+    }
+    _id = 0;
+    _width = _height = 0;
+    _size = 0;
+    _pending = false;
+}
+
+void GQReadbackBuffer::start(const GQTexture2D* texture)
+{
+    assert(!_mapped);
+    QOpenGLExtraFunctions glFuncs(QOpenGLContext::currentContext());
+
+    _width = texture->width();
+    _height = texture->height();
+    qint64 size = qint64(sizeof(float)) * 4 * _width * _height;
+
+    if (!_id)
+        glFuncs.glGenBuffers(1, &_id);
+    glFuncs.glBindBuffer(GL_PIXEL_PACK_BUFFER, _id);
+    if (size != _size)
+    {
+        glFuncs.glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+        _size = size;
+    }
+
+    // With a pack buffer bound the pixels go to offset 0 of the buffer
+    texture->bind();
+    glGetTexImage(texture->target(), 0, GL_RGBA, GL_FLOAT, 0);
+    texture->unbind();
+
+    glFuncs.glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    _pending = true;
+}
+
+const float* GQReadbackBuffer::map()
+{
+    assert(_pending && !_mapped);
+    QOpenGLExtraFunctions glFuncs(QOpenGLContext::currentContext());
+
+    glFuncs.glBindBuffer(GL_PIXEL_PACK_BUFFER, _id);
+    const float* data = (const float*)glFuncs.glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, _size, GL_MAP_READ_BIT);
+    glFuncs.glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    if (!data)
+        qWarning("GQReadbackBuffer::map: cannot map the pixel buffer");
+    _mapped = (data != NULL);
+    return data;
+}
+
+void GQReadbackBuffer::unmap()
+{
+    if (_mapped)
+    {
+        QOpenGLExtraFunctions glFuncs(QOpenGLContext::currentContext());
+        glFuncs.glBindBuffer(GL_PIXEL_PACK_BUFFER, _id);
+        glFuncs.glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glFuncs.glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        _mapped = false;
+    }
+    _pending = false;
+}
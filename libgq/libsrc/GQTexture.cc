@@ -140,6 +140,21 @@ bool GQTexture2D::create(int width, int height, int internal_format, int format,
     return true;
 }
 
+void GQTexture2D::readPixels( GQFloatImage& image, int num_channels ) const
+{
+    assert(num_channels == 1 || num_channels == 3 || num_channels == 4);
+    int format = GL_RGBA;
+    if (num_channels == 3)
+        format = GL_RGB;
+    else if (num_channels == 1)
+        format = GL_RED;
+    image.resize( _width, _height, num_channels );
+
+    bind();
+    glGetTexImage( _target, 0, format, GL_FLOAT, image.raster() );
+    unbind();
+}
+
 void GQTexture2D::setWrapMode(int mode) const
 {
     setWrapMode(mode,mode);
@@ -308,6 +308,29 @@ void GQVertexBufferSet::copyToVBOs()
     reportGLError();
 }
 
+void GQVertexBufferSet::updateVBO( GQVertexBufferType semantic )
+{
+    updateVBO(GQVertexBufferNames[semantic]);
+}
+
+void GQVertexBufferSet::updateVBO( const QString& name )
+{
+    BufferInfo* buf = _buffer_hash.value(name, 0);
+    if (!buf || buf->_vbo_id < 0)
+        return;
+
+    assert(buf->dataSize() == buf->_vbo_size);
+    QOpenGLFunctions glFuncs(QOpenGLContext::currentContext());
+    int target = GL_ARRAY_BUFFER;
+    if (buf->_semantic == GQ_INDEX)
+        target = GL_ELEMENT_ARRAY_BUFFER;
+
+    glFuncs.glBindBuffer(target, (GLuint)(buf->_vbo_id));
+    glFuncs.glBufferSubData(target, 0, buf->_vbo_size, buf->dataPointer());
+    glFuncs.glBindBuffer(target, 0);
+    reportGLError();
+}
+
 void GQVertexBufferSet::deleteVBOs()
 {
     for (int i = 0; i < _buffers.size(); i++)
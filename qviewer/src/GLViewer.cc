@@ -27,8 +27,10 @@ See the COPYING file for details.
 #include "GQDraw.h"
 #include "NPRGLDraw.h"
 #include "GQGPUImageProcessing.h"
+#include "GQImageWriter.h"
 #include "Scene.h"
 #include "Stats.h"
+#include "Profiler.h"
 
 extern dkStringList k_shading;
 static dkBool k_drawShading("Draw->Shading", false);
@@ -38,12 +40,21 @@ dkStringList k_model("Current->Model",QStringList(modelChoices));
 
 static dkBool k_useSnakes("Current->Activate snakes", true);
        dkBool k_snapshot("Current->Activate snapshot",false);
+static QStringList k_snapshot_formats = QStringList() << "png" << "png (fast)" << "raw";
+static dkStringList k_snapshotFormat("Current->Snapshot format", k_snapshot_formats);
 static QStringList k_ref_list = QStringList() << "none" << "line" << "blur" << "grad" << "color" << "motion";
 static dkStringList k_drawRefImg("Draw->Ref. Img.", k_ref_list);
 static QStringList k_draw_list = QStringList() << "strokes" << "brushPath" << "snakes" << "samples" << "none";
 static dkStringList k_drawContour("Draw->Contour", k_draw_list);
 static dkBool k_drawClosest("Contours->Draw->Closest sample", false);
 static dkBool k_initSnakes("Contours->Init",false);
+static dkBool k_record("Current->Record tracking inputs",false);
+// The worker tracks with the CPU attraction field, so the strokes match the
+// sequential loop with "Contours->Relaxation->CPU attraction field" on, and
+// differ from the default GPU field by the rounding of the blur.
+static dkBool k_pipelined("Current->Pipelined tracking",false);
+static dkInt  k_pipelineLatency("Current->Pipeline latency (frames)", 1, 0, 4, 1);
+static dkBool k_profile("Current->Record profile trace",false);
 
 GLViewer::GLViewer(QWidget* parent) : QGLViewer( parent )
 { 
@@ -55,6 +66,7 @@ GLViewer::GLViewer(QWidget* parent) : QGLViewer( parent )
     _ac_initialized = false;
     _prev_frame_number = -1;
     _snapshotPath = "";
+    _recordPath = "";
 
     camera()->frame()->setWheelSensitivity(-1.0);
 
@@ -70,6 +82,127 @@ void GLViewer::initializeGL()
                  << QLatin1String(reinterpret_cast<const char*>(glGetString(GL_SHADING_LANGUAGE_VERSION)));
 }
 
+bool GLViewer::startRecording()
+{
+    QFile file(_recordPath + "/sequence.txt");
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)){
+        qWarning("Cannot write %s", qPrintable(file.fileName()));
+        return false;
+    }
+    QTextStream out(&file);
+    out << "# frame init useMotion viewport[4] depthRange[2]\n";
+    return true;
+}
+
+// Dumps the inputs of the tracking for offline replays (see asbatch)
+void GLViewer::recordFrame(int frame, bool init, bool useMotion)
+{
+    QString idx = QString("%1").arg(frame,4,10,QLatin1Char('0'));
+
+    _imgLines.saveSamples(_recordPath + "/samples." + idx + ".float");
+    if(!init){
+        GQFloatImage refImg;
+        refImg.copy(_imgLines.referenceImage());
+        refImg.save(_recordPath + "/ref." + idx + ".float");
+        if(_imgLines.geometricFlowBuffer())
+            _imgLines.geometricFlowBuffer()->save(_recordPath + "/flow." + idx + ".float");
+    }
+
+    QFile file(_recordPath + "/sequence.txt");
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)){
+        qWarning("Cannot write %s", qPrintable(file.fileName()));
+        return;
+    }
+    const GLint* viewport = _imgLines.clipPathSet()->viewport();
+    const GLdouble* depthRange = _imgLines.clipPathSet()->depthRange();
+    QTextStream out(&file);
+    out << frame << " " << int(init) << " " << int(useMotion) << " "
+        << viewport[0] << " " << viewport[1] << " " << viewport[2] << " " << viewport[3] << " "
+        << depthRange[0] << " " << depthRange[1] << "\n";
+}
+
+// Copies the inputs of the tracking of this frame for the worker thread
+void GLViewer::submitFrame(bool init, bool useMotion)
+{
+    __TIME_CODE_BLOCK("Pipeline submit");
+
+    _pipeline.setup(&_snakes);
+
+    TrackingJob* job = _pipeline.acquire();
+    job->frame = DialsAndKnobs::frameCounter();
+    job->init = init;
+    job->useMotion = useMotion;
+    job->positions2D = _imgLines.samplePositions2D();
+    job->positions = _imgLines.samplePositions();
+    job->tangents = _imgLines.sampleTangents();
+    job->strengths = _imgLines.sampleStrengths();
+
+    const GLint* viewport = _imgLines.clipPathSet()->viewport();
+    const GLdouble* depthRange = _imgLines.clipPathSet()->depthRange();
+    for(int i=0; i<4; i++)
+        job->viewport[i] = viewport[i];
+    job->depthRange[0] = depthRange[0];
+    job->depthRange[1] = depthRange[1];
+
+    job->hasGeomFlow = false;
+    if(!init){
+        job->refImg.copy(_imgLines.referenceImage());
+        if(_imgLines.geometricFlowBuffer()){
+            job->geomFlow.copy(*_imgLines.geometricFlowBuffer());
+            job->hasGeomFlow = true;
+        }
+    }
+    job->textureLength = _snakesRenderer.textureLength();
+
+    _pipeline.submit(job);
+}
+
+// Draws the strokes of a frame taken from the pipeline, saving them when
+// snapshots are on, and gives the job back
+void GLViewer::presentJob(TrackingJob* job)
+{
+    bool snapshot = k_snapshot && _snapshotPath != "";
+    if(snapshot){
+        _snapshotBuffer.initFullScreen(1);
+        glClearColor(1,1,1,0);
+        _snapshotBuffer.bind(GQ_CLEAR_BUFFER);
+    }else{
+        GQDraw::clearGLScreen(vec(1,1,1),1);
+    }
+    if(k_drawShading){
+        GQDraw::clearGLScreen(vec(1,1,1),1);
+        _scene->drawScene(k_shading,(ModelType) k_model.index());
+    }
+    _snakesRenderer.renderStrokes(job->segments, job->pathRanges);
+    if(snapshot)
+        saveSnapshot(QString::number(job->frame));
+
+    _pipeline.release(job);
+}
+
+// Waits for every frame still in the pipeline and presents them in order
+void GLViewer::drainPipeline()
+{
+    __TIME_CODE_BLOCK("Pipeline drain");
+
+    while(TrackingJob* job = _pipeline.take())
+        presentJob(job);
+}
+
+void GLViewer::saveSnapshot(const QString& idx)
+{
+    _snapshotBuffer.unbind();
+    // Encoded on the writer threads; "png (fast)" is zlib level 1
+    bool raw = k_snapshotFormat == k_snapshot_formats[2];
+    int quality = k_snapshotFormat == k_snapshot_formats[1] ? 80 : -1;
+    GQImageWriter& writer = GQImageWriter::instance();
+    GQImage* img = writer.acquire();
+    _snapshotBuffer.readColorTexturei(0, *img);
+    writer.write(img, QString(_snapshotPath + "/ActiveStrokes.%1.%2").arg(idx,4,QLatin1Char('0')).arg(raw ? "raw" : "png"),
+                 true, quality);
+    GQDraw::visualizeTexture(_snapshotBuffer.colorTexture(0));
+}
+
 void GLViewer::resetView()
 {
     vec center;
@@ -169,11 +302,39 @@ void GLViewer::draw()
 
     __TIME_CODE_BLOCK("Total time");
 
+    // Snapshots still being encoded are written before the next sequence
+    if(!k_snapshot && k_snapshot.changedLastFrame())
+        GQImageWriter::instance().flush();
+
     if(k_snapshot && _snapshotPath == ""){
         _snapshotPath = QFileDialog::getExistingDirectory(this,"Snapshot directory",QDir::currentPath(),
                                                           QFileDialog::ShowDirsOnly| QFileDialog::DontResolveSymlinks);
     }
 
+    // Timings of every thread between switching the dial on and off
+    if(k_profile.changedLastFrame()){
+        if(k_profile){
+            Profiler::clear();
+            Profiler::setEnabled(true);
+        }else{
+            Profiler::setEnabled(false);
+            QString filename = QFileDialog::getSaveFileName(this,"Save profile trace",QDir::currentPath(),
+                                                            "Chrome trace (*.json)");
+            if(filename != "")
+                Profiler::saveChromeTrace(filename);
+            qDebug("%s", qPrintable(Profiler::summary()));
+        }
+    }
+
+    if(k_record && _recordPath == ""){
+        _recordPath = QFileDialog::getExistingDirectory(this,"Recording directory",QDir::currentPath(),
+                                                        QFileDialog::ShowDirsOnly| QFileDialog::DontResolveSymlinks);
+        if(_recordPath == "" || !startRecording()){
+            _recordPath = "";
+            k_record.setValue(false);
+        }
+    }
+
     xform modelView_xf;
     camera()->getModelViewMatrix(modelView_xf);
     _scene->setModelViewMatix(modelView_xf);
@@ -186,43 +347,91 @@ void GLViewer::draw()
     _imgLines.drawScene(*_scene,!k_useSnakes && (k_drawRefImg != k_ref_list[4]));
 
     if(k_useSnakes){
-        if(_scene->isAnimated() &&  _prev_frame_number != _scene->currentFrameNumber()){
+        // With the async readback, the samples, reference image and motion
+        // all lag one frame behind, so the flow follows their frame
+        int frame = _scene->isAnimated() ? _scene->currentFrameNumber() : -1;
+        _imgLines.setReadReference(k_pipelined || k_record);
+        _imgLines.queueReadback(proj_xf,modelView_xf,_scene->isAnimated(),true,frame);
+        int sampleFrame = _imgLines.sampleFrame();
+        if(_scene->isAnimated() &&  _prev_frame_number != sampleFrame){
             _imgLines.nextGeomFlowBuffer();
         }
-        _imgLines.readbackSamples(proj_xf,modelView_xf,_scene->isAnimated(),true);
+        _imgLines.readbackSamples();
         int _clipPathSize = _imgLines.clipPathSet()->size();
+        bool reinit = !_ac_initialized || (k_initSnakes && !k_initSnakes.changedLastFrame());
+
+        // Frames still in the pipeline are tracked and shown before going
+        // back to the sequential loop or restarting the snakes
+        if(!k_pipelined || (reinit && _clipPathSize > 0))
+            drainPipeline();
 
         if(_clipPathSize > 0){
             GQDraw::startScreenCoordinatesSystem(true,width(),height());
             GQDraw::clearGLScreen(vec(1,1,1),1.f);
 
-            if(!_ac_initialized || (k_initSnakes && !k_initSnakes.changedLastFrame())){
+            if(reinit){
                 k_initSnakes.setValue(false);
                 _imgLines.initGeomFlowBuffer();
-                _snakes.clear();
-                _snakes.init(*_imgLines.clipPathSet(),true);
                 _snakesRenderer.init(&_snakes);
+                if(k_pipelined){
+                    submitFrame(true, false);
+                }else{
+                    _snakes.clear();
+                    _snakes.init(*_imgLines.clipPathSet(),true);
+                }
                 _ac_initialized = true;
+                if(k_record)
+                    recordFrame(DialsAndKnobs::frameCounter(), true, false);
             }else{
                 _refImg = _imgLines.offscreenTexture();
-                if(_scene->isAnimated()){
-                    _snakes.updateRefImage(_refImg,
-                                           _imgLines.geometricFlowBuffer(),
-                                           NULL,
-                                           *_imgLines.clipPathSet(),
-                                           _prev_frame_number != _scene->currentFrameNumber());
-                    if(_prev_frame_number != _scene->currentFrameNumber())
-                        _prev_frame_number = _scene->currentFrameNumber();
+                // Static scenes always move with the camera
+                bool useMotion = !_scene->isAnimated() || _prev_frame_number != sampleFrame;
+                if(k_record)
+                    recordFrame(DialsAndKnobs::frameCounter(), false, useMotion);
+                if(k_pipelined){
+                    submitFrame(false, useMotion);
                 }else{
                     //_scene->computeAdvection();
                     _snakes.updateRefImage(_refImg,
                                            _imgLines.geometricFlowBuffer(),
                                            NULL,//_scene->denseFlowBuffer()
                                            *_imgLines.clipPathSet(),
-                                           true);
+                                           useMotion);
                 }
+                if(_scene->isAnimated())
+                    _prev_frame_number = sampleFrame;
             }
 
+            // The latency setting is the number of frames left to the worker
+            // when draw returns: 0 waits for this frame, higher values let
+            // the line extraction of the next frames overlap the tracking.
+            // Nothing is left behind on the last frame of a sequence, nor
+            // when no animation plays (no draw may follow).
+            TrackingJob* tracked = NULL;
+            if(k_pipelined){
+                __TIME_CODE_BLOCK("Pipeline wait");
+                bool playing = _scene->isAnimated() && _scene->animationTimer()->isActive();
+                bool lastFrame = _scene->isAnimated() && sampleFrame == _scene->nbFrames()-1;
+                int latency = (playing && !lastFrame) ? int(k_pipelineLatency) : 0;
+                while(_pipeline.pending() > latency){
+                    // Older frames taken at once are still shown and saved
+                    if(tracked)
+                        presentJob(tracked);
+                    tracked = _pipeline.take();
+                }
+                if(tracked){
+                    __SET_COUNTER("Pipelined tracking (ms)", tracked->trackingTime);
+                    idx.setNum(tracked->frame);
+                }
+                __SET_COUNTER("Pipelined frames in flight", _pipeline.pending());
+
+                // Debug views read the snakes directly
+                if(k_drawContour != k_draw_list[0])
+                    _pipeline.waitIdle();
+            }
+            // Only frames coming out of the pipeline are saved
+            bool snapshot = k_snapshot && (!k_pipelined || tracked);
+
             if(k_drawRefImg == k_ref_list[1]) {
                 GQDraw::visualizeTexture(_refImg);
             }else if(k_drawRefImg == k_ref_list[2]) {
@@ -235,7 +444,7 @@ void GLViewer::draw()
                 GQDraw::visualizeTexture(_scene->denseFlowTexture());
             }
 
-            if(k_snapshot){
+            if(snapshot){
                 _snapshotBuffer.initFullScreen(1);
                 glClearColor(1,1,1,0);
                 _snapshotBuffer.bind(GQ_CLEAR_BUFFER);
@@ -255,14 +464,19 @@ void GLViewer::draw()
                 _imgLines.clipPathSet()->draw(true,width(),height());
             }else if(k_drawContour == k_draw_list[0]){
                 GQDraw::stopScreenCoordinatesSystem();
-                _snakesRenderer.renderStrokes();
+                if(!k_pipelined)
+                    _snakesRenderer.renderStrokes();
+                else if(tracked)
+                    _snakesRenderer.renderStrokes(tracked->segments, tracked->pathRanges);
+                else
+                    _snakesRenderer.drawStrokes();
             }
 
-            if(k_snapshot){
-                _snapshotBuffer.unbind();
-                _snapshotBuffer.saveColorTextureToFile(0,QString(_snapshotPath + "/ActiveStrokes.%1.png").arg(idx,4,QLatin1Char('0')));
-                GQDraw::visualizeTexture(_snapshotBuffer.colorTexture(0));
-            }
+            if(tracked)
+                _pipeline.release(tracked);
+
+            if(snapshot)
+                saveSnapshot(idx);
 
             if(k_drawContour != k_draw_list[0])
                 GQDraw::stopScreenCoordinatesSystem();
@@ -23,6 +23,7 @@ See the COPYING file for details.
 #include "ImageSpaceLines.h"
 
 #include "ASRenderer.h"
+#include "TrackingPipeline.h"
 
 #include <qglviewer.h>
 
@@ -46,6 +47,13 @@ protected:
     virtual void draw();
     virtual void resizeGL( int width, int height );
 
+    bool startRecording();
+    void recordFrame(int frame, bool init, bool useMotion);
+    void submitFrame(bool init, bool useMotion);
+    void presentJob(TrackingJob* job);
+    void drainPipeline();
+    void saveSnapshot(const QString& idx);
+
 private:
     bool _inited;
     bool _visible;
@@ -63,6 +71,11 @@ private:
 
     QString _snapshotPath;
     GQFramebufferObject _snapshotBuffer;
+
+    QString _recordPath;
+
+    // Declared last, so that the worker stops before the snakes are deleted
+    TrackingPipeline _pipeline;
 };
 
 #endif /*GLVIEWER_H_*/
@@ -25,6 +25,11 @@ using std::isinf;
 
 #include "TriMesh.h"
 
+#if defined(__SSE2__) || defined(_M_X64)
+#define ISL_USE_SSE
+#include <emmintrin.h>
+#endif
+
 static QStringList k_shading_list = QStringList() << "Phong" << "Toon";
 dkStringList k_shading("Current->Shader",k_shading_list);
 extern dkStringList k_model;
@@ -54,6 +59,10 @@ ImageSpaceLines::ImageSpaceLines()
     _geomFlow = new GQFloatImage();
     _motion_img = new GQFloatImage();
     _prev_motion_img = new GQFloatImage();
+    _currentReadback = 0;
+    _readbacks[0].frame = _readbacks[1].frame = -1;
+    _read_reference = false;
+    _reference_valid = false;
     _initialized = false;
 }
 
@@ -393,26 +402,69 @@ void ImageSpaceLines::visualizeBuffer()
 
 }
 
-void ImageSpaceLines::readbackSamples(xform &proj_xf, xform &mv_xf, bool read_motion, bool useDepth)
+static dkBool k_async_readback("Image Lines->Async readback", false);
+
+void ImageSpaceLines::startReadback(Readback& rb, const xform &proj_xf, const xform &mv_xf, bool read_motion, bool useDepth, int frame)
+{
+    glGetDoublev(GL_DEPTH_RANGE, rb.depthRange);
+    glGetIntegerv(GL_VIEWPORT, rb.viewport);
+    rb.proj_xf = proj_xf;
+    rb.mv_xf = mv_xf;
+    rb.readMotion = read_motion;
+    rb.useDepth = useDepth;
+    rb.frame = frame;
+
+    rb.lines.start(_lines_fbo.colorTexture(0));
+    if (read_motion)
+        rb.motion.start(_lines_fbo.colorTexture(1));
+    renderReference(rb.reference);
+    if (_read_reference)
+        rb.referencePixels.start(rb.reference.colorTexture(0));
+}
+
+void ImageSpaceLines::queueReadback(xform &proj_xf, xform &mv_xf, bool read_motion, bool useDepth, int frame)
+{
+    __TIME_CODE_BLOCK("Image Lines Transfer");
+
+    Readback& current = _readbacks[_currentReadback];
+    Readback& other = _readbacks[1-_currentReadback];
+    startReadback(current, proj_xf, mv_xf, read_motion, useDepth, frame);
+
+    // In async mode, the samples of the previous frame are extracted while
+    // the transfer of this one is in flight (one frame of latency). The
+    // first frame queues its transfer twice to fill the pipeline.
+    Readback* rb = &current;
+    if (k_async_readback) {
+        if (!other.lines.pending())
+            startReadback(other, proj_xf, mv_xf, read_motion, useDepth, frame);
+        rb = &other;
+    } else {
+        other.lines.unmap();
+        other.motion.unmap();
+        other.referencePixels.unmap();
+    }
+    _currentReadback = (rb == &_readbacks[0]) ? 0 : 1;
+    _reference_valid = false;
+}
+
+void ImageSpaceLines::readbackSamples()
 {
     __TIME_CODE_BLOCK("Image Lines Readback");
 
-    GLint viewport[4];
-    GLdouble depthRange[2];
-    glGetDoublev(GL_DEPTH_RANGE, depthRange);
-    glGetIntegerv(GL_VIEWPORT, viewport);
+    Readback* rb = &_readbacks[_currentReadback];
 
     int prevClipPathSize = _clip_path_set.size();
 
-    if(!read_motion){
+    if(!rb->readMotion){
         // Computation of the motion of the previous samples (assuming camera motion only)
         _prevGeomFlow->resize(prevClipPathSize,1,3);
 
+        xform mvp = rb->proj_xf * rb->mv_xf;
         for(int i=0; i<prevClipPathSize; i++){
             vec3 prevPos_world = (*_clip_path_set[i])[0]->position3D();
 
-            vec3 newPos = proj_xf * mv_xf * prevPos_world;
-            vec3 clipPos = ASClipPathSet::clipToViewport(vec4(newPos[0],newPos[1],newPos[2],1.f),viewport,depthRange);
+            vec3 newPos = mvp * prevPos_world;
+            vec3 clipPos = ASClipPathSet::clipToViewport(vec4(newPos[0],newPos[1],newPos[2],1.f),rb->viewport,rb->depthRange);
 
             if(isnan(clipPos[0]) || isnan(clipPos[1]) || isnan(clipPos[2])){
                 qWarning("Nan reprojection");
@@ -424,66 +476,45 @@ void ImageSpaceLines::readbackSamples(xform &proj_xf, xform &mv_xf, bool read_mo
         }
     }
 
-    GQFloatImage max_img;
-    _lines_fbo.readColorTexturef(0, max_img);
-    if (read_motion) {
-        _lines_fbo.readColorTexturef(1, *_motion_img);
-    }
+    // The whole buffers are transferred, the line pixels are picked out of
+    // the mapped memory on the CPU
+    const float* lines = rb->lines.map();
+    const float* motion = rb->readMotion ? rb->motion.map() : NULL;
+    if (lines && (motion || !rb->readMotion))
+        extractSamples(*rb, lines, motion);
+    else
+        _samples.clear();
+    rb->lines.unmap();
+    rb->motion.unmap();
 
-    // Read back the new samples
-    static QVector<vec>  sample_positions2D;
-    static QVector<vec>  sample_positions;
     static QVector<vec>  sample_motions;
-    static QVector<vec2> sample_tangents;
-    static QVector<float> sample_strengths;
-    sample_positions2D.clear();
-    sample_positions.clear();
+    _sample_positions2D.clear();
+    _sample_positions.clear();
     sample_motions.clear();
-    sample_tangents.clear();
-    sample_strengths.clear();
-
-    xform inv_mvp = inv(proj_xf*mv_xf);
-
-    for (int y = 0; y < max_img.height(); y++) {
-        for (int x = 0; x < max_img.width(); x++) {
-            float strength = max_img.pixel(x,y,0);
-            if (strength < 10e-7)
-                continue;
-
-            float tan_x = max_img.pixel(x,y,1);
-            float tan_y = max_img.pixel(x,y,2);
-            float sz    = max_img.pixel(x,y,3);
-            if(!useDepth || sz < -1 || sz > 1)
-                sz = 0.f;
-            vec projPos;
-            projPos[0] = ((float)(x+0.5)/(float)(viewport[2]-1))*2-1;
-            projPos[1] = ((float)(y+0.5)/(float)(viewport[3]-1))*2-1;
-            projPos[2] = sz;
-
-            vec worldPos = inv_mvp * projPos;
-
-            if(isnan(worldPos[0]) || isnan(worldPos[1]) || isnan(worldPos[2]) ||
-                    isinf(worldPos[0]) || isinf(worldPos[1]) || isinf(worldPos[2])){
-                //qWarning("Nan back projection");
-                continue;
-            }
-
-            sample_positions2D.push_back(projPos);
-            sample_positions.push_back(worldPos);
-            sample_tangents.push_back(vec2(tan_x, tan_y));
-            sample_strengths.push_back(strength);
-
-            if (read_motion) {
-                vec motion = vec(_motion_img->pixel(x,y,0), _motion_img->pixel(x,y,1), _motion_img->pixel(x,y,2));
-                sample_motions.push_back(motion);
-            }
+    _sample_tangents.clear();
+    _sample_strengths.clear();
+
+    for (int i = 0; i < _samples.size(); i++) {
+        const LineSample& s = _samples.at(i);
+        if(isnan(s.position[0]) || isnan(s.position[1]) || isnan(s.position[2]) ||
+                isinf(s.position[0]) || isinf(s.position[1]) || isinf(s.position[2])){
+            //qWarning("Nan back projection");
+            continue;
         }
+
+        _sample_positions2D.push_back(s.position2D);
+        _sample_positions.push_back(s.position);
+        _sample_tangents.push_back(s.tangent);
+        _sample_strengths.push_back(s.strength);
+        if (rb->readMotion)
+            sample_motions.push_back(s.motion);
     }
 
-    _clip_path_set.initFromPoints(sample_positions2D, sample_positions,
-                                  sample_tangents, sample_strengths);
+    _clip_path_set.initFromPoints(_sample_positions2D, _sample_positions,
+                                  _sample_tangents, _sample_strengths,
+                                  rb->viewport, rb->depthRange);
 
-    if(read_motion){
+    if(rb->readMotion){
         _geomFlow->resize(sample_motions.size(),1,3);
         for(int i=0; i<_clip_path_set.size(); i++){
             vec3 nextPos = sample_motions.at(i);
@@ -496,12 +527,119 @@ void ImageSpaceLines::readbackSamples(xform &proj_xf, xform &mv_xf, bool read_mo
     }
 }
 
+// Same arithmetic as xform * vec, in double precision
+static inline void unproject(const double m[16], LineSample& s)
+{
+    double v0 = s.position2D[0];
+    double v1 = s.position2D[1];
+    double v2 = s.position2D[2];
+    double hw = 1 / (m[3] * v0 + m[7] * v1 + m[11] * v2 + m[15]);
+    s.position[0] = float(hw * (m[0] * v0 + m[4] * v1 + m[8]  * v2 + m[12]));
+    s.position[1] = float(hw * (m[1] * v0 + m[5] * v1 + m[9]  * v2 + m[13]));
+    s.position[2] = float(hw * (m[2] * v0 + m[6] * v1 + m[10] * v2 + m[14]));
+}
 
-GQTexture2D* ImageSpaceLines::offscreenTexture()
+#ifdef ISL_USE_SSE
+// Two samples at once, with the operations in the same order as above
+static inline __m128d transformRow(const double m[16], int r, __m128d v0, __m128d v1, __m128d v2)
+{
+    __m128d t = _mm_add_pd(_mm_mul_pd(_mm_set1_pd(m[r]), v0), _mm_mul_pd(_mm_set1_pd(m[r+4]), v1));
+    t = _mm_add_pd(t, _mm_mul_pd(_mm_set1_pd(m[r+8]), v2));
+    return _mm_add_pd(t, _mm_set1_pd(m[r+12]));
+}
+
+static inline void unprojectPair(const double m[16], LineSample& a, LineSample& b)
+{
+    __m128d v0 = _mm_set_pd(b.position2D[0], a.position2D[0]);
+    __m128d v1 = _mm_set_pd(b.position2D[1], a.position2D[1]);
+    __m128d v2 = _mm_set_pd(b.position2D[2], a.position2D[2]);
+    __m128d hw = _mm_div_pd(_mm_set1_pd(1.0), transformRow(m, 3, v0, v1, v2));
+    double p[3][2];
+    for (int r = 0; r < 3; r++)
+        _mm_storeu_pd(p[r], _mm_mul_pd(hw, transformRow(m, r, v0, v1, v2)));
+    for (int r = 0; r < 3; r++) {
+        a.position[r] = float(p[r][0]);
+        b.position[r] = float(p[r][1]);
+    }
+}
+#endif
+
+void ImageSpaceLines::extractSamples(const Readback& rb, const float* lines, const float* motion)
+{
+    const int w = rb.lines.width();
+    const int h = rb.lines.height();
+
+    // Count the line pixels of each row, then fill the packed records in
+    // scan order (the geometric flow is indexed by sample)
+    _rowOffsets.resize(h+1);
+    _rowOffsets[0] = 0;
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < h; y++) {
+        const float* row = lines + 4*y*w;
+        int count = 0;
+        for (int x = 0; x < w; x++)
+            if (row[4*x] >= 10e-7)
+                count++;
+        _rowOffsets[y+1] = count;
+    }
+    for (int y = 0; y < h; y++)
+        _rowOffsets[y+1] += _rowOffsets[y];
+
+    const int n = _rowOffsets[h];
+    _samples.resize(n);
+    LineSample* samples = _samples.data();
+
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < h; y++) {
+        const float* row = lines + 4*y*w;
+        int k = _rowOffsets[y];
+        for (int x = 0; x < w; x++) {
+            const float* pix = row + 4*x;
+            if (pix[0] < 10e-7)
+                continue;
+
+            LineSample& s = samples[k++];
+            float sz = pix[3];
+            if(!rb.useDepth || sz < -1 || sz > 1)
+                sz = 0.f;
+            s.position2D[0] = ((float)(x+0.5)/(float)(rb.viewport[2]-1))*2-1;
+            s.position2D[1] = ((float)(y+0.5)/(float)(rb.viewport[3]-1))*2-1;
+            s.position2D[2] = sz;
+            s.tangent = vec2(pix[1], pix[2]);
+            s.strength = pix[0];
+            if (motion) {
+                const float* m = motion + 4*(y*w+x);
+                s.motion = vec(m[0], m[1], m[2]);
+            }
+        }
+    }
+
+    // Batched unprojection, by pairs with SSE2
+    const xform inv_mvp = inv(rb.proj_xf*rb.mv_xf);
+    double m[16];
+    for (int i = 0; i < 16; i++)
+        m[i] = inv_mvp[i];
+
+    const int pairs = n / 2;
+    #pragma omp parallel for schedule(static)
+    for (int k = 0; k < pairs; k++) {
+#ifdef ISL_USE_SSE
+        unprojectPair(m, samples[2*k], samples[2*k+1]);
+#else
+        unproject(m, samples[2*k]);
+        unproject(m, samples[2*k+1]);
+#endif
+    }
+    if (n % 2)
+        unproject(m, samples[n-1]);
+}
+
+
+void ImageSpaceLines::renderReference(GQFramebufferObject& fbo)
 {
-    _offscreen_fbo.initFullScreen(1,GQ_ATTACH_NONE,GQ_COORDS_PIXEL,GQ_FORMAT_RGBA_BYTE);
+    fbo.initFullScreen(1,GQ_ATTACH_NONE,GQ_COORDS_PIXEL,GQ_FORMAT_RGBA_BYTE);
 
-    _offscreen_fbo.bind(GQ_CLEAR_BUFFER);
+    fbo.bind(GQ_CLEAR_BUFFER);
 
     GQShaderRef shader = GQShaderManager::bindProgram("imagesc");
 
@@ -512,9 +650,44 @@ GQTexture2D* ImageSpaceLines::offscreenTexture()
 
     GQDraw::drawFullScreenQuad(_colors_fbo);
 
-    _offscreen_fbo.unbind();
+    fbo.unbind();
+}
+
+GQTexture2D* ImageSpaceLines::offscreenTexture()
+{
+    // Same frame as the samples
+    return _readbacks[_currentReadback].reference.colorTexture(0);
+}
+
+bool ImageSpaceLines::saveSamples(const QString& filename) const
+{
+    return ASClipPathSet::saveSamples(filename, _sample_positions2D, _sample_positions,
+                                      _sample_tangents, _sample_strengths);
+}
 
-    return _offscreen_fbo.colorTexture(0);
+const GQFloatImage& ImageSpaceLines::referenceImage()
+{
+    if (_reference_valid)
+        return _reference_img;
+
+    // Only the first channel is used by the attraction field
+    Readback& rb = _readbacks[_currentReadback];
+    const float* rgba = rb.referencePixels.pending() ? rb.referencePixels.map() : NULL;
+    if (rgba) {
+        int n = rb.referencePixels.width() * rb.referencePixels.height();
+        _reference_img.resize(rb.referencePixels.width(), rb.referencePixels.height(), 1);
+        for (int i = 0; i < n; i++)
+            _reference_img.raster()[i] = rgba[4*i];
+    } else {
+        GQFloatImage pixels;
+        rb.reference.readColorTexturef(0, pixels);
+        _reference_img.resize(pixels.width(), pixels.height(), 1);
+        for (int i = 0; i < pixels.width()*pixels.height(); i++)
+            _reference_img.raster()[i] = pixels.raster()[i*pixels.chan()];
+    }
+    rb.referencePixels.unmap();
+    _reference_valid = true;
+    return _reference_img;
 }
 
 GQFloatImage* ImageSpaceLines::geometricFlowBuffer() {
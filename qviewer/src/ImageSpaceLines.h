@@ -16,6 +16,7 @@ See the COPYING file for details.
 #define _STEERABLE_IMAGE_LINES_H_
 
 #include "GQFramebufferObject.h"
+#include "GQReadbackBuffer.h"
 #include "Scene.h"
 #include "ASClipPath.h"
 
@@ -28,6 +29,15 @@ enum buffer_indices {
     BUFFER_INDICES_NUM
 };
 
+// One line pixel, as extracted from the lines buffer
+struct LineSample {
+    vec   position2D;
+    vec   position;
+    vec2  tangent;
+    float strength;
+    vec   motion;
+};
+
 class ImageSpaceLines
 {
   public:
@@ -37,12 +47,28 @@ class ImageSpaceLines
 
     void drawScene(Scene& scene, bool visualize=false);
     
-    void readbackSamples(xform &proj_xf, xform &mv_xf, bool read_motion, bool useDepth);
+    // Queues the transfer of the lines of this frame. With the async
+    // readback, the samples, reference image and motion extracted next are
+    // those of the previous frame, rendered at sampleFrame().
+    void queueReadback(xform &proj_xf, xform &mv_xf, bool read_motion, bool useDepth, int frame);
+    int  sampleFrame() const { return _readbacks[_currentReadback].frame; }
+    void readbackSamples();
+    // Samples of the last readback, for offline replays
+    bool saveSamples(const QString& filename) const;
+    const QVector<vec>&   samplePositions2D() const { return _sample_positions2D; }
+    const QVector<vec>&   samplePositions() const { return _sample_positions; }
+    const QVector<vec2>&  sampleTangents() const { return _sample_tangents; }
+    const QVector<float>& sampleStrengths() const { return _sample_strengths; }
 
     ASClipPathSet* clipPathSet() { return &_clip_path_set; }
 
     GQFramebufferObject* colors_fbo() { return &_colors_fbo; }
     GQTexture2D*    offscreenTexture();
+    // First channel of the reference image on the CPU. With setReadReference
+    // on, it goes through the pack buffers with the samples (and lags with
+    // them in async mode); otherwise it is read back when first asked for.
+    void                setReadReference(bool b) { _read_reference = b; }
+    const GQFloatImage& referenceImage();
     GQTexture2D*    energyTexture() { return _energy_fbo.colorTexture(0); }
     GQTexture2D*    colorTexture() { return _colors_fbo.colorTexture(0); }
 
@@ -77,11 +103,15 @@ protected:
     GQFramebufferObject _half_blur_fbo;
     GQFramebufferObject _energy_fbo;
     GQFramebufferObject _lines_fbo;
-    GQFramebufferObject _offscreen_fbo;
     GQFramebufferObject _depth_buffer;
 
     ASClipPathSet _clip_path_set;
 
+    QVector<vec>   _sample_positions2D;
+    QVector<vec>   _sample_positions;
+    QVector<vec2>  _sample_tangents;
+    QVector<float> _sample_strengths;
+
     GQFloatImage* _geomFlow;
     GQFloatImage* _prevGeomFlow;
 
@@ -89,6 +119,35 @@ protected:
     GQFloatImage* _prev_motion_img;
 
     xform _next_camera_matrix;
+
+    // Transfers of the lines and motion buffers, with the reference image,
+    // frame and camera they were rendered with
+    struct Readback {
+        GQReadbackBuffer lines;
+        GQReadbackBuffer motion;
+        GQFramebufferObject reference;
+        GQReadbackBuffer    referencePixels;
+        int      frame;
+        xform    proj_xf;
+        xform    mv_xf;
+        GLint    viewport[4];
+        GLdouble depthRange[2];
+        bool     readMotion;
+        bool     useDepth;
+    };
+    Readback _readbacks[2];
+    int      _currentReadback;
+
+    void startReadback(Readback& rb, const xform &proj_xf, const xform &mv_xf, bool read_motion, bool useDepth, int frame);
+    void renderReference(GQFramebufferObject& fbo);
+    void extractSamples(const Readback& rb, const float* lines, const float* motion);
+
+    QVector<LineSample> _samples;
+    QVector<int>        _rowOffsets;
+
+    bool         _read_reference;
+    bool         _reference_valid;
+    GQFloatImage _reference_img;
 };
 
 #endif // _STEERABLE_IMAGE_LINES_H_
@@ -0,0 +1,193 @@
+/*****************************************************************************\
+
+MeshSequence.cc
+Authors:
+    Pierre Benard (pierre.benard@laposte.net),
+    Forrester Cole (fcole@csail.mit.edu),
+    Jingwan Lu (jingwanl@princeton.edu)
+Copyright (c) 2012 Pierre Benard, Forrester Cole, Jingwan Lu
+
+qviewer is distributed under the terms of the GNU General Public License.
+See the COPYING file for details.
+
+\*****************************************************************************/
+
+#include "MeshSequence.h"
+#include "TriMesh.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QTextStream>
+#include <QSet>
+
+using trimesh::TriMesh;
+
+static QMutex         s_cacheMutex;
+static QWaitCondition s_cacheWritten;
+static QSet<QString>  s_cacheWrites;
+
+MeshSequence::MeshSequence()
+{
+    _window_start = 0;
+    _look_ahead = 0;
+    _stop = false;
+    _use_cache = true;
+}
+
+MeshSequence::~MeshSequence()
+{
+    close();
+}
+
+bool MeshSequence::readFrameList( const QString& filename, QStringList& frames )
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning("Could not open %s", qPrintable(filename));
+        return false;
+    }
+    QTextStream ts(&file);
+    QDir filedir = QFileInfo(filename).dir();
+    QString line = ts.readLine();
+    while (!line.isNull()) {
+        if (!line.trimmed().isEmpty())
+            frames << filedir.filePath(line.trimmed());
+        line = ts.readLine();
+    }
+    if (frames.isEmpty()) {
+        qWarning("MeshSequence: no frame in %s", qPrintable(filename));
+        return false;
+    }
+    return true;
+}
+
+bool MeshSequence::writeCache( TriMesh* trimesh, const QString& filename )
+{
+    QMutexLocker locker(&s_cacheMutex);
+    while (s_cacheWrites.contains(filename))
+        s_cacheWritten.wait(&s_cacheMutex);
+    s_cacheWrites.insert(filename);
+    locker.unlock();
+
+    bool ok = trimesh->write_cache(qPrintable(filename));
+
+    locker.relock();
+    s_cacheWrites.remove(filename);
+    s_cacheWritten.wakeAll();
+    return ok;
+}
+
+bool MeshSequence::open( const QString& filename, bool useCache )
+{
+    close();
+    _use_cache = useCache;
+
+    if (!readFrameList(filename, _filenames))
+        return false;
+
+    // Nothing is decoded before the first request
+    _window_start = 0;
+    _look_ahead = -1;
+    _stop = false;
+    start(QThread::LowPriority);
+    return true;
+}
+
+void MeshSequence::close()
+{
+    if (isRunning()) {
+        _mutex.lock();
+        _stop = true;
+        _requested.wakeAll();
+        _mutex.unlock();
+        wait();
+    }
+    _cache.clear();
+    _filenames.clear();
+}
+
+bool MeshSequence::inWindow( int f ) const
+{
+    int n = _filenames.size();
+    return (f - _window_start + n) % n <= _look_ahead;
+}
+
+QSharedPointer<MeshFrame> MeshSequence::frame( int f, int lookAhead )
+{
+    QMutexLocker locker(&_mutex);
+
+    _window_start = f;
+    _look_ahead = lookAhead;
+    QMutableHashIterator<int, QSharedPointer<MeshFrame> > it(_cache);
+    while (it.hasNext()) {
+        it.next();
+        if (!inWindow(it.key()))
+            it.remove();
+    }
+    _requested.wakeAll();
+
+    while (!_cache.contains(f))
+        _decoded.wait(&_mutex);
+    return _cache.value(f);
+}
+
+void MeshSequence::insert( int f, const QSharedPointer<MeshFrame>& frame )
+{
+    QMutexLocker locker(&_mutex);
+
+    _cache.insert(f, frame);
+    _decoded.wakeAll();
+}
+
+void MeshSequence::run()
+{
+    QMutexLocker locker(&_mutex);
+
+    while (!_stop) {
+        // First missing frame of the window, in playback order
+        int n = _filenames.size();
+        int next = -1;
+        for (int d = 0; d <= _look_ahead && d < n; d++) {
+            int f = (_window_start + d) % n;
+            if (!_cache.contains(f)) {
+                next = f;
+                break;
+            }
+        }
+        if (next < 0) {
+            _requested.wait(&_mutex);
+            continue;
+        }
+
+        locker.unlock();
+        QSharedPointer<MeshFrame> data(new MeshFrame);
+        decode(next, *data);
+        locker.relock();
+
+        // A failed frame is still inserted (empty) so that no one waits for it
+        if (inWindow(next))
+            _cache.insert(next, data);
+        _decoded.wakeAll();
+    }
+}
+
+bool MeshSequence::decode( int f, MeshFrame& frame ) const
+{
+    QByteArray filename = _filenames.at(f).toLocal8Bit();
+    TriMesh* trimesh = _use_cache ? TriMesh::read_cache(filename.constData()) : NULL;
+    bool cached = (trimesh != NULL);
+    if (!trimesh)
+        trimesh = TriMesh::read(filename.constData());
+    if (!trimesh) {
+        qWarning("MeshSequence: could not load %s", filename.constData());
+        return false;
+    }
+    trimesh->need_normals();
+    if (_use_cache && !cached)
+        writeCache(trimesh, _filenames.at(f));
+    frame.vertices.swap(trimesh->vertices);
+    frame.normals.swap(trimesh->normals);
+    delete trimesh;
+    return true;
+}
@@ -0,0 +1,84 @@
+/*****************************************************************************\
+
+MeshSequence.h
+Authors:
+    Pierre Benard (pierre.benard@laposte.net),
+    Forrester Cole (fcole@csail.mit.edu),
+    Jingwan Lu (jingwanl@princeton.edu)
+Copyright (c) 2012 Pierre Benard, Forrester Cole, Jingwan Lu
+
+Streaming source for animated mesh sequences (.seq files). Only the
+per-frame vertex positions and normals are kept, for a bounded window of
+frames decoded ahead of the current one by a background thread.
+
+qviewer is distributed under the terms of the GNU General Public License.
+See the COPYING file for details.
+
+\*****************************************************************************/
+
+#ifndef MESH_SEQUENCE_H_
+#define MESH_SEQUENCE_H_
+
+#include "GQInclude.h"
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QHash>
+#include <QSharedPointer>
+#include <QStringList>
+
+#include <vector>
+
+namespace trimesh { class TriMesh; }
+
+struct MeshFrame {
+    std::vector<vec> vertices;
+    std::vector<vec> normals;
+};
+
+class MeshSequence : public QThread
+{
+public:
+    MeshSequence();
+    ~MeshSequence();
+
+    // Reads the list of frame files and starts the prefetch thread, idle
+    // until the first call to frame(). Reads the frames through the binary
+    // mesh cache when useCache is set
+    bool open( const QString& filename, bool useCache = true );
+    void close();
+
+    // Frame files listed in a .seq file, relative to its directory
+    static bool readFrameList( const QString& filename, QStringList& frames );
+    // Writes the binary mesh cache of filename. Writers of the same cache
+    // (the prefetch and the loading threads) wait for each other.
+    static bool writeCache( trimesh::TriMesh* trimesh, const QString& filename );
+
+    int nbFrames() const { return _filenames.size(); }
+    const QString& frameFilename( int f ) const { return _filenames.at(f); }
+
+    // Blocks until the frame is decoded, the next lookAhead frames are
+    // decoded in the background. Frames out of that window are released.
+    QSharedPointer<MeshFrame> frame( int f, int lookAhead );
+    // Frame already decoded by the caller, so that it is not read again
+    void insert( int f, const QSharedPointer<MeshFrame>& frame );
+
+protected:
+    void run();
+    bool decode( int f, MeshFrame& frame ) const;
+    bool inWindow( int f ) const;
+
+    QStringList    _filenames;
+    bool           _use_cache;
+
+    QMutex         _mutex;
+    QWaitCondition _requested;
+    QWaitCondition _decoded;
+    QHash<int, QSharedPointer<MeshFrame> > _cache;
+    int            _window_start;
+    int            _look_ahead;
+    bool           _stop;
+};
+
+#endif // MESH_SEQUENCE_H_
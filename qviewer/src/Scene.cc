@@ -28,6 +28,7 @@ See the COPYING file for details.
 using namespace GQDraw;
 
 #include <assert.h>
+#include <algorithm>
 
 const int CURRENT_VERSION = 1;
 
@@ -35,12 +36,18 @@ static dkSlider k_toon_slider("Light->Toon factor",1);
 
 static dkFloat k_animation_frame_time("Mesh animation->Frame time", 0.1, 0.01, 10, 0.1);
 static dkBool  k_play_animation("Mesh animation->Play", false);
+static dkInt   k_prefetch_frames("Mesh animation->Prefetch frames", 4, 0, 64, 1);
+static dkBool  k_mesh_cache("Mesh animation->Binary cache", true);
+static dkBool  k_stream_sequences("Mesh animation->Stream sequences", true);
+static dkBool  k_quantize_flow("Mesh animation->Quantized flow", true);
 
 extern dkStringList k_model;
 
 Scene::Scene()
 {
     _current_frame = 0;
+    _streamed_frame = -1;
+    _decoded_flow_frame = -1;
     _session = NULL;
     _tex_toon_filename = "";
     _tex_toon = NULL;
@@ -73,14 +80,24 @@ void Scene::init()
 
 void Scene::clear()
 {
+    _sequence.close();
     qDeleteAll(_meshes);
+    _meshes.clear();
+    _current_frame = 0;
+    _streamed_frame = -1;
+    _decoded_flow_frame = -1;
 	_viewer_state.clear();
 	_dials_and_knobs_state.clear();
 }
 
 bool Scene::loadTrimesh( const QString& filename )
 {
-    TriMesh* trimesh = TriMesh::read(qPrintable(filename));
+    // A valid cache may lack some of the data computed by setupMesh (the
+    // streaming only stores the normals), setupMesh fills it in
+    TriMesh* trimesh = k_mesh_cache ? TriMesh::read_cache(qPrintable(filename)) : NULL;
+    bool cached = (trimesh != NULL);
+    if (!trimesh)
+        trimesh = TriMesh::read(qPrintable(filename));
     if (!trimesh)
     {
         clear();
@@ -90,6 +107,8 @@ bool Scene::loadTrimesh( const QString& filename )
     _viewer_state.clear();
     _dials_and_knobs_state.clear();
     setupMesh(trimesh);
+    if (k_mesh_cache && !cached)
+        MeshSequence::writeCache(trimesh, filename);
     return true;
 }
 
@@ -119,19 +138,31 @@ bool Scene::load( const QString& filename )
 
 		return load(root, path); 
 	}
-    else if (filename.endsWith("seq")) { // sequence of meshes
-        QFile file(filename);
-        if (!file.open(QIODevice::ReadOnly)) {
-            qWarning("Could not open %s", qPrintable(filename));
+    else if (filename.endsWith("seq") && k_stream_sequences) { // sequence of meshes
+        // The topology comes from the first frame, the positions of
+        // the other frames are streamed
+        if (!_sequence.open(filename, k_mesh_cache))
+            return false;
+        if (!loadTrimesh(_sequence.frameFilename(0))) {
+            _sequence.close();
             return false;
         }
-        QTextStream ts(&file);
-        QDir filedir = QFileInfo(filename).dir();
-        QString line = ts.readLine();
-        while (!line.isNull()) {
-            QString framename = filedir.filePath(line);
-            loadTrimesh(framename);
-            line = ts.readLine();
+        // Decoded once, for both the topology and the streaming
+        TriMesh* trimesh = _meshes[0]->trimesh;
+        QSharedPointer<MeshFrame> first(new MeshFrame);
+        first->vertices = trimesh->vertices;
+        first->normals = trimesh->normals;
+        _sequence.insert(0, first);
+        computeGeometricFlow();
+        _session = NULL;
+    }
+    else if (filename.endsWith("seq")) { // all frames in memory
+        QStringList frames;
+        if (!MeshSequence::readFrameList(filename, frames))
+            return false;
+        for (int f = 0; f < frames.size(); f++) {
+            if (!loadTrimesh(frames[f]))
+                return false;
         }
         computeGeometricFlow();
         _session = NULL;
@@ -273,7 +304,7 @@ bool Scene::save( QDomDocument& doc, QDomElement& root, const QDir& path )
 
 void Scene::advanceAnimation()
 {
-     _current_frame = (_current_frame+1)%_meshes.size();
+     _current_frame = (_current_frame+1)%nbFrames();
 }
 
 void Scene::toggleAnimation(bool play)
@@ -431,21 +462,161 @@ void Scene::setupVertexBufferSet(Mesh* mesh)
 
 void Scene::computeGeometricFlow()
 {
+    if (isStreamed()) {
+        _streamed_frame = -1;
+        updateStreamedFrame();
+        return;
+    }
+
     int nvertices = _meshes[0]->trimesh->vertices.size();
     int nframes = _meshes.size();
+
+    // Quantized flows are decoded in a single buffer shared by all the
+    // frames, when a frame becomes current
+    bool quantize = k_quantize_flow && nframes > 1;
+    _decoded_flow.resize(quantize ? nvertices : 0);
+    _decoded_flow_frame = -1;
+
+    float max_error = 0.f;
+    double packed_size = 0.0;
+    std::vector<vec3> flow(quantize ? nvertices : 0);
     for (int f = 0; f < nframes; f++) {
-        std::vector<vec3> pf;
+        Mesh* mesh = _meshes[f];
+        if ((int)mesh->trimesh->vertices.size() != nvertices ||
+            (int)_meshes[(f+1)%nframes]->trimesh->vertices.size() != nvertices) {
+            qWarning("Scene: frame %d does not match the topology of the sequence", f);
+            return;
+        }
+
+        // The buffer set does not copy its sources, the mesh keeps them
+        std::vector<vec3>& pf = quantize ? flow : mesh->geom_flow;
+        pf.resize(nvertices);
         for (int g = 0; g < nvertices; g++) {
-            vec3 p = _meshes[f]->trimesh->vertices[g];
+            vec3 p = mesh->trimesh->vertices[g];
             vec3 q = _meshes[(f+1)%nframes]->trimesh->vertices[g];
-            pf.push_back(q-p);
+            pf[g] = q-p;
+        }
+
+        if (quantize) {
+            mesh->packed_flow.encode(flow);
+            std::vector<vec3>().swap(mesh->geom_flow);
+            max_error = std::max(max_error, mesh->packed_flow.maxError());
+            packed_size += mesh->packed_flow.memorySize();
+            mesh->vertex_buffer_set.add("geom_flow",_decoded_flow);
+        } else {
+            mesh->packed_flow.clear();
+            mesh->vertex_buffer_set.add("geom_flow",pf);
+        }
+    }
+
+    if (quantize) {
+        double float_size = double(nframes) * nvertices * sizeof(vec3);
+        qDebug("Geometric flow: %d frames, %.1f MB instead of %.1f MB, max error %g",
+               nframes, (packed_size + _decoded_flow.size()*sizeof(vec3)) / 1048576.0,
+               float_size / 1048576.0, max_error);
+    }
+}
+
+void Scene::decodeCurrentFlow()
+{
+    Mesh* mesh = currentMesh();
+    if (isStreamed() || mesh->packed_flow.isEmpty() || _decoded_flow_frame == _current_frame)
+        return;
+
+    mesh->packed_flow.decode(_decoded_flow);
+    _decoded_flow_frame = _current_frame;
+    if (mesh->vertex_buffer_set.vbosLoaded())
+        mesh->vertex_buffer_set.updateVBO("geom_flow");
+}
+
+void QuantizedFlow::encode(const std::vector<vec>& flow)
+{
+    int n = flow.size();
+    vec lo(0,0,0), hi(0,0,0);
+    if (n > 0)
+        lo = hi = flow[0];
+    for (int i = 1; i < n; i++) {
+        for (int c = 0; c < 3; c++) {
+            lo[c] = std::min(lo[c], flow[i][c]);
+            hi[c] = std::max(hi[c], flow[i][c]);
         }
-        _meshes[f]->vertex_buffer_set.add("geom_flow",pf);
+    }
+    _origin = lo;
+    for (int c = 0; c < 3; c++)
+        _step[c] = (hi[c] - lo[c]) / 65535.f;
+
+    _deltas.resize(3*n);
+    double sum_sq = 0.0;
+    _maxError = 0.f;
+    for (int i = 0; i < n; i++) {
+        for (int c = 0; c < 3; c++) {
+            int q = 0;
+            if (_step[c] > 0.f)
+                q = std::min(65535, std::max(0, (int)floor((flow[i][c] - lo[c]) / _step[c] + 0.5f)));
+            _deltas[3*i+c] = (short)(q - 32768);
+            float err = fabs(_origin[c] + q * _step[c] - flow[i][c]);
+            _maxError = std::max(_maxError, err);
+            sum_sq += err * err;
+        }
+    }
+    _rmsError = n > 0 ? sqrt(sum_sq / (3*n)) : 0.f;
+}
+
+void QuantizedFlow::decode(std::vector<vec>& flow) const
+{
+    int n = _deltas.size() / 3;
+    flow.resize(n);
+    for (int i = 0; i < n; i++)
+        for (int c = 0; c < 3; c++)
+            flow[i][c] = _origin[c] + (_deltas[3*i+c] + 32768) * _step[c];
+}
+
+void Scene::updateStreamedFrame()
+{
+    if (!isStreamed() || _streamed_frame == _current_frame)
+        return;
+
+    __TIME_CODE_BLOCK("Mesh streaming");
+
+    // Flow from the current frame to the next one only
+    int next_frame = (_current_frame+1)%_sequence.nbFrames();
+    QSharedPointer<MeshFrame> cur = _sequence.frame(_current_frame, k_prefetch_frames);
+    QSharedPointer<MeshFrame> next = _sequence.frame(next_frame, k_prefetch_frames);
+    _streamed_frame = _current_frame;
+
+    Mesh* mesh = _meshes[0];
+    TriMesh* trimesh = mesh->trimesh;
+    int nvertices = trimesh->vertices.size();
+    if ((int)cur->vertices.size() != nvertices) {
+        qWarning("Scene: frame %d does not match the topology of the sequence", _current_frame);
+        return;
+    }
+
+    // Same sizes, so the buffer set still points to the right storage
+    std::copy(cur->vertices.begin(), cur->vertices.end(), trimesh->vertices.begin());
+    if (cur->normals.size() == trimesh->normals.size())
+        std::copy(cur->normals.begin(), cur->normals.end(), trimesh->normals.begin());
+
+    mesh->geom_flow.resize(nvertices);
+    bool has_next = ((int)next->vertices.size() == nvertices);
+    for (int g = 0; g < nvertices; g++)
+        mesh->geom_flow[g] = has_next ? next->vertices[g] - cur->vertices[g] : vec3(0,0,0);
+
+    if (!mesh->vertex_buffer_set.hasBuffer("geom_flow"))
+        mesh->vertex_buffer_set.add("geom_flow",mesh->geom_flow);
+
+    if (mesh->vertex_buffer_set.vbosLoaded()) {
+        mesh->vertex_buffer_set.updateVBO(GQ_VERTEX);
+        mesh->vertex_buffer_set.updateVBO(GQ_NORMAL);
+        mesh->vertex_buffer_set.updateVBO("geom_flow");
     }
 }
 
 void Scene::drawMesh(GQShaderRef& shader)
 {
+    updateStreamedFrame();
+    decodeCurrentFlow();
+
     Mesh* mesh = currentMesh();
     if (mesh->vertex_buffer_set.numBuffers() == 1)
         setupVertexBufferSet(mesh);
@@ -572,6 +743,10 @@ void Scene::recordStats(Stats& stats)
 	stats.beginConstantGroup("Mesh");
     stats.setConstant("Num Vertices", currentMesh()->trimesh->vertices.size());
     stats.setConstant("Num Faces", currentMesh()->trimesh->faces.size());
+    if (!currentMesh()->packed_flow.isEmpty()) {
+        stats.setConstant("Flow max error", currentMesh()->packed_flow.maxError());
+        stats.setConstant("Flow RMS error", currentMesh()->packed_flow.rmsError());
+    }
 	stats.endConstantGroup();
 }
 
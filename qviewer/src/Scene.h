@@ -40,6 +40,7 @@ See the COPYING file for details.
 #include "Sphere.h"
 #include "Cube.h"
 #include "Quad.h"
+#include "MeshSequence.h"
 
 #include "DialsAndKnobs.h"
 
@@ -53,6 +54,29 @@ enum ModelType
 	NUM_MODELS
 };
 
+// Per-frame flow as int16 deltas normalized by their bounding box
+class QuantizedFlow {
+public:
+    QuantizedFlow() : _maxError(0.f), _rmsError(0.f) {}
+
+    void encode(const std::vector<vec>& flow);
+    void decode(std::vector<vec>& flow) const;
+    void clear() { _deltas.clear(); }
+
+    bool isEmpty() const { return _deltas.empty(); }
+    int  memorySize() const { return _deltas.size() * sizeof(short); }
+    // Reconstruction error of the last encode, in scene units
+    float maxError() const { return _maxError; }
+    float rmsError() const { return _rmsError; }
+
+protected:
+    vec                _origin;
+    vec                _step;
+    std::vector<short> _deltas;
+    float              _maxError;
+    float              _rmsError;
+};
+
 struct Mesh {
     Mesh(TriMesh* m, const QString& f) : trimesh(m), filename(f) {}
     ~Mesh() { delete trimesh; }
@@ -60,6 +84,8 @@ struct Mesh {
     QString              filename;
     GQVertexBufferSet    vertex_buffer_set;
     QVector<int>		 tristrips;
+    std::vector<vec>     geom_flow;
+    QuantizedFlow        packed_flow;
 };
 
 class GLViewer;
@@ -107,11 +133,14 @@ public:
 
 	static QString fileExtension() { return QString("qvs"); }
 
-    bool isAnimated() const { return _meshes.size() > 1; }
+    bool isAnimated() const { return nbFrames() > 1; }
+    // Streamed sequences share a single mesh updated at each frame
+    bool isStreamed() const { return _sequence.nbFrames() > 0; }
+    int nbFrames() const { return isStreamed() ? _sequence.nbFrames() : _meshes.size(); }
     QTimer* animationTimer() { return &_animation_timer; }
     int currentFrameNumber() const { return _current_frame; }
-    Mesh* currentMesh() { return _meshes[currentFrameNumber()]; }
-    const Mesh* currentMesh() const { return _meshes.at(currentFrameNumber()); }
+    Mesh* currentMesh() { return _meshes[isStreamed() ? 0 : currentFrameNumber()]; }
+    const Mesh* currentMesh() const { return _meshes.at(isStreamed() ? 0 : currentFrameNumber()); }
 
     Session* session() { return _session; }
     void setSession( Session* session ) { _session = session; }
@@ -130,10 +159,20 @@ protected:
 
     void setupLighting(GQShaderRef& shader);
     void drawMesh(GQShaderRef& shader);
+    void updateStreamedFrame();
+    void decodeCurrentFlow();
 
     // Triangle meshes
     QList<Mesh*>     _meshes;
 
+    // Animated sequence, streamed from disk
+    MeshSequence     _sequence;
+    int              _streamed_frame;
+
+    // Flow of the in-memory frames, decoded for the current one
+    std::vector<vec> _decoded_flow;
+    int              _decoded_flow_frame;
+
     // Procedural objects
 	Sphere*				_sphere;
 	Cube*				_cube;
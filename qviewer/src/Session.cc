@@ -29,6 +29,7 @@ See the COPYING file for details.
 
 #include "Stats.h"
 #include "GLViewer.h"
+#include "GQImageWriter.h"
 
 using namespace trimesh;
 
@@ -313,6 +314,10 @@ void Session::cleanUpPlayback()
     disconnect( this, SIGNAL( redrawNeeded() ), _viewer, SLOT( update() ) );
     disconnect( _viewer, SIGNAL( drawFinished(bool)), this, SLOT(dumpScreenshot()) );
 
+    // All the screenshots are on disk when the playback ends
+    if (_playback_mode == PLAYBACK_SCREENSHOTS)
+        GQImageWriter::instance().flush();
+
     _state = STATE_LOADED;
 }
 
@@ -435,13 +440,12 @@ void Session::dumpScreenshot()
 {
     if (!_has_dumped_current_frame)
     {
-        QString filename;
-        filename.asprintf(qPrintable(_screenshot_file_pattern), _current_frame);
+        QString filename = QString::asprintf(qPrintable(_screenshot_file_pattern), _current_frame);
         _screenshot_filenames.push_back(filename);
         
-        _viewer->saveSnapshot( filename, true );
+        GQImageWriter::instance().write( _viewer->grabFramebuffer(), filename, _viewer->snapshotQuality() );
 
-        _console->print( QString("Saved %1\n").arg(filename) );
+        _console->print( QString("Writing %1\n").arg(filename) );
 
         _has_dumped_current_frame = true;
     }
@@ -0,0 +1,162 @@
+/*****************************************************************************\
+
+TrackingPipeline.cc
+Authors:
+    Pierre Benard (pierre.benard@laposte.net),
+    Forrester Cole (fcole@csail.mit.edu),
+    Jingwan Lu (jingwanl@princeton.edu)
+Copyright (c) 2012 Pierre Benard, Forrester Cole, Jingwan Lu
+
+qviewer is distributed under the terms of the GNU General Public License.
+See the COPYING file for details.
+
+\*****************************************************************************/
+
+#include "TrackingPipeline.h"
+#include "ASSnakes.h"
+
+#include <QElapsedTimer>
+
+TrackingPipeline::TrackingPipeline()
+{
+    _snakes = NULL;
+    _busy = false;
+    _stop = false;
+    setObjectName("Tracking");
+}
+
+TrackingPipeline::~TrackingPipeline()
+{
+    stop();
+    qDeleteAll(_jobs);
+}
+
+void TrackingPipeline::setup( ASSnakes* snakes )
+{
+    _snakes = snakes;
+    if (!isRunning()) {
+        _stop = false;
+        start();
+    }
+}
+
+void TrackingPipeline::stop()
+{
+    if (isRunning()) {
+        flush();
+        _mutex.lock();
+        _stop = true;
+        _submitted.wakeAll();
+        _mutex.unlock();
+        wait();
+    }
+}
+
+TrackingJob* TrackingPipeline::acquire()
+{
+    QMutexLocker locker(&_mutex);
+
+    if (!_free.isEmpty())
+        return _free.takeLast();
+
+    TrackingJob* job = new TrackingJob;
+    _jobs << job;
+    return job;
+}
+
+void TrackingPipeline::submit( TrackingJob* job )
+{
+    QMutexLocker locker(&_mutex);
+
+    _queue.enqueue(job);
+    _submitted.wakeAll();
+}
+
+void TrackingPipeline::release( TrackingJob* job )
+{
+    QMutexLocker locker(&_mutex);
+
+    _free << job;
+}
+
+int TrackingPipeline::pending() const
+{
+    QMutexLocker locker(&_mutex);
+
+    return _queue.size() + _done.size() + (_busy ? 1 : 0);
+}
+
+TrackingJob* TrackingPipeline::take()
+{
+    QMutexLocker locker(&_mutex);
+
+    while (_done.isEmpty()) {
+        if (_queue.isEmpty() && !_busy)
+            return NULL;
+        _tracked.wait(&_mutex);
+    }
+    return _done.dequeue();
+}
+
+void TrackingPipeline::waitIdle()
+{
+    QMutexLocker locker(&_mutex);
+
+    while (!_queue.isEmpty() || _busy)
+        _tracked.wait(&_mutex);
+}
+
+void TrackingPipeline::flush()
+{
+    QMutexLocker locker(&_mutex);
+
+    while (!_queue.isEmpty() || _busy)
+        _tracked.wait(&_mutex);
+    while (!_done.isEmpty())
+        _free << _done.dequeue();
+}
+
+void TrackingPipeline::run()
+{
+    QMutexLocker locker(&_mutex);
+
+    while (!_stop) {
+        if (_queue.isEmpty()) {
+            _submitted.wait(&_mutex);
+            continue;
+        }
+
+        TrackingJob* job = _queue.dequeue();
+        _busy = true;
+        locker.unlock();
+        process(job);
+        locker.relock();
+
+        _done.enqueue(job);
+        _busy = false;
+        _tracked.wakeAll();
+    }
+}
+
+void TrackingPipeline::process( TrackingJob* job )
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    // Same steps as the sequential loop of GLViewer::draw, on copies
+    _pathSet.initFromPoints(job->positions2D, job->positions, job->tangents,
+                            job->strengths, job->viewport, job->depthRange);
+    if (_pathSet.size() > 0) {
+        if (job->init) {
+            _snakes->clear();
+            _snakes->init(_pathSet, true);
+        } else {
+            _snakes->updateRefImage(job->refImg,
+                                    job->hasGeomFlow ? &job->geomFlow : NULL,
+                                    NULL, _pathSet, job->useMotion);
+        }
+    }
+    ASRenderer::buildSegments(*_snakes, job->segments, job->pathRanges, job->textureLength);
+
+    job->trackingTime = timer.nsecsElapsed() * 1e-6;
+}
@@ -0,0 +1,106 @@
+/*****************************************************************************\
+
+TrackingPipeline.h
+Authors:
+    Pierre Benard (pierre.benard@laposte.net),
+    Forrester Cole (fcole@csail.mit.edu),
+    Jingwan Lu (jingwanl@princeton.edu)
+Copyright (c) 2012 Pierre Benard, Forrester Cole, Jingwan Lu
+
+Runs the snakes tracking on a worker thread while the GL thread extracts
+the lines of the next frames. The inputs of each frame are copied into
+recycled jobs and tracked strictly in submission order, so the strokes
+are the same as with the sequential loop when it uses the CPU attraction
+field ("Contours->Relaxation->CPU attraction field"), only displayed a few
+frames later. The default GPU field blurs on the GPU, so its strokes can
+differ from the pipelined ones by the rounding of the blur. The reference image
+comes from the pack buffers of ImageSpaceLines, next to the samples.
+
+qviewer is distributed under the terms of the GNU General Public License.
+See the COPYING file for details.
+
+\*****************************************************************************/
+
+#ifndef TRACKING_PIPELINE_H_
+#define TRACKING_PIPELINE_H_
+
+#include "GQInclude.h"
+#include "GQImage.h"
+
+#include "ASClipPath.h"
+#include "ASRenderer.h"
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+#include <QList>
+
+#include <vector>
+
+struct TrackingJob {
+    // Inputs, filled on the GL thread
+    int            frame;
+    bool           init;
+    bool           useMotion;
+    QVector<vec>   positions2D;
+    QVector<vec>   positions;
+    QVector<vec2>  tangents;
+    QVector<float> strengths;
+    GLint          viewport[4];
+    GLdouble       depthRange[2];
+    GQFloatImage   refImg;
+    GQFloatImage   geomFlow;
+    bool           hasGeomFlow;
+    float          textureLength;
+
+    // Outputs, filled on the worker thread
+    std::vector<ASRenderer::Segment>   segments;
+    std::vector<ASRenderer::PathRange> pathRanges;
+    double         trackingTime;
+};
+
+class TrackingPipeline : public QThread
+{
+public:
+    TrackingPipeline();
+    ~TrackingPipeline();
+
+    void setup( ASSnakes* snakes );
+    void stop();
+
+    // Recycled job to fill on the GL thread
+    TrackingJob* acquire();
+    void submit( TrackingJob* job );
+    void release( TrackingJob* job );
+
+    // Submitted jobs not taken back yet
+    int pending() const;
+    // Oldest submitted job, blocks until it is tracked
+    TrackingJob* take();
+
+    // Blocks until every submitted job is tracked, leaving the snakes
+    // safe to read from the GL thread
+    void waitIdle();
+    // Same, and drops the results that were not taken
+    void flush();
+
+protected:
+    void run();
+    void process( TrackingJob* job );
+
+    ASSnakes*     _snakes;
+    ASClipPathSet _pathSet;
+
+    mutable QMutex _mutex;
+    QWaitCondition _submitted;
+    QWaitCondition _tracked;
+    QList<TrackingJob*>  _jobs;
+    QList<TrackingJob*>  _free;
+    QQueue<TrackingJob*> _queue;
+    QQueue<TrackingJob*> _done;
+    bool _busy;
+    bool _stop;
+};
+
+#endif // TRACKING_PIPELINE_H_
@@ -1,5 +1,6 @@
 #include "GQInclude.h"
 #include "GQShaderManager.h"
+#include "GQImageWriter.h"
 
 #include "DialsAndKnobs.h"
 
@@ -9,6 +10,7 @@
 #include <QDir>
 #include <QMessageBox>
 #include <QSurfaceFormat>
+#include <QThread>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -57,6 +59,7 @@ QDir findShadersDirectory( const QString& app_path )
 int main( int argc, char** argv )
 {
     QApplication app(argc, argv);
+    app.thread()->setObjectName("Main");
 
     QSurfaceFormat format;
     format.setVersion(2, 1);
@@ -101,5 +104,7 @@ int main( int argc, char** argv )
     window.init( working_dir, scene_name );
     window.show();
 
-    return app.exec();
+    int ret = app.exec();
+    GQImageWriter::instance().flush();
+    return ret;
 }
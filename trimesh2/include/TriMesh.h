@@ -185,6 +185,13 @@ public:
 	bool write(const char *filename);
 	bool write(const ::std::string &filename);
 
+	// Binary cache next to the source file, with the derived data
+	// computed so far. read_cache() returns NULL if the cache is
+	// missing or older than the source.
+	static ::std::string cache_filename(const char *filename);
+	static TriMesh *read_cache(const char *filename);
+	bool write_cache(const char *filename);
+
 
 	//
 	// Useful queries
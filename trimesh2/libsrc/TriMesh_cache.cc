@@ -0,0 +1,289 @@
+/*
+TriMesh_cache.cc
+Binary cache of a mesh and its derived data, stored next to the source
+file as <filename>.tmc. Sections are page-aligned so that the whole file
+can be mapped and each vector filled with a single copy.
+*/
+
+#include "TriMesh.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+# include <sys/mman.h>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+using namespace std;
+
+#define dprintf TriMesh::dprintf
+#define eprintf TriMesh::eprintf
+
+
+namespace trimesh {
+
+// Bump when the layout or the set of sections changes
+#define CACHE_VERSION 1
+#define CACHE_ALIGN 4096
+#define CACHE_ENDIAN 0x01020304u
+
+enum CacheSection {
+	CACHE_VERTICES, CACHE_FACES, CACHE_TSTRIPS, CACHE_GRID,
+	CACHE_COLORS, CACHE_CONFIDENCES, CACHE_NORMALS,
+	CACHE_TEXCOORDS, CACHE_UDIRS, CACHE_VDIRS,
+	CACHE_NSECTIONS
+};
+
+struct CacheSectionInfo {
+	unsigned elem_size;
+	unsigned pad;
+	long long count;
+	long long offset;
+};
+
+struct CacheHeader {
+	char magic[8];
+	unsigned version;
+	unsigned endian;
+	long long source_size;
+	long long source_mtime;
+	int grid_width, grid_height;
+	float bbox_min[3], bbox_max[3];
+	int bbox_valid;
+	float bsphere_center[3];
+	float bsphere_r;
+	int bsphere_valid;
+	CacheSectionInfo sections[CACHE_NSECTIONS];
+};
+
+static const char cache_magic[8] = "TMCACHE";
+
+
+// Size and modification time of the source, to detect stale caches
+static bool source_stamp(const char *filename, long long &size, long long &mtime)
+{
+	struct stat st;
+	if (stat(filename, &st) != 0)
+		return false;
+	size = (long long) st.st_size;
+	mtime = (long long) st.st_mtime;
+	return true;
+}
+
+string TriMesh::cache_filename(const char *filename)
+{
+	return string(filename) + ".tmc";
+}
+
+
+// Section table in the order of CacheSection
+template <class T>
+static void set_section(CacheHeader &h, int which, const vector<T> &v, long long &offset)
+{
+	h.sections[which].elem_size = sizeof(T);
+	h.sections[which].pad = 0;
+	h.sections[which].count = v.size();
+	h.sections[which].offset = offset;
+	long long len = (long long) (v.size() * sizeof(T));
+	offset += (len + CACHE_ALIGN - 1) / CACHE_ALIGN * CACHE_ALIGN;
+}
+
+template <class T>
+static bool write_section(FILE *f, const CacheHeader &h, int which, const vector<T> &v)
+{
+	if (v.empty())
+		return true;
+	if (fseek(f, (long) h.sections[which].offset, SEEK_SET) != 0)
+		return false;
+	return fwrite(&v[0], sizeof(T), v.size(), f) == v.size();
+}
+
+bool TriMesh::write_cache(const char *filename)
+{
+	CacheHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, cache_magic, sizeof(h.magic));
+	h.version = CACHE_VERSION;
+	h.endian = CACHE_ENDIAN;
+	if (!source_stamp(filename, h.source_size, h.source_mtime))
+		return false;
+	h.grid_width = grid_width;
+	h.grid_height = grid_height;
+	for (int i = 0; i < 3; i++) {
+		h.bbox_min[i] = bbox.min[i];
+		h.bbox_max[i] = bbox.max[i];
+		h.bsphere_center[i] = bsphere.center[i];
+	}
+	h.bbox_valid = bbox.valid;
+	h.bsphere_r = bsphere.r;
+	h.bsphere_valid = bsphere.valid;
+
+	long long offset = CACHE_ALIGN;
+	set_section(h, CACHE_VERTICES, vertices, offset);
+	set_section(h, CACHE_FACES, faces, offset);
+	set_section(h, CACHE_TSTRIPS, tstrips, offset);
+	set_section(h, CACHE_GRID, grid, offset);
+	set_section(h, CACHE_COLORS, colors, offset);
+	set_section(h, CACHE_CONFIDENCES, confidences, offset);
+	set_section(h, CACHE_NORMALS, normals, offset);
+	set_section(h, CACHE_TEXCOORDS, texcoords, offset);
+	set_section(h, CACHE_UDIRS, udirs, offset);
+	set_section(h, CACHE_VDIRS, vdirs, offset);
+
+	// Written under a temporary name, then renamed, so that a concurrent
+	// reader never sees a partial file
+	string cachename = cache_filename(filename);
+	char tmpname[1024];
+	sprintf(tmpname, "%.900s.%p.tmp", cachename.c_str(), (void *) this);
+	FILE *f = fopen(tmpname, "wb");
+	if (!f) {
+		eprintf("Error opening [%s] for writing: %s.\n", tmpname,
+			strerror(errno));
+		return false;
+	}
+
+	bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+		write_section(f, h, CACHE_VERTICES, vertices) &&
+		write_section(f, h, CACHE_FACES, faces) &&
+		write_section(f, h, CACHE_TSTRIPS, tstrips) &&
+		write_section(f, h, CACHE_GRID, grid) &&
+		write_section(f, h, CACHE_COLORS, colors) &&
+		write_section(f, h, CACHE_CONFIDENCES, confidences) &&
+		write_section(f, h, CACHE_NORMALS, normals) &&
+		write_section(f, h, CACHE_TEXCOORDS, texcoords) &&
+		write_section(f, h, CACHE_UDIRS, udirs) &&
+		write_section(f, h, CACHE_VDIRS, vdirs);
+	// Pad the last section so that the file size is a whole number of pages
+	if (ok && offset > CACHE_ALIGN) {
+		char zero = 0;
+		ok = fseek(f, (long) (offset - 1), SEEK_SET) == 0 &&
+			fwrite(&zero, 1, 1, f) == 1;
+	}
+	ok = (fclose(f) == 0) && ok;
+
+#ifdef _WIN32
+	remove(cachename.c_str());
+#endif
+	if (!ok || rename(tmpname, cachename.c_str()) != 0) {
+		eprintf("Error writing mesh cache [%s].\n", cachename.c_str());
+		remove(tmpname);
+		return false;
+	}
+	dprintf("Wrote mesh cache %s\n", cachename.c_str());
+	return true;
+}
+
+
+template <class T>
+static bool read_section(const char *data, long long size, const CacheHeader &h,
+                         int which, vector<T> &v)
+{
+	const CacheSectionInfo &s = h.sections[which];
+	if (s.count == 0) {
+		v.clear();
+		return true;
+	}
+	if (s.elem_size != sizeof(T) || s.offset < 0 ||
+	    s.offset + s.count * (long long) sizeof(T) > size)
+		return false;
+	const T *begin = (const T *) (data + s.offset);
+	v.assign(begin, begin + s.count);
+	return true;
+}
+
+static bool read_cache_data(const char *data, long long size,
+                            long long source_size, long long source_mtime,
+                            TriMesh *mesh)
+{
+	if (size < (long long) sizeof(CacheHeader))
+		return false;
+	CacheHeader h;
+	memcpy(&h, data, sizeof(h));
+	if (memcmp(h.magic, cache_magic, sizeof(h.magic)) != 0 ||
+	    h.version != CACHE_VERSION || h.endian != CACHE_ENDIAN ||
+	    h.source_size != source_size || h.source_mtime != source_mtime)
+		return false;
+
+	if (!read_section(data, size, h, CACHE_VERTICES, mesh->vertices) ||
+	    !read_section(data, size, h, CACHE_FACES, mesh->faces) ||
+	    !read_section(data, size, h, CACHE_TSTRIPS, mesh->tstrips) ||
+	    !read_section(data, size, h, CACHE_GRID, mesh->grid) ||
+	    !read_section(data, size, h, CACHE_COLORS, mesh->colors) ||
+	    !read_section(data, size, h, CACHE_CONFIDENCES, mesh->confidences) ||
+	    !read_section(data, size, h, CACHE_NORMALS, mesh->normals) ||
+	    !read_section(data, size, h, CACHE_TEXCOORDS, mesh->texcoords) ||
+	    !read_section(data, size, h, CACHE_UDIRS, mesh->udirs) ||
+	    !read_section(data, size, h, CACHE_VDIRS, mesh->vdirs))
+		return false;
+
+	mesh->grid_width = h.grid_width;
+	mesh->grid_height = h.grid_height;
+	for (int i = 0; i < 3; i++) {
+		mesh->bbox.min[i] = h.bbox_min[i];
+		mesh->bbox.max[i] = h.bbox_max[i];
+		mesh->bsphere.center[i] = h.bsphere_center[i];
+	}
+	mesh->bbox.valid = (h.bbox_valid != 0);
+	mesh->bsphere.r = h.bsphere_r;
+	mesh->bsphere.valid = (h.bsphere_valid != 0);
+	return true;
+}
+
+TriMesh *TriMesh::read_cache(const char *filename)
+{
+	long long source_size, source_mtime;
+	if (!source_stamp(filename, source_size, source_mtime))
+		return NULL;
+
+	string cachename = cache_filename(filename);
+	TriMesh *mesh = new TriMesh();
+	bool ok = false;
+
+#ifndef _WIN32
+	int fd = open(cachename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		delete mesh;
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED) {
+			madvise(data, st.st_size, MADV_SEQUENTIAL);
+			ok = read_cache_data((const char *) data, st.st_size,
+			                     source_size, source_mtime, mesh);
+			munmap(data, st.st_size);
+		}
+	}
+	close(fd);
+#else
+	FILE *f = fopen(cachename.c_str(), "rb");
+	if (!f) {
+		delete mesh;
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (size > 0) {
+		vector<char> data(size);
+		if (fread(&data[0], 1, size, f) == (size_t) size)
+			ok = read_cache_data(&data[0], size, source_size, source_mtime, mesh);
+	}
+	fclose(f);
+#endif
+
+	if (!ok) {
+		dprintf("Ignoring stale or invalid mesh cache %s\n", cachename.c_str());
+		delete mesh;
+		return NULL;
+	}
+	dprintf("Read %s from cache: %lu vertices, %lu faces\n", filename,
+		(unsigned long) mesh->vertices.size(), (unsigned long) mesh->faces.size());
+	return mesh;
+}
+
+} // namespace trimesh
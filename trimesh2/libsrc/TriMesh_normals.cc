@@ -241,6 +241,8 @@ void TriMesh::need_uv_dirs()
         return;
 
     int nv = vertices.size();
+    if ((int) udirs.size() == nv && (int) vdirs.size() == nv)
+        return;
 	udirs.clear();
 	vdirs.clear();
 	udirs.resize(nv);